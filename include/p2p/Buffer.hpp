@@ -0,0 +1,93 @@
+#pragma once
+
+#include "p2p/BoundedQueue.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace p2p {
+
+// read-only span over bytes owned elsewhere
+class ByteView {
+public:
+    ByteView() = default;
+    ByteView(const uint8_t* data, size_t size) : data_(data), size_(size) {}
+    ByteView(const std::vector<uint8_t>& v) : data_(v.data()), size_(v.size()) {}
+
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    const uint8_t* begin() const { return data_; }
+    const uint8_t* end() const { return data_ + size_; }
+    uint8_t operator[](size_t i) const { return data_[i]; }
+
+    // bytes [off, off + n), clamped to the view
+    ByteView sub(size_t off, size_t n = SIZE_MAX) const {
+        if (off > size_) off = size_;
+        if (n > size_ - off) n = size_ - off;
+        return ByteView(data_ + off, n);
+    }
+    std::vector<uint8_t> toVector() const { return std::vector<uint8_t>(begin(), end()); }
+
+private:
+    const uint8_t* data_{nullptr};
+    size_t size_{0};
+};
+
+class BufferPool;
+
+// one reference to a pooled block; copies share the block, the last one
+// to go hands it back to its pool
+class BufferRef {
+public:
+    BufferRef() = default;
+    BufferRef(const BufferRef& o);
+    BufferRef(BufferRef&& o) noexcept : b_(o.b_) { o.b_ = nullptr; }
+    BufferRef& operator=(BufferRef o) noexcept { std::swap(b_, o.b_); return *this; }
+    ~BufferRef();
+
+    explicit operator bool() const { return b_ != nullptr; }
+    uint8_t* data() const;
+    size_t capacity() const;
+
+private:
+    friend class BufferPool;
+    struct Block;
+    explicit BufferRef(Block* b) : b_(b) {}
+    Block* b_{nullptr};
+};
+
+// fixed-size blocks recycled through a lock-free free list, so steady-state
+// receive does not touch the allocator. Blocks still referenced when the pool
+// goes away are freed by their last reference.
+class BufferPool {
+public:
+    explicit BufferPool(size_t blockSize, size_t maxFree = 4096);
+    ~BufferPool();
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    BufferRef acquire();
+    size_t blockSize() const { return shared_->blockSize; }
+    // a block of any size that belongs to no pool, for the odd message larger
+    // than a pooled block; freed by its last reference
+    static BufferRef allocate(size_t size);
+
+private:
+    friend class BufferRef;
+    struct Shared {
+        Shared(size_t bs, size_t maxFree) : blockSize(bs), free(maxFree) {}
+        size_t blockSize;
+        BoundedQueue<BufferRef::Block*> free;
+        std::atomic<bool> closed{false};
+    };
+    std::shared_ptr<Shared> shared_;
+
+    static void release(BufferRef::Block* b);
+};
+
+} // namespace p2p
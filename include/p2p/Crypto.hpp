@@ -5,6 +5,7 @@
 #include <vector>
 #include <string>
 #include <cstdint>
+#include <optional>
 
 namespace p2p::crypto {
 
@@ -20,4 +21,25 @@ std::vector<uint8_t> encrypt(const KeyBytes& senderPriv, const KeyBytes& recipie
 // decrypt with crypto_box
 std::vector<uint8_t> decrypt(const KeyBytes& recipientPriv, const KeyBytes& senderPub, const std::vector<uint8_t>& ciphertext);
 
+// precomputed crypto_box key (the X25519 step), same for both directions;
+// nullopt for a public key that yields no secret (a low-order point)
+using SharedKey = std::array<uint8_t, 32>;
+std::optional<SharedKey> beforenm(const KeyBytes& ourPriv, const KeyBytes& theirPub);
+void wipe(SharedKey& key);
+
+// same wire format as encrypt/decrypt, minus the scalar multiplication
+std::vector<uint8_t> encryptAfternm(const SharedKey& key, const std::vector<uint8_t>& plaintext);
+std::vector<uint8_t> decryptAfternm(const SharedKey& key, const std::vector<uint8_t>& ciphertext);
+// decrypt over the ciphertext; plaintext ends up at buf + 24, ptLen bytes
+bool decryptAfternmInPlace(const SharedKey& key, uint8_t* buf, size_t len, size_t& ptLen);
+
+// XChaCha20-Poly1305; ciphertext carries the 16-byte tag, nonce is the caller's
+using AeadKey = std::array<uint8_t, 32>;
+using AeadNonce = std::array<uint8_t, 24>;
+constexpr size_t kAeadTagBytes = 16;
+std::vector<uint8_t> aeadEncrypt(const AeadKey& key, const AeadNonce& nonce, const std::vector<uint8_t>& ad, const std::vector<uint8_t>& plaintext);
+bool aeadDecrypt(const AeadKey& key, const AeadNonce& nonce, const std::vector<uint8_t>& ad, const std::vector<uint8_t>& ciphertext, std::vector<uint8_t>& plaintext);
+// decrypt over the ciphertext; plaintext starts at buf, ptLen bytes
+bool aeadDecryptInPlace(const AeadKey& key, const AeadNonce& nonce, const uint8_t* ad, size_t adLen, uint8_t* buf, size_t len, size_t& ptLen);
+
 } // namespace p2p::crypto
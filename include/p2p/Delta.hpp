@@ -0,0 +1,55 @@
+#pragma once
+
+#include "p2p/Buffer.hpp"
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <vector>
+
+namespace p2p::delta {
+
+// rsync-style block signatures of a basis file. A block of the new file
+// matches when its rolling weak checksum and its BLAKE2b-128 hash both agree;
+// the weak one is cheap enough to test at every byte offset.
+using Strong = std::array<uint8_t, 16>;
+struct Sig {
+    uint32_t weak{0};
+    Strong strong{};
+};
+
+// a = sum of bytes, b = sum of (n - i) * byte, both mod 2^16
+class Rolling {
+public:
+    void reset(const uint8_t* p, size_t n);
+    void roll(uint8_t out, uint8_t in) {
+        a_ += in - out;
+        b_ += a_ - static_cast<uint32_t>(n_) * out;
+    }
+    uint32_t value() const { return (a_ & 0xFFFF) | (b_ << 16); }
+
+private:
+    uint32_t a_{0}, b_{0};
+    size_t n_{0};
+};
+
+Sig sign(const uint8_t* p, size_t n);
+Strong strong(const uint8_t* p, size_t n);
+
+// about the square root of the basis size, as rsync picks it
+uint32_t blockSize(uint64_t basisSize);
+
+// bytes [at, at + blockSize) of the new file equal basis block `block`
+struct Ref {
+    uint64_t at{0};
+    uint32_t block{0};
+};
+
+// finds basis blocks in the size-byte new file; refs come sorted and disjoint,
+// and none at all if a read fails. read returns [off, off + len), valid until
+// the next call, or nullopt if it cannot be read
+using Source = std::function<std::optional<ByteView>(uint64_t off, size_t len)>;
+std::vector<Ref> match(const std::vector<Sig>& sigs, uint32_t blockSize, uint64_t size, const Source& read);
+
+} // namespace p2p::delta
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace p2p {
+
+// resolved UDP address, IPv4 or IPv6, kept in binary form. Peers, routes and
+// the transport compare and hash these; text only appears when parsing user
+// input and for display.
+struct Endpoint {
+    enum class Family : uint8_t { None = 0, V4 = 4, V6 = 6 };
+
+    Family family{Family::None};
+    uint16_t port{0};
+    std::array<uint8_t, 16> addr{}; // network order; v4 uses the first 4 bytes
+    uint32_t scope{0};              // v6 interface index (sin6_scope_id); link-local needs it
+
+    Endpoint() = default;
+    // numeric address only (no DNS), v6 optionally with "%if" or "%index";
+    // an unparsable ip leaves the endpoint invalid
+    Endpoint(const std::string& ip, uint16_t port);
+
+    static Endpoint v4(const uint8_t bytes[4], uint16_t port);
+    static Endpoint v6(const uint8_t bytes[16], uint16_t port, uint32_t scope = 0);
+
+    bool valid() const { return family != Family::None && port != 0; }
+    size_t addrLen() const { return family == Family::V6 ? 16 : family == Family::V4 ? 4 : 0; }
+    // same address, any port
+    bool sameHost(const Endpoint& o) const {
+        return family == o.family && scope == o.scope && std::memcmp(addr.data(), o.addr.data(), addrLen()) == 0;
+    }
+
+    std::string ip() const;       // "10.0.0.1" / "fe80::1%2"
+    std::string toString() const; // "10.0.0.1:9000" / "[fe80::1%2]:9000"
+
+    bool operator==(const Endpoint& o) const { return port == o.port && sameHost(o); }
+    bool operator!=(const Endpoint& o) const { return !(*this == o); }
+};
+
+struct EndpointHash {
+    size_t operator()(const Endpoint& e) const {
+        // FNV-1a over the bytes that matter
+        uint64_t h = 1469598103934665603ull;
+        auto mix = [&](uint8_t b){ h ^= b; h *= 1099511628211ull; };
+        mix(static_cast<uint8_t>(e.family));
+        for (size_t i = 0; i < e.addrLen(); ++i) mix(e.addr[i]);
+        for (int s = 0; s < 32; s += 8) mix(static_cast<uint8_t>(e.scope >> s));
+        mix(e.port >> 8); mix(e.port & 0xFF);
+        return static_cast<size_t>(h);
+    }
+};
+
+} // namespace p2p
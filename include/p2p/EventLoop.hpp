@@ -0,0 +1,70 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+namespace p2p {
+
+// reactor: fd readiness + timers, one thread can serve many sockets
+class EventLoop {
+public:
+    enum Events : uint32_t { Readable = 1u << 0, Writable = 1u << 1 };
+    enum class Backend { Auto, Epoll, Select };
+
+    using IoCallback = std::function<void(uint32_t events)>;
+    using TimerCallback = std::function<void()>;
+    using TimerId = uint64_t;
+
+    virtual ~EventLoop() = default;
+
+    // epoll on linux, select elsewhere (or when asked for)
+    static std::unique_ptr<EventLoop> create(Backend backend = Backend::Auto);
+
+    // edge-triggered backends only report transitions; callbacks must drain until EAGAIN
+    virtual bool edgeTriggered() const = 0;
+    virtual bool add(int fd, uint32_t events, IoCallback cb) = 0;
+    virtual bool modify(int fd, uint32_t events) = 0;
+    virtual void remove(int fd) = 0;
+    // interrupt a blocked runOnce from another thread
+    virtual void wakeup() {}
+
+    // timers fire on the loop thread; safe to add/cancel from any thread
+    TimerId addTimer(std::chrono::milliseconds delay, TimerCallback cb, bool repeat = false);
+    void cancelTimer(TimerId id);
+
+    // wait for io or the next timer (at most maxWaitMs), then dispatch
+    void runOnce(int maxWaitMs);
+
+protected:
+    // block up to timeoutMs and run io callbacks
+    virtual void wait(int timeoutMs) = 0;
+
+private:
+    using Clock = std::chrono::steady_clock;
+    struct Timer {
+        TimerCallback cb;
+        std::chrono::milliseconds interval{0};
+        bool repeat{false};
+    };
+    struct Due {
+        Clock::time_point at;
+        TimerId id;
+        bool operator>(const Due& o) const { return at > o.at; }
+    };
+
+    std::mutex timerMtx_;
+    std::priority_queue<Due, std::vector<Due>, std::greater<Due>> heap_{};
+    std::unordered_map<TimerId, Timer> timers_{};
+    TimerId nextTimer_{1};
+
+    int nextTimeout(int maxWaitMs);
+    void fireTimers();
+};
+
+} // namespace p2p
@@ -1,42 +1,428 @@
 #pragma once
 
 #include "p2p/Node.hpp"
+#include "p2p/Merkle.hpp"
+#include "p2p/Delta.hpp"
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <map>
 #include <unordered_map>
 #include <optional>
 #include <fstream>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
 
 namespace p2p {
 
 class FileTransfer {
 public:
+    // limits on incomplete incoming transfers. Each is charged what it can
+    // come to hold: its bitmap, verified page hashes, chunks that overtook
+    // their page, and in memory mode the whole file. In disk mode the file's
+    // size is charged against the disk budgets instead, and a file that does
+    // not fit the free space is refused before anything is allocated
+    struct Options {
+        uint64_t maxBytes = uint64_t(1) << 30;         // all transfers together
+        uint64_t maxBytesPerPeer = uint64_t(512) << 20; // those a peer offered; downloads are not counted
+        uint64_t maxDiskBytes = uint64_t(64) << 30;     // disk mode: all partial files together
+        uint64_t maxDiskBytesPerPeer = uint64_t(8) << 30; // those a peer offered
+        uint32_t maxUnits = uint32_t(1) << 26;         // chunks plus pages of one file
+        // dropped after this long without a unit; disk-mode progress stays for a resume
+        std::chrono::seconds idleTimeout{120};
+        // disk mode: partial files of dropped transfers are removed once untouched this long
+        std::chrono::seconds partialTtl{std::chrono::hours(24 * 7)};
+    };
+
+    struct Stats {
+        size_t incoming{0};    // incomplete incoming transfers
+        uint64_t reserved{0};  // bytes charged to them
+        uint64_t diskReserved{0}; // disk mode: sizes of their partial files
+        uint64_t evicted{0};   // dropped while idle, or to make room
+        uint64_t rejected{0};  // refused: over budget or implausibly large
+        uint64_t stalled{0};   // sends and downloads given up after repeated timeouts
+    };
+
     explicit FileTransfer(Node& node);
+    FileTransfer(Node& node, Options opts);
+    ~FileTransfer();
+
+    Stats stats() const;
 
     using FileHandler = std::function<void(const PeerId& from, const std::string& name, const std::vector<uint8_t>& data)>;
+    using SavedHandler = std::function<void(const PeerId& from, const std::string& name, const std::string& path)>;
     void onFile(FileHandler cb) { onFile_ = std::move(cb); }
+    // stream incoming files into dir instead of memory: chunks are written at
+    // their offset into a preallocated "<dir>/.<root>.part" and the finished file
+    // is renamed to its (sanitised, never clobbering) name. Progress is kept in
+    // "<dir>/.<root>.state", so when the same content is offered again after
+    // either side restarted, only the missing chunks are sent. Memory per
+    // transfer is one bit per chunk. With replace, a finished file takes the
+    // place of the same-named one in dir, and the old contents serve as a
+    // basis: the sender fetches their rsync-style block signatures and sends
+    // each page it can rebuild from basis blocks as a list of block references
+    // instead of its chunks. Call before the node starts
+    void receiveToDirectory(const std::string& dir, SavedHandler cb, bool replace = false);
+
+    // the file is read in bounded windows, so memory does not grow with its
+    // size, and a file that shrinks meanwhile ends the transfer (false).
+    // chunkSize 0 sizes chunks to fill one datagram on the path to dest as
+    // known now; the root depends on it, so pass a fixed size where the same
+    // content must keep the same root across paths
+    bool sendFile(const PeerId& dest, const std::string& path, size_t chunkSize = 0);
+    // Files are content-addressed: a manifest names the BLAKE2b Merkle root of
+    // the chunks, the receiver answers with what it already holds, and every
+    // chunk is checked against the root before it is written.
+    // Both block until the receiver has acknowledged every chunk (true) or the
+    // transfer stalls through repeated retransmission timeouts (false). Acks
+    // arrive on the node's threads, so called from a handler or timer they
+    // return false at once instead of stalling them.
+    // Chunks go out in a congestion window: the receiver acks each one with a
+    // cumulative index plus a selective-ack bitmap, losses are retransmitted
+    // after an RTT-derived timeout or once later chunks get through, and the
+    // window grows additively and halves on loss
+    bool sendBuffer(const PeerId& dest, const std::string& name, const std::vector<uint8_t>& data, size_t chunkSize = 0);
 
-    bool sendFile(const PeerId& dest, const std::string& path, size_t chunkSize = 1024);
-    bool sendBuffer(const PeerId& dest, const std::string& name, const std::vector<uint8_t>& data, size_t chunkSize = 1024);
+    // Swarm distribution. Shared content is served to any peer that asks for
+    // its root; the returned root is what downloaders name. Files stay open
+    // and are read per request. chunkSize 0 fills a datagram on any path
+    std::optional<merkle::Hash> share(const std::string& path, size_t chunkSize = 0);
+    std::optional<merkle::Hash> shareBuffer(const std::string& name, std::vector<uint8_t> data, size_t chunkSize = 0);
+    void unshare(const merkle::Hash& root);
+    // Pull content by root from every listed peer that has it (every known
+    // peer when empty). Holders report which chunks they have; the rarest are
+    // requested first, each from the holder with the most free window, and
+    // requests a slow peer sits on are moved to a faster one. Chunks already
+    // received are served to other downloaders meanwhile, and the finished
+    // file stays shared until unshare. The file is delivered through onFile /
+    // receiveToDirectory. Blocks until complete (true) or nothing arrives for
+    // 15 s (false); like sendFile, never from the node's own threads
+    bool download(const merkle::Hash& root, const std::vector<PeerId>& peers = {});
 
 private:
+    using Clock = std::chrono::steady_clock;
+    static constexpr uint32_t kMaxWindow = 1024;    // units in flight
+    static constexpr double kInitialWindow = 10;
+    static constexpr uint64_t kReorderThresh = 3;   // later acked sends before a unit counts as lost
+    static constexpr unsigned kMaxBackoffs = 15;    // consecutive timeouts before giving up (~1 min)
+    static constexpr size_t kSackBytes = 32;        // selective ack covers 256 units past the cumulative ack
+    static constexpr size_t kFinishedMemory = 1024; // completed transfers still re-acked
+    static constexpr size_t kMaxRanges = 128;       // held ranges reported in a resume
+    static constexpr uint32_t kStateFlush = 256;    // units between progress file updates
+    static constexpr uint32_t kPullSpan = 4096;     // units past the first missing one a download requests
+    static constexpr size_t kPullBatch = 64;        // units per request message
+    static constexpr uint32_t kPullWake = 8;        // answers between scheduling passes
+    static constexpr uint32_t kSigBatch = 64;       // block signatures per message
+    static constexpr size_t kSigWindow = 32;        // signature requests outstanding
+    static constexpr unsigned kSigRetries = 4;      // timeouts in a row before sending without the basis
+    static constexpr size_t kMaxPieces = 24;        // basis ranges per copied page
+    static constexpr uint8_t kCopyTries = 3;        // transmissions of a copy before its chunks go as data
+    static constexpr auto kRequery = std::chrono::seconds(1); // partial holders are asked again for what they gained
+    static constexpr auto kPullStall = std::chrono::seconds(15);
+    static constexpr auto kLayoutTrial = std::chrono::seconds(3); // without a verified page before another holder's layout is tried
+    static constexpr auto kQueueWait = std::chrono::milliseconds(1); // pause after the send queue filled up
+    static constexpr size_t kMaxEarlyBytes = 1 << 20; // per transfer
+    static constexpr size_t kMaxOpenPages = 256;      // pages with verified hashes still waiting on chunks
+    static constexpr auto kEvictIdle = std::chrono::seconds(5); // idle enough to make room for a new transfer
+    static constexpr auto kPartialScan = std::chrono::minutes(1); // between looks for partial files past partialTtl
+    static constexpr auto kAckDelay = std::chrono::milliseconds(0); // held acks go out once the loop has handled what it just read
+
     Node& node_;
+    Options opts_;
+    struct Guard {
+        std::shared_mutex mtx;
+        FileTransfer* self{nullptr};
+    };
+    std::shared_ptr<Guard> guard_;
     FileHandler onFile_{};
+    SavedHandler onSaved_{};
+    std::string saveDir_{};
+    bool replace_{false};
 
+    // the first 16 bytes of the Merkle root; uniformly random, so any 8 make a hash
     using FileId = std::array<uint8_t, 16>;
-    struct Incoming {
+    struct FileIdHash {
+        size_t operator()(const FileId& id) const {
+            size_t h = 0;
+            std::memcpy(&h, id.data(), sizeof(h));
+            return h;
+        }
+    };
+
+    // A transfer is a sequence of units: each page of leaf hashes (plus its
+    // proof) directly followed by the chunks it covers, so unit p*17 is page p
+    // and unit p*17+1+k is chunk p*16+k. Acks and resume ranges count units.
+    struct Layout {
+        uint64_t size{0};
+        uint32_t chunkSize{0};
+        uint32_t chunks{0};
+        uint32_t pages{0};
+        static bool make(uint64_t size, uint32_t chunkSize, Layout& out);
+        uint32_t units() const { return chunks + pages; }
+        size_t chunkLen(uint32_t i) const;
+        static uint32_t pageUnit(uint32_t p) { return p * (merkle::kPageLeaves + 1); }
+        static uint32_t chunkUnit(uint32_t c) { return pageUnit(c / merkle::kPageLeaves) + 1 + c % merkle::kPageLeaves; }
+        // false for page units; chunk gets the chunk index otherwise
+        static bool isChunk(uint32_t unit, uint32_t& chunk);
+        uint32_t leavesIn(uint32_t p) const { return std::min(merkle::kPageLeaves, chunks - p * merkle::kPageLeaves); }
+        bool operator==(const Layout& o) const { return size == o.size && chunkSize == o.chunkSize; }
+        bool operator!=(const Layout& o) const { return !(*this == o); }
+    };
+    struct Manifest {
+        merkle::Hash root{};
+        Layout layout;
         std::string name;
-        uint32_t total{0};
+    };
+
+    struct Incoming {
+        Manifest m;
         uint32_t received{0};
-        std::vector<std::optional<std::vector<uint8_t>>> chunks;
+        std::vector<uint64_t> have;   // completion bitmap, one bit per unit
+        uint32_t next{0};             // lowest unit still missing
+        uint32_t high{0};             // one past the highest unit received
+        // verified leaf hashes of pages whose chunks are still arriving
+        std::unordered_map<uint32_t, std::vector<merkle::Hash>> leaves;
+        // chunks that overtook their page: acked, checked and written once it arrives
+        std::unordered_map<uint32_t, std::vector<uint8_t>> early;
+        size_t earlyBytes{0};
+        // page roots as pages verify, so a finished download can seed without rehashing
+        std::vector<merkle::Hash> pageRoots;
+        uint32_t rootsKnown{0};
+        std::vector<uint8_t> data;    // memory mode: the whole file, filled in place
+        int fd{-1};                   // disk mode
+        int stateFd{-1};
+        std::string partPath, statePath;
+        int basisFd{-1};              // replace mode: the file being replaced
+        uint64_t basisSize{0};
+        uint32_t blockSize{0};
+        uint32_t unsaved{0};          // units received since the progress file was written
+        uint32_t dirtyLo{UINT32_MAX}, dirtyHi{0}; // bitmap words changed since then
+        PeerId peer{};                // who offered it; zero for our own downloads
+        uint64_t cost{0};             // charged against the budgets
+        uint64_t disk{0};             // charged against the disk budgets
+        Clock::time_point activeAt{}; // last unit received
+        bool ackHeld{false};          // an in-order unit not yet acked, see kAckDelay
+        uint32_t ackEcho{0};
+        PeerId ackTo{};
+        bool has(uint32_t u) const { return have[u / 64] >> (u % 64) & 1; }
+        void set(uint32_t u) { have[u / 64] |= uint64_t(1) << (u % 64); }
+        // holds something checked against the root, so its layout is the right one
+        bool verified() const { return rootsKnown || received > early.size(); }
+    };
+    std::mutex inMtx_;
+    std::unordered_map<FileId, Incoming, FileIdHash> in_;
+    using InIter = std::unordered_map<FileId, Incoming, FileIdHash>::iterator;
+    // duplicates of a finished transfer are answered with a full ack
+    std::unordered_map<FileId, uint32_t, FileIdHash> finished_;
+    std::deque<FileId> finishedOrder_;
+    EventLoop::TimerId sweepTimer_{0};
+    Clock::time_point scannedAt_{}; // last look for stale partial files
+    std::atomic<size_t> incoming_{0};
+    std::atomic<uint64_t> reserved_{0}, diskReserved_{0}, evicted_{0}, rejected_{0}, stalled_{0};
+
+    // sender side: window slots, unit i lives in ring[i % ring.size()]
+    struct Slot {
+        Clock::time_point sentAt{};
+        uint64_t seq{0};   // transmission order
+        uint8_t tx{0};     // transmissions so far
+        bool acked{false};
+        bool lost{false};  // waiting for retransmit
+        bool deferred{false}; // chunk of a page sent as a copy: only sent if the copy fails
+    };
+    // per page when the receiver offered a basis
+    enum class Copy : uint8_t {
+        Plain, // sent as leaves and chunks
+        Ready, // some chunks lie entirely in basis blocks
+        Sent,  // went out as a copy; those chunks wait
+        Done   // the copy was acked, and with it those chunks
+    };
+    struct Outgoing {
+        PeerId peer{};
+        uint32_t total{0};       // units
+        uint32_t base{0};        // every unit below is acknowledged
+        uint32_t next{0};        // first unit never sent
+        uint32_t inflight{0};
+        uint32_t recover{0};     // losses below this belong to the current window cut
+        uint64_t seq{0};
+        uint64_t ackedSeq{0};    // newest transmission known to have arrived
+        double cwnd{kInitialWindow};
+        double ssthresh{kMaxWindow};
+        bool haveRtt{false};
+        Clock::duration srtt{}, rttvar{};
+        Clock::duration rto{std::chrono::seconds(1)};
+        unsigned backoffs{0};
+        bool probed{false};      // a tail loss probe went out since the last ack
+        bool probe{false};       // send one unit beyond the window
+        bool resumed{false};     // the receiver answered the manifest
+        Clock::time_point resumedAt{};
+        std::vector<std::pair<uint32_t, uint32_t>> held; // [start, end) units the receiver already has
+        size_t heldAt{0};
+        uint64_t basisSize{0};   // the receiver's older copy, when it offers one
+        uint32_t blockSize{0};
+        std::vector<delta::Sig> sigs;
+        std::vector<bool> sigGot; // per signature batch
+        uint32_t sigsLeft{0};
+        std::vector<Copy> copy;
+        std::vector<uint16_t> copied; // per page: the chunks a copy rebuilds
+        std::vector<Slot> ring;
+        std::condition_variable cv;
+    };
+    std::mutex outMtx_;
+    std::map<std::pair<PeerId, FileId>, Outgoing*> out_; // guarded by outMtx_
+
+    // content served to downloaders
+    struct Share {
+        Manifest m;
+        merkle::PageTree tree;
+        std::vector<uint8_t> data; // shareBuffer
+        int fd{-1};                // share
     };
-    std::unordered_map<std::string, Incoming> in_; // key: hex(fileId)
+    std::mutex shareMtx_;
+    std::unordered_map<FileId, std::unique_ptr<Share>, FileIdHash> shares_;
+
+    // downloader side: one entry per peer that reported the content. Only the
+    // root is known up front; size and chunk size are each holder's word, so
+    // a holder whose layout differs from the one being fetched is kept as a
+    // candidate and does not count
+    struct Source {
+        PeerId peer{};
+        Manifest m;              // as this holder reported it
+        bool seed{false};
+        bool counted{false};     // its layout is the one being fetched
+        bool bad{false};         // answered with a unit that failed to verify
+        std::vector<uint64_t> have; // partial holder: one bit per chunk
+        double window{kInitialWindow};
+        double ssthresh{kMaxWindow};
+        uint32_t inflight{0};
+        bool haveRtt{false};
+        Clock::duration srtt{}, rttvar{};
+        Clock::duration rto{std::chrono::seconds(1)};
+        Clock::time_point cutAt{};
+        uint64_t seq{0};
+        uint64_t ackedSeq{0};    // newest request answered
+        bool holds(uint32_t unit) const;
+    };
+    struct Request {
+        uint32_t source{0};
+        Clock::time_point sentAt{};
+        uint64_t seq{0};   // holders answer in order, so one is lost once a later one is answered
+        bool moved{false}; // taken from another source; no RTT sample
+    };
+    struct Pull {
+        merkle::Hash root{};
+        std::vector<Source> sources;
+        uint32_t seeds{0};               // counted sources only
+        std::vector<uint16_t> partial;   // counted partial holders per unit
+        std::vector<Layout> tried;       // layouts given up on
+        Clock::time_point layoutAt{};    // when the current one was taken
+        std::unordered_map<uint32_t, Request> pending;
+        uint32_t arrived{0};             // answers since the last schedule pass
+        bool wake{false};                // schedule again without waiting
+        Clock::time_point progressAt{};
+        bool done{false};
+        bool handover{false};            // complete, handlers running
+        // the finished file, seeded afterwards
+        Manifest m;
+        std::vector<merkle::Hash> pageRoots;
+        std::vector<uint8_t> data;
+        std::string path;
+        std::condition_variable cv;
+    };
+    std::unordered_map<FileId, Pull*, FileIdHash> pulls_; // guarded by inMtx_
+
+    // random-access view of [off, off+len) of the file being sent; valid until
+    // the next call, nullopt if it cannot be read
+    using ChunkSource = std::function<std::optional<ByteView>(uint64_t off, size_t len)>;
+    bool sendChunks(const PeerId& dest, const std::string& name, uint64_t size, size_t chunkSize,
+                    const ChunkSource& read);
+    void handleManifest(const PeerId& from, ByteView body);
+    void handleResume(const PeerId& from, ByteView body);
+    void handleChunk(const PeerId& from, ByteView body, bool copy = false);
+    void handleAck(const PeerId& from, ByteView body);
+    void handleQuery(const PeerId& from, ByteView body);
+    void handleHave(const PeerId& from, ByteView body);
+    void handleRequest(const PeerId& from, ByteView body);
+    void handleSigRequest(const PeerId& from, ByteView body);
+    void handleSigs(const PeerId& from, ByteView body);
+    // sends a held ack whose next unit did not come in time
+    void flushAck(const FileId& id);
+    // a unit left the send queue: its send time starts now, not when it was queued
+    void sentOut(const PeerId& dest, const FileId& id, uint32_t unit, uint8_t tx);
+    // outMtx_ held: the basis signatures, empty when the receiver stops answering
+    std::vector<delta::Sig> fetchSignatures(Outgoing& o, const FileId& id, std::unique_lock<std::mutex>& lock);
+    // bytes [at, at+len) of a page are bytes [off, off+len) of the basis
+    struct Piece {
+        uint32_t at{0};
+        uint64_t off{0};
+        uint32_t len{0};
+    };
+    using Pieces = std::vector<Piece>;
+    // the pieces covering whole chunks of page p; returns which chunks they cover
+    static uint16_t copyPieces(const Layout& L, const std::vector<delta::Ref>& refs, uint32_t blockSize,
+                               uint32_t p, Pieces& out);
+    // inMtx_ held: adds (d = 1) or takes out a source's chunks in the availability counts
+    static void countSource(Pull& pl, const Source& s, int d);
+    // inMtx_ held: restarts the transfer with the layout most other holders
+    // reported, preferring one not tried yet; false if there is none. it may
+    // be in_.end() when nothing is being fetched yet
+    bool switchLayout(Pull& pl, InIter& it, Clock::time_point now);
+    // inMtx_ held: expire and hand out requests; the messages to send land in out
+    void schedule(Pull& pl, const Incoming& inc, Clock::time_point now,
+                  std::vector<std::pair<PeerId, std::vector<std::vector<uint8_t>>>>& out);
+    // outMtx_ held
+    template <typename T> static void sampleRtt(T& o, Clock::duration r);
+    static bool onTimeout(Outgoing& o, Clock::time_point now, Clock::time_point& deadline);
+    // marks overdue units lost; returns when the next one would become overdue
+    static Clock::time_point detectLosses(Outgoing& o, Clock::time_point now);
+    static void advance(Outgoing& o);
+    // inMtx_ held
+    // a new transfer within the budgets, making room from idle ones; in_.end() if refused
+    InIter admit(const PeerId& from, const Manifest& m, bool download);
+    static uint64_t footprint(const Layout& L, bool inMemory);
+    void evict(InIter it);
+    // drops a transfer and its partial files
+    void discard(InIter it);
+    void sweep();
+    // removes partial files in dir, other than those named in open, untouched for partialTtl
+    void removeStale(const std::string& dir, const std::vector<std::string>& open) const;
+    bool startIncoming(const Manifest& m, Incoming& inc);
+    enum class Accepted : uint8_t { Yes, NoRoom, Invalid };
+    Accepted accept(Incoming& inc, uint32_t unit, ByteView payload);
+    bool store(Incoming& inc, uint32_t chunk, ByteView payload);
+    static bool writeChunk(Incoming& inc, uint32_t chunk, ByteView payload);
+    // takes a copied page and rebuilds the chunks it covers from the basis, all or nothing
+    bool applyCopy(Incoming& inc, uint32_t unit, ByteView body);
+    void markHeld(Incoming& inc, uint32_t unit);
+    void saveProgress(Incoming& inc);
+    std::string finishOnDisk(Incoming& inc, const FileId& id);
+    // retires a complete transfer, sends reply and delivers the file; releases lock
+    void finish(const PeerId& from, InIter it, std::unique_lock<std::mutex>& lock,
+                const std::vector<uint8_t>& reply);
+    static void closeIncoming(Incoming& inc);
+
+    // nullopt if a chunk cannot be read
+    static std::optional<merkle::PageTree> buildTree(const Layout& L, const ChunkSource& read);
+    // a page unit's payload: its leaf hashes followed by the proof; false if a chunk cannot be read
+    static bool pagePayload(const Layout& L, const merkle::PageTree& tree, uint32_t p,
+                            const ChunkSource& read, std::vector<uint8_t>& out);
+    static std::vector<uint8_t> buildHave(const Manifest& m, const Incoming* inc);
+    void addShare(std::unique_ptr<Share> sh);
 
-    static FileId randomId();
+    static FileId idOf(const merkle::Hash& root);
+    // the sender's name reduced to a file name in the save directory
+    static std::string localName(const std::string& name, const std::string& key);
     static std::string toHex16(const FileId& id);
-    static std::vector<uint8_t> buildChunk(const FileId& id, uint32_t index, uint32_t total,
-                                           const std::string& name, const std::vector<uint8_t>& data);
-    static bool parseChunk(const std::vector<uint8_t>& msg, FileId& id, uint32_t& index, uint32_t& total,
-                           std::string& name, std::vector<uint8_t>& data);
+    static std::vector<uint8_t> buildManifest(const Manifest& m);
+    static bool parseManifest(ByteView body, Manifest& m);
+    static std::vector<uint8_t> buildResume(const FileId& id, const Incoming* inc, uint32_t units);
+    static std::vector<uint8_t> buildChunk(const FileId& id, uint32_t unit, ByteView payload);
+    static std::vector<uint8_t> buildCopy(const FileId& id, uint32_t unit, const Pieces& pieces, ByteView page);
+    static std::vector<uint8_t> buildAck(const FileId& id, uint32_t echo, uint32_t cum,
+                                         const std::vector<uint64_t>* have, uint32_t high);
 };
 
 } // namespace p2p
@@ -23,6 +23,15 @@ struct Identity {
     static Identity generate();
 };
 
+// ids are hashes already, so the leading bytes make a good bucket hash
+struct PeerIdHash {
+    size_t operator()(const PeerId& id) const {
+        size_t h = 0;
+        for (size_t i = 0; i < sizeof(h); ++i) h = (h << 8) | id[i];
+        return h;
+    }
+};
+
 // hex helpers
 std::string toHex(const uint8_t* data, size_t len);
 std::string toHex(const PeerId& id);
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "p2p/Buffer.hpp"
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace p2p::merkle {
+
+// BLAKE2b-256 Merkle tree over file chunks. Leaves are H(0x00|chunk), inner
+// nodes H(0x01|left|right); a missing right child is the all-zero hash.
+// Chunks are grouped into pages of kPageLeaves so a receiver can check a
+// page of leaf hashes against the root with one short proof, and then each
+// chunk against its leaf, without ever holding the whole leaf layer.
+using Hash = std::array<uint8_t, 32>;
+constexpr uint32_t kPageLeaves = 16;
+
+Hash leaf(ByteView chunk);
+Hash parent(const Hash& left, const Hash& right);
+
+inline uint32_t pageCount(uint32_t chunks) { return (chunks + kPageLeaves - 1) / kPageLeaves; }
+// sibling hashes needed to climb from a page root to the file root
+unsigned proofLength(uint32_t pages);
+
+// root of one page; n < kPageLeaves only for the last page
+Hash pageRoot(const Hash* leaves, size_t n);
+
+// the tree above the page roots, kept by the sender to answer proofs
+class PageTree {
+public:
+    explicit PageTree(std::vector<Hash> pageRoots);
+    const Hash& root() const { return levels_.back().front(); }
+    uint32_t pages() const { return static_cast<uint32_t>(levels_.front().size()); }
+    std::vector<Hash> proof(uint32_t page) const;
+
+private:
+    std::vector<std::vector<Hash>> levels_; // page roots first, the root last
+};
+
+// proof holds proofLength(pages) hashes
+bool verifyPage(const Hash& root, uint32_t pages, uint32_t page, const Hash* leaves, size_t n, const Hash* proof);
+
+} // namespace p2p::merkle
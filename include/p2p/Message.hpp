@@ -1,5 +1,7 @@
 #pragma once
 
+#include "p2p/Buffer.hpp"
+
 #include <cstdint>
 #include <vector>
 
@@ -7,10 +9,36 @@ namespace p2p {
 
 enum class MessageType : uint8_t {
     TEXT = 0x01,
+    FILE_COPY = 0xE8,
+    FILE_SIGREQ = 0xE9,
+    FILE_SIGS = 0xEA,
+    FILE_QUERY = 0xEB,
+    FILE_HAVE = 0xEC,
+    FILE_REQUEST = 0xED,
+    FILE_RESUME = 0xEE,
+    FILE_MANIFEST = 0xEF,
+    FILE_ACK = 0xF0,
     FILE_CHUNK = 0xF1,
     USER_BASE = 0x80
 };
 
+// first byte of every plaintext the router seals. Application messages go
+// out as DATA or inside a BATCH, so whatever they start with, the router
+// never takes one for its own traffic
+enum class Frame : uint8_t {
+    DATA = 0x00,
+    BATCH = 0x01,
+    FRAGMENT = 0x02,
+    SESSION_HELLO = 0x03,
+    SESSION_ACCEPT = 0x04,
+    FIND_NODE = 0x05,
+    NODES = 0x06,
+    MTU_PROBE = 0x07,
+    MTU_ACK = 0x08,
+    SESSION_RESET = 0x09,
+    SESSION_CHALLENGE = 0x0A
+};
+
 inline std::vector<uint8_t> packMessage(MessageType type, const std::vector<uint8_t>& payload) {
     std::vector<uint8_t> out;
     out.reserve(1 + payload.size());
@@ -26,4 +54,11 @@ inline bool unpackMessage(const std::vector<uint8_t>& bytes, MessageType& type,
     return true;
 }
 
+inline bool unpackMessage(ByteView bytes, MessageType& type, ByteView& payload) {
+    if (bytes.size() < 1) return false;
+    type = static_cast<MessageType>(bytes[0]);
+    payload = bytes.sub(1);
+    return true;
+}
+
 } // namespace p2p
@@ -5,10 +5,14 @@
 #include "p2p/Transport.hpp"
 #include "p2p/Router.hpp"
 #include "p2p/Message.hpp"
+#include "p2p/EventLoop.hpp"
+#include "p2p/Pipeline.hpp"
+#include "p2p/SendQueue.hpp"
 
 #include <thread>
 #include <atomic>
 #include <functional>
+#include <future>
 
 namespace p2p {
 
@@ -16,29 +20,102 @@ class Node {
 public:
     using MessageHandler = Router::MessageHandler;
     using TypedHandler = Router::TypedHandler;
+    using ViewHandler = Router::ViewHandler;
+    using TypedViewHandler = Router::TypedViewHandler;
 
-    explicit Node(const std::string& bindIp = "", uint16_t bindPort = 0);
+    // shards > 1 receives on that many SO_REUSEPORT sockets, one worker thread each;
+    // handlers may then run concurrently for different senders
+    explicit Node(const std::string& bindIp = "", uint16_t bindPort = 0, size_t shards = 1,
+                  EventLoop::Backend backend = EventLoop::Backend::Auto);
     ~Node();
 
     const Identity& identity() const { return self_; }
     uint16_t port() const { return transport_.localPort(); }
+    size_t shards() const { return reactors_.size(); }
+    // shard 0's reactor; extra sockets and timers can share its thread
+    EventLoop& eventLoop() { return *reactors_[0]; }
 
     void start();
     void stop();
 
     void addPeer(const Peer& p);
+    std::vector<Peer> peers() const { return peers_.list(); }
+    // iterative DHT lookup; found peers are added to the directory
+    void findNode(const PeerId& target, Router::LookupHandler done = {}) { router_.findNode(target, std::move(done)); }
     bool sendMessage(const PeerId& dest, const std::vector<uint8_t>& data);
+    bool sendMessages(const PeerId& dest, const std::vector<std::vector<uint8_t>>& batch);
     bool sendText(const PeerId& dest, const std::string& text);
+    // synchronous like the above, but a full queue is told apart from a missing route
+    SendResult send(const PeerId& dest, const std::vector<uint8_t>& data) { return router_.send(dest, data); }
+    SendResult send(const PeerId& dest, const std::vector<std::vector<uint8_t>>& batch) { return router_.send(dest, batch); }
+    // queue for the event loop, which seals and sends while the socket takes
+    // more and pauses while it is backed up; done gets the result on the loop
+    // thread. A peer's queue past SendQueue::Options::maxBytes refuses the
+    // message (QueueFull, at once). Messages still queued at stop() complete
+    // with Stopped. cls sets the message's share of the link; by default it
+    // follows the message type, so file data queues behind chat
+    bool sendAsync(const PeerId& dest, std::vector<uint8_t> data, SendQueue::Completion done,
+                   SendClass cls = SendClass::Auto);
+    std::future<SendResult> sendAsync(const PeerId& dest, std::vector<uint8_t> data, SendClass cls = SendClass::Auto);
+    size_t queuedBytes(const PeerId& dest) const { return outbox_->queuedBytes(dest); }
+    // queue limits, class quanta, per-peer rates and watermark callbacks; call before start()
+    void configureSendQueue(SendQueue::Options opts);
+    // hold dest to bytesPerSec in class cls (0 = unlimited)
+    void setPeerRate(const PeerId& dest, SendClass cls, uint64_t bytesPerSec) { outbox_->setRate(dest, cls, bytesPerSec); }
+    void enableSessions(bool on = true) { router_.enableSessions(on); }
+    // pack small messages to the same peer into one packet, sent after at most
+    // opts.deadline or once a datagram is full; see Router::enableCoalescing
+    void enableCoalescing(Router::CoalesceOptions opts = {}) { router_.enableCoalescing(opts); }
+    void disableCoalescing() { router_.disableCoalescing(); }
+    // send parked messages without waiting for their deadline
+    void flushMessages() { router_.flushMessages(); }
+    // path MTU to dest as probed so far, and the largest message that still
+    // fits one datagram; bigger ones are fragmented
+    size_t pathMtu(const PeerId& dest) const { return router_.pathMtu(dest); }
+    size_t maxPayload(const PeerId& dest) const { return router_.maxPayload(dest); }
+    // probe dest's path now; true while the probes are out
+    bool probePath(const PeerId& dest) { return router_.probePath(dest); }
+    bool probing(const PeerId& dest) const { return router_.probing(dest); }
+    // datagrams too big for a receive buffer, dropped on arrival
+    uint64_t truncatedDatagrams() const { return transport_.truncated(); }
+    // move verify/decrypt and handlers off the I/O threads; call before start()
+    void enablePipeline(Pipeline::Options opts = {});
+    Pipeline::Stats pipelineStats() const { return pipeline_ ? pipeline_->stats() : Pipeline::Stats{}; }
     void onMessage(MessageHandler cb) { router_.onMessage(std::move(cb)); }
     void onTypedMessage(TypedHandler cb) { router_.onTypedMessage(std::move(cb)); }
+    // no-copy handlers; the view is only valid during the call
+    void onMessageView(ViewHandler cb) { router_.onMessageView(std::move(cb)); }
+    void onTypedMessageView(TypedViewHandler cb) { router_.onTypedMessageView(std::move(cb)); }
+    // the calling thread is one of the node's reactors or pipeline workers,
+    // i.e. a handler or timer: anything blocking there stalls receives
+    bool onNodeThread() const;
 
 private:
     Identity self_{};
     PeerDirectory peers_{};
     Transport transport_{};
     Router router_;
-    std::thread loop_{};
+    std::unique_ptr<Pipeline> pipeline_{};
+    std::vector<std::unique_ptr<EventLoop>> reactors_{}; // one per shard
+    EventLoop::TimerId beaconTimer_{0};
+    EventLoop::TimerId pruneTimer_{0};
+    EventLoop::TimerId dhtTimer_{0};
+    std::vector<std::thread> workers_{};
     std::atomic<bool> running_{false};
+    std::unique_ptr<SendQueue> outbox_;
+    std::atomic<bool> drainQueued_{false};
+    std::atomic<bool> retryQueued_{false};
+    static constexpr size_t kDrainBudget = 256; // messages per loop turn, so receives are not starved
+    static constexpr size_t kDrainBurst = 32;   // messages per batched send
+
+    void handlePacket(PacketView& pkt, const Endpoint& from);
+    void handleBeacon(ByteView bytes, const Endpoint& from);
+    void sendBeacon();
+    void scheduleDrain();
+    void scheduleRetry(SendQueue::Clock::duration wait);
+    void drainSends();
+    void failQueued();
+    std::vector<uint8_t> beacon() const;
 };
 
 } // namespace p2p
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "p2p/Identity.hpp"
+#include "p2p/Buffer.hpp"
 
 #include <cstdint>
 #include <vector>
@@ -8,15 +9,62 @@
 namespace p2p {
 
 struct Packet {
+    // Signed: Ed25519 + crypto_box; Session: AEAD under handshake keys, "SESS" on the wire
+    enum class Kind : uint8_t { Signed, Session };
+
     PeerId sender{};
     PeerId dest{};
     uint8_t ttl{8};
     std::array<uint8_t, 64> signature{}; // sign(sender||dest||payload)
     std::vector<uint8_t> payload; // encrypted
+    Kind kind{Kind::Signed};
+    uint32_t session{0}; // session packets only
+    uint64_t counter{0}; // session packets only; nonce + replay index
+
+    // bytes sealing adds around a plaintext on the wire
+    static constexpr size_t kSessionOverhead = 4+32+32+1+4+8+4 + 16; // header + AEAD tag
+    static constexpr size_t kSignedOverhead = 32+32+1+64+4 + 24+16;  // header + box nonce and MAC
 
     // serialize to bytes
     std::vector<uint8_t> serialize() const;
     static bool deserialize(const uint8_t* data, size_t len, Packet& out);
 };
 
+// a received packet parsed in place: header fields are copied out, signature
+// and payload stay in the receive buffer, which the view keeps alive. The
+// payload is writable so the receiver can decrypt over it.
+struct PacketView {
+    Packet::Kind kind{Packet::Kind::Signed};
+    PeerId sender{};
+    PeerId dest{};
+    uint8_t ttl{0};
+    uint32_t session{0};
+    uint64_t counter{0};
+
+    ByteView signature() const { return ByteView(buf_.data() + sigOff_, 64); }
+    ByteView payload() const { return ByteView(buf_.data() + payloadOff_, payloadLen_); }
+    uint8_t* mutablePayload() { return buf_.data() + payloadOff_; }
+    const BufferRef& buffer() const { return buf_; }
+    // the datagram as received (with any ttl patch applied)
+    ByteView wire() const { return ByteView(buf_.data(), wireLen_); }
+    // rewrite the ttl byte in the buffer, for relaying the original bytes
+    void setTtl(uint8_t t) { ttl = t; buf_.data()[ttlOff_] = t; }
+
+    // takes buf over on success; leaves it alone otherwise
+    static bool parse(BufferRef& buf, size_t len, PacketView& out);
+    // swap the bytes for a reassembled message: payload() then spans all len
+    // bytes of buf, and wire() and signature() no longer apply
+    void adopt(BufferRef buf, size_t len);
+    // owning copy, for paths that must outlive or rewrite the packet
+    Packet toPacket() const;
+
+private:
+    BufferRef buf_{};
+    size_t wireLen_{0};
+    size_t ttlOff_{0};
+    size_t sigOff_{0};
+    size_t payloadOff_{0};
+    size_t payloadLen_{0};
+};
+
 } // namespace p2p
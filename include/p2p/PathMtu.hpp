@@ -0,0 +1,73 @@
+#pragma once
+
+#include "p2p/Identity.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace p2p {
+
+// packetization-layer path MTU discovery (RFC 8899 in spirit): every path is
+// assumed to carry kBase-byte datagrams; for peers we send to, padded probes
+// of the common larger link sizes go out together with don't-fragment set,
+// and the largest one the peer acknowledges becomes the path's size. Probes
+// that go unanswered kTries rounds in a row are given up on, and each path is
+// searched again from kBase every kResearch, which also recovers from a path
+// that shrank.
+class PathMtu {
+public:
+    static constexpr size_t kBase = 1200;
+    // UDP payloads of IPv6/IPv4 over 1500- and 9000-byte links
+    static constexpr std::array<size_t, 4> kLadder{1452, 1472, 8952, 8972};
+
+    struct Probe {
+        PeerId peer{};
+        uint32_t nonce{0};
+        size_t size{0};
+    };
+
+    explicit PathMtu(size_t ceiling, size_t capacity = 4096);
+
+    // largest datagram known to reach peer; kBase until probed
+    size_t mtu(const PeerId& peer) const;
+    // traffic to peer: start searching its path if it is not being searched
+    void use(const PeerId& peer);
+    // true while peer has probes out that are neither answered nor timed out
+    bool searching(const PeerId& peer) const;
+    // probes to send now; call about once a second
+    std::vector<Probe> due();
+    // start a round for peer right away instead of at the next due()
+    std::vector<Probe> kick(const PeerId& peer);
+    void acked(const PeerId& peer, uint32_t nonce, size_t size);
+
+private:
+    using Clock = std::chrono::steady_clock;
+    static constexpr int kTries = 3;
+    static constexpr auto kProbeTimeout = std::chrono::milliseconds(500);
+    static constexpr auto kResearch = std::chrono::minutes(10);
+    static constexpr auto kIdle = std::chrono::minutes(10);
+
+    struct Path {
+        size_t mtu{kBase};
+        uint32_t nonce{0};
+        int tries{0};            // rounds sent in this search
+        size_t outstanding{0};   // probes of the current round not yet acked
+        Clock::time_point roundAt{};
+        Clock::time_point searchAt{};
+        Clock::time_point usedAt{};
+    };
+
+    size_t ceiling_;
+    size_t capacity_;
+    mutable std::mutex mtx_;
+    std::unordered_map<PeerId, Path, PeerIdHash> paths_;
+
+    void round(const PeerId& peer, Path& p, Clock::time_point now, std::vector<Probe>& out);
+    std::vector<size_t> sizesAbove(size_t mtu) const;
+};
+
+} // namespace p2p
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "p2p/Identity.hpp"
+#include "p2p/Endpoint.hpp"
 
 #include <string>
 #include <chrono>
@@ -11,8 +12,7 @@ struct Peer {
     PeerId id{};
     KeyBytes publicKey{};
     SignPublic signPublic{};
-    std::string ip;
-    uint16_t port{0};
+    Endpoint endpoint{}; // invalid when the peer is only reachable through others
     std::chrono::steady_clock::time_point lastSeen{};
 };
 
@@ -1,24 +1,109 @@
 #pragma once
 
 #include "p2p/Peer.hpp"
+#include "p2p/Crypto.hpp"
 
-#include <vector>
+#include <atomic>
+#include <memory>
 #include <mutex>
 #include <optional>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace p2p {
 
+// Read-mostly peer table. Readers grab the current immutable snapshot with
+// one atomic shared_ptr load and look peers up by id or address without
+// copying and without the writers' mutex. That load is not lock-free: under
+// C++17 it is std::atomic_load, which libstdc++ guards with a spinlock from a
+// small address-hashed pool (held for a refcount bump); C++20 builds use
+// std::atomic<std::shared_ptr>. Writers serialise on a mutex and publish a
+// new snapshot, which copies the whole table: O(peers) per change of an
+// address or key. Only lastSeen and the lazily derived box key change inside
+// a published record, and those cost no copy.
 class PeerDirectory {
 public:
+    struct Record {
+        explicit Record(const Peer& p);
+        ~Record();
+        Peer peer; // peer.lastSeen is stale; use seen()
+        std::chrono::steady_clock::time_point seen() const;
+
+    private:
+        friend class PeerDirectory;
+        mutable std::atomic<std::chrono::steady_clock::rep> seen_{0};
+        mutable std::once_flag keyOnce_;
+        mutable crypto::SharedKey key_{};
+        mutable bool keyOk_{false};
+    };
+    using RecordPtr = std::shared_ptr<const Record>;
+
+    struct Snapshot {
+        std::unordered_map<PeerId, RecordPtr, PeerIdHash> byId;
+        std::unordered_map<Endpoint, RecordPtr, EndpointHash> byAddr;
+    };
+
+    PeerDirectory();
+
     void addOrUpdate(const Peer& p);
     std::vector<Peer> list() const;
     std::optional<Peer> findById(const PeerId& id) const;
-    void upsertAddrAndKeys(const PeerId& id, const std::string& ip, uint16_t port, const KeyBytes& boxPub, const SignPublic& signPub);
+    void upsertAddrAndKeys(const PeerId& id, const Endpoint& ep, const KeyBytes& boxPub, const SignPublic& signPub);
+    // drop peers silent for maxAge. Finding them costs O(due) heap pops, not
+    // a directory scan; removing them costs one snapshot copy (O(peers)) per
+    // sweep that removes anything. A sweep only runs once the oldest has been
+    // due for kSweepSlack, so expiries batch into at most one copy per slack
+    // period and peers can outlive maxAge by up to that much.
+    // Peers added with a zero lastSeen are pinned until traffic arrives from them
     void removeStale(std::chrono::seconds maxAge);
+    static constexpr auto kSweepSlack = std::chrono::seconds(10);
+
+    // read path: no writer lock, no copy
+    std::shared_ptr<const Snapshot> snapshot() const {
+#if defined(__cpp_lib_atomic_shared_ptr)
+        return snap_.load(std::memory_order_acquire);
+#else
+        return std::atomic_load_explicit(&snap_, std::memory_order_acquire);
+#endif
+    }
+    RecordPtr find(const PeerId& id) const;
+    // refresh lastSeen of whoever sits at this address; no writer lock, no copy
+    void touch(const Endpoint& from);
+
+    // crypto_box shared key for a peer, computed once per record; a peer whose
+    // box key changes gets a new record, so a stale key is never handed out.
+    // None (nullptr) for a public key no secret can be agreed with: that peer
+    // can be neither sent to nor heard from
+    std::optional<crypto::SharedKey> boxKey(const PeerId& id, const KeyBytes& selfPriv) const;
+    static const crypto::SharedKey* boxKey(const Record& r, const KeyBytes& selfPriv);
 
 private:
-    mutable std::mutex mtx_;
-    std::vector<Peer> peers_;
+    using Rep = std::chrono::steady_clock::rep;
+    // min-heap on the lastSeen a peer had when queued; touches only move the
+    // real value forward, so an entry that comes due is re-queued if the peer
+    // was heard from since, and removed otherwise
+    struct Due {
+        Rep seen;
+        PeerId id;
+        bool operator>(const Due& o) const { return seen > o.seen; }
+    };
+
+    std::mutex writeMtx_;
+#if defined(__cpp_lib_atomic_shared_ptr)
+    std::atomic<std::shared_ptr<const Snapshot>> snap_;
+#else
+    std::shared_ptr<const Snapshot> snap_; // only through std::atomic_load/atomic_store
+#endif
+    std::priority_queue<Due, std::vector<Due>, std::greater<Due>> expiry_;
+    std::unordered_set<PeerId, PeerIdHash> queued_; // ids with an entry in expiry_
+
+    // writeMtx_ held
+    void put(const Peer& p);
+    void publish(std::shared_ptr<const Snapshot> next);
+    void schedule(const PeerId& id, Rep seen);
 };
 
 } // namespace p2p
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "p2p/BoundedQueue.hpp"
+#include "p2p/Packet.hpp"
+#include "p2p/Endpoint.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace p2p {
+
+class Router;
+
+// Staged receive path: the I/O threads only parse and submit, a pool of
+// crypto workers verifies and decrypts, and one delivery stage runs the
+// handlers. A sender always maps to the same worker, so its messages reach
+// the handlers in arrival order.
+class Pipeline {
+public:
+    using Task = std::function<void()>;
+    using Executor = std::function<void(Task)>;
+
+    struct Options {
+        size_t workers = 2;
+        size_t queueCapacity = 1024; // per queue, rounded up to a power of two
+        // run handlers on a user executor instead of the delivery thread;
+        // tasks for one sender are submitted in order
+        Executor executor{};
+    };
+
+    struct Stats {
+        uint64_t submitted{0};
+        uint64_t dropped{0}; // a stage queue was full
+    };
+
+    Pipeline(Router& router, Options opts);
+    ~Pipeline();
+
+    void start();
+    void stop();
+
+    // called from I/O threads; false (and counted) if the worker queue is full
+    bool submit(PacketView&& pkt, const Endpoint& from);
+    Stats stats() const;
+    // the calling thread is one of ours
+    bool onWorker() const;
+
+private:
+    // both carry the receive buffer along, so nothing is copied between stages
+    struct Inbound {
+        PacketView pkt;
+        Endpoint from;
+    };
+    struct Delivery {
+        PacketView pkt;
+        ByteView plaintext; // into pkt's buffer
+    };
+
+    // a bounded queue plus a parking spot for its single consumer
+    template <typename T>
+    struct Stage {
+        explicit Stage(size_t cap) : q(cap) {}
+        BoundedQueue<T> q;
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::atomic<bool> parked{false};
+
+        bool push(T&& v) {
+            if (!q.push(std::move(v))) return false;
+            if (parked.load(std::memory_order_acquire)) { std::lock_guard<std::mutex> l(mtx); cv.notify_one(); }
+            return true;
+        }
+    };
+
+    Router& router_;
+    Options opts_;
+    std::vector<std::unique_ptr<Stage<Inbound>>> workers_;
+    Stage<Delivery> delivery_;
+    std::vector<std::thread> threads_;
+    std::atomic<bool> running_{false};
+    std::atomic<uint64_t> submitted_{0};
+    std::atomic<uint64_t> dropped_{0};
+
+    void workerLoop(Stage<Inbound>& st);
+    void deliveryLoop();
+    template <typename T> bool next(Stage<T>& st, T& out);
+};
+
+} // namespace p2p
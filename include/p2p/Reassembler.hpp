@@ -0,0 +1,59 @@
+#pragma once
+
+#include "p2p/Identity.hpp"
+#include "p2p/Buffer.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace p2p {
+
+// puts messages the router split over several packets back together.
+// FRAGMENT body: id u32 | index u16 | count u16 | bytes. Partial messages
+// are bounded per peer and in total; one that cannot fit, or that has not
+// grown for the timeout, is dropped whole.
+class Reassembler {
+public:
+    static constexpr size_t kHeader = 4+2+2;
+
+    Reassembler(size_t maxBytes = size_t(64) << 20, size_t maxPerPeer = size_t(16) << 20,
+                std::chrono::milliseconds timeout = std::chrono::seconds(5));
+
+    // true once the fragment completes its message: out holds all len bytes
+    bool add(const PeerId& from, ByteView body, BufferRef& out, size_t& len);
+    // drop partial messages past the timeout
+    void expire();
+    size_t pending() const;
+    uint64_t dropped() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+    static constexpr size_t kMaxPartials = 64; // per peer
+
+    struct Partial {
+        uint16_t count{0};
+        uint16_t got{0};
+        size_t bytes{0};
+        std::vector<std::vector<uint8_t>> pieces; // empty until received
+        Clock::time_point touched{};
+    };
+    struct PeerState {
+        std::unordered_map<uint32_t, Partial> partials;
+        size_t bytes{0};
+    };
+
+    size_t maxBytes_;
+    size_t maxPerPeer_;
+    Clock::duration timeout_;
+    mutable std::mutex mtx_;
+    std::unordered_map<PeerId, PeerState, PeerIdHash> peers_;
+    size_t bytes_{0};
+    uint64_t dropped_{0};
+
+    void drop(PeerState& st, std::unordered_map<uint32_t, Partial>::iterator it);
+};
+
+} // namespace p2p
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "p2p/Identity.hpp"
+#include "p2p/Endpoint.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+namespace p2p {
+
+// reverse-path routes: the neighbour a packet from a peer arrived through is
+// a good next hop back to it. Routes learned from session packets, which are
+// authenticated and replay-checked, are trusted; signed packets (replayable)
+// and relayed ones only record hints, which never replace a trusted route.
+// LRU-bounded; entries age out unless traffic keeps refreshing them and are
+// dropped when a send fails.
+class RouteCache {
+public:
+    struct Route {
+        Endpoint hop;
+        bool trusted{false};
+    };
+
+    explicit RouteCache(size_t capacity = 4096, std::chrono::seconds maxAge = std::chrono::seconds(60));
+
+    // from an authenticated packet that cannot be a replay
+    void learn(const PeerId& dest, const Endpoint& hop);
+    // from a packet we only forwarded; good for nothing but forwarding
+    void hint(const PeerId& dest, const Endpoint& hop);
+    std::optional<Route> lookup(const PeerId& dest);
+    void fail(const PeerId& dest);
+    size_t size() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+    struct Entry {
+        PeerId dest{};
+        Endpoint hop;
+        Clock::time_point learned{};
+        bool trusted{false};
+    };
+
+    size_t capacity_;
+    Clock::duration maxAge_;
+    mutable std::mutex mtx_;
+    std::list<Entry> lru_; // most recently used first
+    std::unordered_map<PeerId, std::list<Entry>::iterator, PeerIdHash> index_;
+
+    void put(const PeerId& dest, const Endpoint& hop, bool trusted);
+};
+
+} // namespace p2p
@@ -4,29 +4,124 @@
 #include "p2p/PeerDirectory.hpp"
 #include "p2p/Crypto.hpp"
 #include "p2p/Message.hpp"
+#include "p2p/Session.hpp"
+#include "p2p/SeenCache.hpp"
+#include "p2p/RoutingTable.hpp"
+#include "p2p/RouteCache.hpp"
+#include "p2p/PathMtu.hpp"
+#include "p2p/Reassembler.hpp"
 
+#include <atomic>
+#include <chrono>
+#include <deque>
 #include <functional>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace p2p {
 
+// what became of a send. Sent: handed to the socket, or to the transport's
+// queue while the socket drains. QueueFull: a bounded send queue had no room;
+// nothing went out, try again once it drains
+enum class SendResult { Sent, QueueFull, NoRoute, TooLarge, Stopped };
+
 class Router {
 public:
     using MessageHandler = std::function<void(const PeerId& from, const std::vector<uint8_t>& data)>;
     using TypedHandler = std::function<void(const PeerId& from, MessageType type, const std::vector<uint8_t>& payload)>;
+    // zero-copy variants: the views point into the receive buffer and are only valid during the call
+    using ViewHandler = std::function<void(const PeerId& from, ByteView data)>;
+    using TypedViewHandler = std::function<void(const PeerId& from, MessageType type, ByteView payload)>;
+    using LookupHandler = std::function<void(const PeerId& target, const std::vector<PeerId>& closest)>;
+    using IntroHook = std::function<void(const Endpoint& to)>;
+    using TimerHook = std::function<void(std::chrono::milliseconds delay, std::function<void()> cb)>;
+
+    struct CoalesceOptions {
+        std::chrono::milliseconds deadline{1}; // longest a message waits for company
+        size_t maxBytes{0};                    // flush once a batch would pass this; 0 = one full datagram
+    };
 
     Router(const Identity& self, Transport& transport, PeerDirectory& peers);
 
     // forward or deliver
-    void handleIncoming(const Packet& pkt, const std::string& fromIp, uint16_t fromPort);
+    void handleIncoming(PacketView& pkt, const Endpoint& from);
+
+    // handleIncoming split into stages for Pipeline:
+    // admit (I/O thread): bookkeeping and forwarding; true if the packet is ours to open
+    bool admit(PacketView& pkt, const Endpoint& from);
+    // open (crypto worker): verify + decrypt in place; false if bad or consumed internally.
+    // plaintext points into pkt's buffer. The hop it arrived from becomes the
+    // learned route back to the sender
+    bool open(PacketView& pkt, const Endpoint& from, ByteView& plaintext);
+    // deliver (delivery stage): run the user handlers
+    void deliver(const PeerId& from, ByteView plaintext);
 
-    // send encrypted; forward if needed
+    // send encrypted; forward if needed. A message too big for one datagram
+    // on the path goes out as FRAGMENTs, each sealed on its own, and is put
+    // back together before any handler sees it; up to kMaxMessage bytes
     bool sendMessage(const PeerId& dest, const std::vector<uint8_t>& data);
+    // same, but a whole burst goes out through one batched send
+    bool sendMessages(const PeerId& dest, const std::vector<std::vector<uint8_t>>& batch);
+    // both, telling a full queue apart from a missing route. taken, if given,
+    // is how many messages of the burst were handed over, in order
+    SendResult send(const PeerId& dest, const std::vector<uint8_t>& data);
+    SendResult send(const PeerId& dest, const std::vector<std::vector<uint8_t>>& batch, size_t* taken = nullptr);
+
+    // largest datagram known to reach dest (see PathMtu); probing starts once
+    // messages go to it
+    size_t pathMtu(const PeerId& dest) const { return paths_.mtu(dest); }
+    // largest message that still goes out to dest in a single datagram
+    size_t maxPayload(const PeerId& dest) const;
+    // search dest's path now rather than at the next maintain(); true while
+    // the probes are out
+    bool probePath(const PeerId& dest);
+    bool probing(const PeerId& dest) const { return paths_.searching(dest); }
+    static constexpr size_t kMaxMessage = size_t(16) << 20;
+    // the Frame byte the router puts ahead of every message it seals
+    static constexpr size_t kFrameBytes = 1;
+
+    // opt in to coalescing: sendMessage parks small messages per peer and
+    // sends them together as one BATCH packet (one seal, one datagram) when
+    // the deadline passes or the batch is full. The receiver unpacks a batch
+    // and hands each message to the handlers on its own. Order per peer is
+    // kept: anything sent past the coalescer flushes the peer's batch first.
+    // Needs the timer hook, which Node sets
+    void enableCoalescing(CoalesceOptions opts);
+    void disableCoalescing();
+    // send every parked batch now
+    void flushMessages();
+    void setTimerHook(TimerHook hook) { timer_ = std::move(hook); }
 
+    // opt in to handshake sessions: after a signed handshake, packets to that
+    // peer carry an AEAD tag and counter instead of Ed25519 + crypto_box.
+    // Incoming handshakes are answered either way.
+    void enableSessions(bool on) { sessionsEnabled_ = on; }
+
+    // Kademlia-style routing: authenticated senders land in k-buckets; packets
+    // for peers we cannot reach directly go greedily to the closest known peer
+    // that is closer than us, and only flood when there is none.
+    // iterative FIND_NODE toward target; done gets the closest ids found
+    void findNode(const PeerId& target, LookupHandler done = {});
+    // a peer became known out of band (addPeer, discovery beacon)
+    void notePeer(const PeerId& id);
+    // lookup timeouts, bootstrap self-lookup, bucket refresh, path MTU probes
+    // and stale fragments; call about once a second
+    void maintain();
+    const RoutingTable& table() const { return table_; }
+    // lookup contacts do not know our keys yet; the node sends them its beacon through this
+    void setIntroHook(IntroHook hook) { intro_ = std::move(hook); }
+
+    // register before the node starts; handlers are read concurrently by all shards
     void onMessage(MessageHandler cb);
     void onTypedMessage(TypedHandler cb);
+    void onMessageView(ViewHandler cb);
+    void onTypedMessageView(TypedViewHandler cb);
     // sign packet bytes
     static std::array<uint8_t,64> signPacket(const Identity& self, const Packet& pkt);
     static bool verifyPacket(const Peer& senderPeer, const Packet& pkt);
+    static bool verifyPacket(const Peer& senderPeer, const PacketView& pkt);
 
 private:
     Identity self_;
@@ -34,8 +129,73 @@ private:
     PeerDirectory& peers_;
     std::vector<MessageHandler> handlers_{};
     std::vector<TypedHandler> typedHandlers_{};
+    std::vector<ViewHandler> viewHandlers_{};
+    std::vector<TypedViewHandler> typedViewHandlers_{};
+    SessionTable sessions_{};
+    SeenCache seen_{};
+    std::array<uint8_t, 16> digestKey_{};
+    std::atomic<bool> sessionsEnabled_{false};
+    PathMtu paths_{Transport::kMaxDatagram};
+    Reassembler frags_{kMaxMessage * 4, kFrameBytes + kMaxMessage};
+    std::atomic<uint32_t> nextFragment_{0};
+
+    struct Batch {
+        std::vector<uint8_t> bytes; // BATCH|len|message|len|message...
+        size_t frames{0};
+        uint64_t gen{0};
+        // taken out earlier and refused by a full transport; they go first
+        std::deque<std::vector<uint8_t>> stuck;
+    };
+    std::mutex flushMtx_; // from taking a batch out until it is sent, so a peer's batches keep their order
+    std::mutex batchMtx_;
+    std::unordered_map<PeerId, Batch, PeerIdHash> batches_;
+    CoalesceOptions coalesce_{};
+    std::atomic<bool> coalescing_{false};
+    uint64_t batchGen_{0};
+    TimerHook timer_{};
+
+    using Clock = std::chrono::steady_clock;
+    static constexpr size_t kAlpha = 3; // lookup parallelism
+    static constexpr size_t kMaxIntros = 2 * kAlpha; // beacons sent per NODES reply
+    struct Lookup {
+        PeerId target{};
+        std::vector<PeerId> shortlist; // nearest first, at most k
+        std::unordered_set<PeerId, PeerIdHash> queried;
+        std::unordered_map<PeerId, Clock::time_point, PeerIdHash> inflight;
+        Clock::time_point started{};
+        LookupHandler done;
+    };
+    RoutingTable table_;
+    RouteCache routes_{};
+    std::mutex lookupMtx_;
+    std::unordered_map<uint32_t, Lookup> lookups_;
+    uint32_t nextLookup_{1};
+    bool bootstrapped_{false};
+    IntroHook intro_{};
 
-    bool forward(const Packet& pkt, const std::string& exceptIp, uint16_t exceptPort);
+    bool forward(ByteView wire, const Endpoint& except);
+    Packet seal(const PeerId& dest, const crypto::SharedKey& key, const std::vector<uint8_t>& data) const;
+    bool route(const Peer& dest, const Packet& pkt);
+    uint64_t digest(const PacketView& pkt) const;
+    bool sendSigned(const PeerId& dest, const std::vector<uint8_t>& data);
+    bool handleControl(PacketView& pkt, ByteView& plaintext);
+    void dispatch(const PeerId& from, ByteView message);
+    // framed bytes that fit one datagram to dest
+    size_t room(const PeerId& dest) const;
+    // these take framed messages; application data is framed as DATA by send
+    SendResult sendNow(const PeerId& dest, const std::vector<uint8_t>& data);
+    SendResult sendAll(const PeerId& dest, const std::vector<std::vector<uint8_t>>& batch, size_t* taken = nullptr);
+    SendResult park(const PeerId& dest, const std::vector<uint8_t>& data);
+    // sends what is parked for dest; Sent if there was nothing
+    SendResult flushPeer(const PeerId& dest, uint64_t gen = 0);
+    void fragment(const std::vector<uint8_t>& data, size_t room, std::vector<std::vector<uint8_t>>& out);
+    void sendProbes(const std::vector<PathMtu::Probe>& probes);
+    bool relay(const PeerId& dest, ByteView wire, const Endpoint& from);
+    PeerDirectory::RecordPtr nextHop(const PeerId& dest, const Endpoint& except);
+    void answerFindNode(const PeerId& from, const std::vector<uint8_t>& body);
+    void handleNodes(const PeerId& from, const std::vector<uint8_t>& body);
+    // queue FIND_NODEs for a lookup; true when it has nothing left in flight
+    bool step(uint32_t id, Lookup& lk, std::vector<std::pair<PeerId, std::vector<uint8_t>>>& sends);
 };
 
 } // namespace p2p
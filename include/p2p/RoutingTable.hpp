@@ -0,0 +1,55 @@
+#pragma once
+
+#include "p2p/Identity.hpp"
+
+#include <array>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace p2p {
+
+// Kademlia k-buckets over PeerId XOR distance. Bucket i holds peers that share
+// exactly i leading bits with us; each bucket is least-recently-seen first.
+class RoutingTable {
+public:
+    static constexpr size_t kBucketSize = 20; // k
+    static constexpr size_t kBuckets = 256;
+
+    explicit RoutingTable(const PeerId& self);
+
+    // peer was heard from; a full bucket only takes it if its oldest entry went quiet
+    void touch(const PeerId& id);
+    void remove(const PeerId& id);
+
+    // up to n known ids, nearest to target first
+    std::vector<PeerId> closest(const PeerId& target, size_t n) const;
+    // random ids inside every non-empty bucket untouched for maxAge, for refresh lookups
+    std::vector<PeerId> staleBucketTargets(std::chrono::seconds maxAge);
+    size_t size() const;
+
+    // leading bits shared by a and b (256 if equal)
+    static size_t commonPrefix(const PeerId& a, const PeerId& b);
+    // true if a is strictly closer to target than b
+    static bool closer(const PeerId& target, const PeerId& a, const PeerId& b);
+
+private:
+    using Clock = std::chrono::steady_clock;
+    struct Entry {
+        PeerId id{};
+        Clock::time_point seen{};
+    };
+    struct Bucket {
+        std::deque<Entry> entries;
+        Clock::time_point touched{};
+    };
+
+    static constexpr std::chrono::seconds kQuiet{120};
+
+    PeerId self_;
+    mutable std::mutex mtx_;
+    std::array<Bucket, kBuckets> buckets_{};
+};
+
+} // namespace p2p
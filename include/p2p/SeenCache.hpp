@@ -0,0 +1,45 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace p2p {
+
+// bounded set of recently seen packet digests, two generations per stripe:
+// an entry lives between window/2 and window, or until its stripe fills up.
+// Generations are preallocated open-addressing tables, so inserts never allocate
+class SeenCache {
+public:
+    explicit SeenCache(size_t capacity = 1 << 16, std::chrono::seconds window = std::chrono::seconds(30));
+
+    // true if the digest is new (and now remembered), false for a duplicate
+    bool insert(uint64_t digest);
+
+private:
+    using Clock = std::chrono::steady_clock;
+    static constexpr size_t kStripes = 16;
+
+    // linear probing, 0 marks an empty slot; kept at most half full
+    struct Gen {
+        std::vector<uint64_t> slots;
+        size_t count{0};
+        bool contains(uint64_t d) const;
+        void insert(uint64_t d);
+        void clear();
+    };
+    struct Stripe {
+        std::mutex mtx;
+        Gen cur;
+        Gen prev;
+        Clock::time_point rotated{Clock::now()};
+    };
+
+    std::array<Stripe, kStripes> stripes_{};
+    size_t perGen_;
+    Clock::duration half_;
+};
+
+} // namespace p2p
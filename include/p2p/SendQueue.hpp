@@ -0,0 +1,114 @@
+#pragma once
+
+#include "p2p/Identity.hpp"
+#include "p2p/Message.hpp"
+#include "p2p/Router.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace p2p {
+
+// scheduling class of a queued message. Control: router and file-transfer
+// protocol messages (acks, requests, manifests); Interactive: chat and user
+// messages; Bulk: file data. Auto picks one from the message type
+enum class SendClass : uint8_t { Control, Interactive, Bulk, Auto };
+
+// per-peer bounded queues of messages waiting to be sent. Classes share the
+// link by deficit round robin: each turn a class may send up to its quantum
+// in bytes, so bulk data cannot hold interactive messages back by more than
+// one bulk quantum. Within a class, peers take turns. A peer can be held to a
+// rate per class (token bucket); its messages wait while it is over it.
+// Each peer's queue is bounded in bytes; crossing the high watermark on the
+// way up and the low one on the way down is reported once each, which is the
+// producer's cue to pause and resume.
+class SendQueue {
+public:
+    using Completion = std::function<void(SendResult)>;
+    using WatermarkHandler = std::function<void(const PeerId& peer, bool above)>;
+    using Clock = std::chrono::steady_clock;
+    static constexpr size_t kClasses = 3;
+
+    struct Options {
+        size_t maxBytes = size_t(4) << 20;      // per peer; pushes past it are refused
+        size_t highWatermark = size_t(3) << 20; // onWatermark(peer, true) once the queue reaches it
+        size_t lowWatermark = size_t(1) << 20;  // onWatermark(peer, false) once it drains below
+        WatermarkHandler onWatermark{};
+        // bytes per round robin turn, by class
+        std::array<size_t, kClasses> quantum{16384, 16384, 4096};
+        // bytes per second each peer may send, by class; 0 = unlimited
+        std::array<uint64_t, kClasses> peerRate{0, 0, 0};
+        size_t burst = 64 << 10;                // token bucket depth
+    };
+
+    struct Item {
+        PeerId peer{};
+        std::vector<uint8_t> data;
+        Completion done;
+        SendClass cls{SendClass::Interactive};
+    };
+
+    explicit SendQueue(Options opts);
+
+    static SendClass classify(MessageType type);
+
+    // false (and data untouched) if the peer's queue has no room
+    bool push(const PeerId& peer, std::vector<uint8_t>& data, Completion& done, SendClass cls = SendClass::Auto);
+    // next message by class share and peer turn. False if nothing can go
+    // now; when that is only because of rate limits, retry says how long
+    // until something can
+    bool pop(Item& out, Clock::duration& retry);
+    // puts popped messages that could not go out back at the head of their
+    // queues, in order, and gives back what popping them charged
+    void requeue(std::vector<Item>& items);
+    // everything still queued, e.g. to fail it on shutdown
+    std::vector<Item> takeAll();
+    // per-peer override of Options::peerRate for one class; 0 = unlimited
+    void setRate(const PeerId& peer, SendClass cls, uint64_t bytesPerSec);
+    size_t queuedBytes(const PeerId& peer) const;
+    size_t queuedBytes() const;
+
+private:
+    struct Bucket {
+        double tokens{0};
+        Clock::time_point at{};
+    };
+    struct PeerQueue {
+        std::array<std::deque<Item>, kClasses> items;
+        std::array<Bucket, kClasses> buckets;
+        size_t bytes{0};
+        bool above{false};
+        bool idle{false}; // in idle_
+    };
+    static constexpr auto kPrune = std::chrono::seconds(1);
+
+    Options opts_;
+    mutable std::mutex mtx_;
+    std::unordered_map<PeerId, PeerQueue, PeerIdHash> queues_;
+    std::unordered_map<PeerId, std::array<uint64_t, kClasses>, PeerIdHash> rates_; // setRate overrides
+    std::array<std::deque<PeerId>, kClasses> turn_; // per class: peers with something queued, next first
+    std::deque<PeerId> idle_; // empty queues kept while their peer owes tokens
+    Clock::time_point prunedAt_{};
+    std::array<size_t, kClasses> deficit_{};
+    size_t cls_{0};     // class whose turn it is
+    bool fresh_{true};  // cls_ has not had its quantum for this turn yet
+    size_t bytes_{0};
+
+    uint64_t rateOf(const PeerId& peer, size_t cls) const;
+    PeerQueue& queueFor(const PeerId& peer, Clock::time_point now);
+    // true if peer may send in cls now; otherwise wait is lowered to when it may
+    bool ready(const PeerId& peer, PeerQueue& q, size_t cls, Clock::time_point now, Clock::duration& wait);
+    // false while the peer still owes tokens for a class
+    bool settled(const PeerId& peer, const PeerQueue& q, Clock::time_point now) const;
+    void release(const PeerId& peer, Clock::time_point now);
+    // drops idle queues whose debt is paid; at most once per kPrune
+    void prune(Clock::time_point now);
+};
+
+} // namespace p2p
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "p2p/Identity.hpp"
+#include "p2p/Packet.hpp"
+#include "p2p/Crypto.hpp"
+
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace p2p {
+
+// Per-peer symmetric sessions set up by a handshake that travels in ordinary
+// signed packets:
+//   HELLO  (initiator -> responder): flags | id | ephemeral kx pub [| nonce]
+//   ACCEPT (responder -> initiator): id | ephemeral kx pub
+// The initiator takes the crypto_kx client keys, the responder the server keys.
+// A side that lost its sessions gets them reset in three steps:
+//   RESET     (lost -> holder): id of a session it cannot open
+//   CHALLENGE (holder -> lost): id it sends on | fresh nonce
+//   HELLO with the reset flag and the nonce, only if that id is really gone
+// so neither a spoofed session packet nor a replayed message wipes sessions.
+// A responder only sends on a session once a packet from the initiator proves
+// the initiator has the keys. Session packets carry an AEAD tag and a counter
+// nonce instead of a signature.
+class SessionTable {
+public:
+    enum class OpenResult { Ok, UnknownSession, Rejected };
+
+    ~SessionTable();
+
+    // HELLO to send, or empty if a session is up or a handshake is in flight
+    std::vector<uint8_t> initiate(const PeerId& peer);
+    // RESET answering a session packet we cannot open. Such packets are
+    // unauthenticated, so this sends at most one per kResetEvery per peer
+    std::vector<uint8_t> resync(const PeerId& peer, uint32_t session);
+    // CHALLENGE answering a RESET that names the session we send on to peer;
+    // empty for any other (stale or spoofed) session
+    std::vector<uint8_t> challenge(const PeerId& peer, const std::vector<uint8_t>& reset);
+    // reset HELLO answering a CHALLENGE for a session we really lack; its
+    // handshake is kept apart from the session table until the signed ACCEPT arrives
+    std::vector<uint8_t> answer(const PeerId& peer, const std::vector<uint8_t>& challenge);
+    // answer a HELLO body; returns the ACCEPT message (empty if malformed). A
+    // reset HELLO only counts once, and only if it echoes our open challenge
+    std::vector<uint8_t> accept(const PeerId& peer, const std::vector<uint8_t>& hello);
+    // finish our handshake from an ACCEPT body
+    bool complete(const PeerId& peer, const std::vector<uint8_t>& acceptBody);
+
+    // encrypt onto the peer's active session; false when there is none yet
+    bool seal(const PeerId& self, const PeerId& dest, const std::vector<uint8_t>& plaintext, Packet& out);
+    // authenticate, decrypt (in place) and replay-check a session packet addressed to us
+    OpenResult open(PacketView& pkt, ByteView& plaintext);
+
+    bool active(const PeerId& peer) const;
+    void drop(const PeerId& peer);
+
+private:
+    using Clock = std::chrono::steady_clock;
+    static constexpr size_t kMaxSessions = 2;      // per peer: ours + theirs during a simultaneous open
+    static constexpr uint64_t kReplayWindow = 64;  // counters accepted behind the highest seen
+    static constexpr auto kResetEvery = std::chrono::seconds(5);
+    static constexpr size_t kMaxResyncs = 1024;    // peers with a reset step out or recently sent
+    static constexpr size_t kNonceBytes = 16;
+
+    struct Session {
+        uint32_t id{0};
+        crypto::AeadKey rx{};
+        crypto::AeadKey tx{};
+        uint64_t txCounter{0};
+        uint64_t rxHighest{0};
+        uint64_t rxWindow{0}; // bit i set: rxHighest - i was seen
+        bool confirmed{false}; // we may send on it
+    };
+    struct Pending {
+        uint32_t id{0};
+        KeyBytes pub{};
+        KeyBytes sec{};
+        Clock::time_point sentAt{};
+    };
+    struct Challenge {
+        std::array<uint8_t, kNonceBytes> nonce{};
+        Clock::time_point sentAt{};
+    };
+    struct PeerState {
+        std::vector<Session> sessions;
+        std::optional<Pending> pending;
+        uint32_t active{0}; // session we send on, 0 = none
+    };
+
+    mutable std::mutex mtx_;
+    std::unordered_map<PeerId, PeerState, PeerIdHash> peers_;
+    std::unordered_map<PeerId, Pending, PeerIdHash> resyncs_; // id 0 once answered
+    std::unordered_map<PeerId, Clock::time_point, PeerIdHash> resets_; // RESETs we sent
+    std::unordered_map<PeerId, Challenge, PeerIdHash> challenges_;
+
+    static Pending makePending(Clock::time_point now);
+    static std::vector<uint8_t> hello(const Pending& p, const uint8_t* nonce = nullptr);
+    // room for one more entry in a rate-limit map, dropping entries past kResetEvery
+    template <typename Map, typename At>
+    static bool makeRoom(Map& m, Clock::time_point now, At at);
+    static void install(PeerState& st, Session s);
+    static void wipe(Session& s);
+    static bool replayed(const Session& s, uint64_t counter);
+    static void markSeen(Session& s, uint64_t counter);
+};
+
+} // namespace p2p
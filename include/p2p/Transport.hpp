@@ -2,34 +2,99 @@
 
 #include "p2p/Packet.hpp"
 #include "p2p/Peer.hpp"
+#include "p2p/Endpoint.hpp"
 
+#include <array>
+#include <atomic>
+#include <deque>
 #include <functional>
+#include <mutex>
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace p2p {
 
 class Transport {
 public:
-    using PacketHandler = std::function<void(const Packet& pkt, const std::string& fromIp, uint16_t fromPort)>;
-    using RawHandler = std::function<void(const std::vector<uint8_t>& bytes, const std::string& fromIp, uint16_t fromPort)>;
+    // the view shares the pooled receive buffer; move it to keep the packet past the call
+    using PacketHandler = std::function<void(PacketView& pkt, const Endpoint& from)>;
+    using RawHandler = std::function<void(ByteView bytes, const Endpoint& from)>;
+
+    struct Datagram {
+        Endpoint to;
+        std::vector<uint8_t> bytes;
+    };
 
     Transport();
     ~Transport();
 
-    bool bind(const std::string& ip, uint16_t port);
-    bool send(const std::string& ip, uint16_t port, const Packet& pkt);
-    bool sendRaw(const std::string& ip, uint16_t port, const std::vector<uint8_t>& data);
-    bool sendBroadcast(uint16_t port, const std::vector<uint8_t>& data);
+    // shards > 1 binds that many SO_REUSEPORT sockets on one port; the kernel
+    // hashes each sender's address to a fixed socket, so per-peer order holds.
+    // An IPv6 ip (e.g. "::") binds a dual-stack socket that also reaches IPv4 peers
+    bool bind(const std::string& ip, uint16_t port, size_t shards = 1);
+    bool send(const Endpoint& to, const Packet& pkt);
+    bool sendRaw(const Endpoint& to, ByteView data);
+    // 255.255.255.255 on IPv4; a dual-stack socket also sends to ff02::1
+    bool sendBroadcast(uint16_t port, ByteView data);
+
+    // batched send (sendmmsg on linux); returns number of datagrams sent or queued.
+    // unsent gets the indexes of the rest, in order; one bad destination skips only itself
+    size_t sendBatch(const std::vector<Datagram>& batch, std::vector<size_t>* unsent = nullptr);
+    // one buffer to many destinations, e.g. a relayed datagram to every next hop
+    size_t sendBatch(const std::vector<Endpoint>& dests, ByteView data);
 
-    // poll without blocking
+    // poll without blocking; drains up to recvBatch() datagrams per wakeup
     void poll(int timeoutMs, const PacketHandler& pktHandler, const RawHandler& rawHandler);
+    // read one shard until its socket is empty (for edge-triggered event loops)
+    void drain(size_t shard, const PacketHandler& pktHandler, const RawHandler& rawHandler);
 
+    // sends that hit EAGAIN are queued; hook(true) asks for writability, hook(false) when drained.
+    // The hook is called with the queue locked and must not send through this transport
+    using WritableHook = std::function<void(bool wantWritable)>;
+    void setWritableHook(WritableHook hook) { writableHook_ = std::move(hook); }
+    void flush();
+    size_t pendingCount() const;
+    // something waits for the socket to drain; new sends queue behind it
+    bool backlogged() const { return hasPending_.load(std::memory_order_acquire); }
+    // the queue is at kMaxPending: further sends fail until the socket drains
+    bool full() const { return backlogged() && pendingCount() >= kMaxPending; }
+
+    // shard 0 also carries all sends
+    int fd(size_t shard = 0) const { return shard < socks_.size() ? socks_[shard] : -1; }
+    size_t shardCount() const { return socks_.size(); }
     uint16_t localPort() const { return boundPort_; }
+    size_t recvBatch() const { return recvBatch_; }
+    void setRecvBatch(size_t n) { recvBatch_ = n == 0 ? 1 : (n > kMaxRecvBatch ? kMaxRecvBatch : n); }
+
+    // datagrams that did not fit a receive buffer; they are dropped, never parsed cut short
+    uint64_t truncated() const { return truncated_.load(std::memory_order_relaxed); }
+
+    // receive buffer size, and so the largest datagram the router sends: a
+    // jumbo frame's worth. Bigger messages are fragmented by the router
+    static constexpr size_t kMaxDatagram = 9216;
+    static constexpr size_t kMaxRecvBatch = 64;
+    static constexpr size_t kMaxPending = 1024;
 
 private:
     int sock_{-1};
+    int family_{0}; // AF_INET or AF_INET6 (dual-stack)
+    int bcast_{-1}; // AF_INET, for v4 broadcasts when family_ is AF_INET6
+    std::vector<int> socks_{};
     uint16_t boundPort_{0};
+    size_t recvBatch_{32};
+    BufferPool pool_{kMaxDatagram};
+    std::vector<std::array<BufferRef, kMaxRecvBatch>> rxSlots_{}; // one set per shard
+    std::atomic<uint64_t> truncated_{0};
+
+    mutable std::mutex pendMtx_;
+    std::deque<Datagram> pending_{};
+    std::atomic<bool> hasPending_{false};
+    WritableHook writableHook_{};
+
+    size_t receiveBatch(size_t shard, const PacketHandler& pktHandler, const RawHandler& rawHandler);
+    bool sendTo(const Endpoint& to, const uint8_t* data, size_t len);
+    bool enqueue(const Endpoint& to, const uint8_t* data, size_t len);
 };
 
 } // namespace p2p
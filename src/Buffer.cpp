@@ -0,0 +1,56 @@
+#include "p2p/Buffer.hpp"
+
+namespace p2p {
+
+struct BufferRef::Block {
+    std::atomic<uint32_t> refs{0};
+    std::shared_ptr<BufferPool::Shared> pool;
+    std::unique_ptr<uint8_t[]> bytes;
+};
+
+BufferRef::BufferRef(const BufferRef& o) : b_(o.b_) {
+    if (b_) b_->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+BufferRef::~BufferRef() {
+    if (b_ && b_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) BufferPool::release(b_);
+}
+
+uint8_t* BufferRef::data() const { return b_ ? b_->bytes.get() : nullptr; }
+size_t BufferRef::capacity() const { return b_ ? b_->pool->blockSize : 0; }
+
+BufferPool::BufferPool(size_t blockSize, size_t maxFree)
+    : shared_(std::make_shared<Shared>(blockSize, maxFree)) {}
+
+BufferPool::~BufferPool() {
+    shared_->closed.store(true, std::memory_order_release);
+    BufferRef::Block* b = nullptr;
+    while (shared_->free.pop(b)) delete b;
+}
+
+BufferRef BufferPool::acquire() {
+    BufferRef::Block* b = nullptr;
+    if (!shared_->free.pop(b)) {
+        b = new BufferRef::Block();
+        b->pool = shared_;
+        b->bytes.reset(new uint8_t[shared_->blockSize]);
+    }
+    b->refs.store(1, std::memory_order_relaxed);
+    return BufferRef(b);
+}
+
+BufferRef BufferPool::allocate(size_t size) {
+    auto* b = new BufferRef::Block();
+    b->pool = std::make_shared<Shared>(size, 1);
+    b->pool->closed.store(true, std::memory_order_relaxed);
+    b->bytes.reset(new uint8_t[size ? size : 1]);
+    b->refs.store(1, std::memory_order_relaxed);
+    return BufferRef(b);
+}
+
+void BufferPool::release(BufferRef::Block* b) {
+    Shared& s = *b->pool;
+    if (s.closed.load(std::memory_order_acquire) || !s.free.push(std::move(b))) delete b;
+}
+
+} // namespace p2p
@@ -6,8 +6,9 @@
 namespace p2p::crypto {
 
 static void ensure_init() {
-    static bool inited = false;
-    if (!inited) { if (sodium_init() == -1) { std::abort(); } inited = true; }
+    // function-local static: initialised once even with several shard threads
+    static const bool inited = sodium_init() != -1;
+    if (!inited) std::abort();
 }
 
 std::vector<uint8_t> sign(const SignSecret& secretKey, const std::vector<uint8_t>& message) {
@@ -52,4 +53,90 @@ std::vector<uint8_t> decrypt(const KeyBytes& recipientPriv, const KeyBytes& send
     return out;
 }
 
+std::optional<SharedKey> beforenm(const KeyBytes& ourPriv, const KeyBytes& theirPub) {
+    ensure_init();
+    SharedKey k{};
+    if (crypto_box_beforenm(k.data(), theirPub.data(), ourPriv.data()) != 0) {
+        wipe(k);
+        return std::nullopt;
+    }
+    return k;
+}
+
+void wipe(SharedKey& key) { sodium_memzero(key.data(), key.size()); }
+
+std::vector<uint8_t> encryptAfternm(const SharedKey& key, const std::vector<uint8_t>& plaintext) {
+    ensure_init();
+    std::vector<uint8_t> out;
+    out.resize(crypto_box_NONCEBYTES + crypto_box_MACBYTES + plaintext.size());
+    uint8_t* nonce = out.data();
+    randombytes_buf(nonce, crypto_box_NONCEBYTES);
+    uint8_t* c = out.data() + crypto_box_NONCEBYTES;
+    if (crypto_box_easy_afternm(c, plaintext.data(), plaintext.size(), nonce, key.data()) != 0) {
+        return {};
+    }
+    return out;
+}
+
+std::vector<uint8_t> decryptAfternm(const SharedKey& key, const std::vector<uint8_t>& ciphertext) {
+    ensure_init();
+    if (ciphertext.size() < crypto_box_NONCEBYTES + crypto_box_MACBYTES) return {};
+    const uint8_t* nonce = ciphertext.data();
+    const uint8_t* c = ciphertext.data() + crypto_box_NONCEBYTES;
+    size_t clen = ciphertext.size() - crypto_box_NONCEBYTES;
+    std::vector<uint8_t> out;
+    out.resize(clen - crypto_box_MACBYTES);
+    if (crypto_box_open_easy_afternm(out.data(), c, clen, nonce, key.data()) != 0) {
+        return {};
+    }
+    return out;
+}
+
+bool decryptAfternmInPlace(const SharedKey& key, uint8_t* buf, size_t len, size_t& ptLen) {
+    ensure_init();
+    if (len < crypto_box_NONCEBYTES + crypto_box_MACBYTES) return false;
+    uint8_t* c = buf + crypto_box_NONCEBYTES;
+    size_t clen = len - crypto_box_NONCEBYTES;
+    // the easy API allows m == c
+    if (crypto_box_open_easy_afternm(c, c, clen, buf, key.data()) != 0) return false;
+    ptLen = clen - crypto_box_MACBYTES;
+    return true;
+}
+
+std::vector<uint8_t> aeadEncrypt(const AeadKey& key, const AeadNonce& nonce, const std::vector<uint8_t>& ad, const std::vector<uint8_t>& plaintext) {
+    ensure_init();
+    std::vector<uint8_t> out(plaintext.size() + crypto_aead_xchacha20poly1305_ietf_ABYTES);
+    unsigned long long clen = 0;
+    if (crypto_aead_xchacha20poly1305_ietf_encrypt(out.data(), &clen, plaintext.data(), plaintext.size(),
+                                                   ad.data(), ad.size(), nullptr, nonce.data(), key.data()) != 0) {
+        return {};
+    }
+    out.resize(clen);
+    return out;
+}
+
+bool aeadDecrypt(const AeadKey& key, const AeadNonce& nonce, const std::vector<uint8_t>& ad, const std::vector<uint8_t>& ciphertext, std::vector<uint8_t>& plaintext) {
+    ensure_init();
+    if (ciphertext.size() < crypto_aead_xchacha20poly1305_ietf_ABYTES) return false;
+    plaintext.resize(ciphertext.size() - crypto_aead_xchacha20poly1305_ietf_ABYTES);
+    unsigned long long mlen = 0;
+    if (crypto_aead_xchacha20poly1305_ietf_decrypt(plaintext.data(), &mlen, nullptr, ciphertext.data(), ciphertext.size(),
+                                                   ad.data(), ad.size(), nonce.data(), key.data()) != 0) {
+        return false;
+    }
+    plaintext.resize(mlen);
+    return true;
+}
+
+bool aeadDecryptInPlace(const AeadKey& key, const AeadNonce& nonce, const uint8_t* ad, size_t adLen, uint8_t* buf, size_t len, size_t& ptLen) {
+    ensure_init();
+    if (len < crypto_aead_xchacha20poly1305_ietf_ABYTES) return false;
+    unsigned long long mlen = 0;
+    if (crypto_aead_xchacha20poly1305_ietf_decrypt(buf, &mlen, nullptr, buf, len, ad, adLen, nonce.data(), key.data()) != 0) {
+        return false;
+    }
+    ptLen = static_cast<size_t>(mlen);
+    return true;
+}
+
 } // namespace p2p::crypto
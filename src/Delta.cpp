@@ -0,0 +1,90 @@
+#include "p2p/Delta.hpp"
+
+#include <sodium.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+namespace p2p::delta {
+
+void Rolling::reset(const uint8_t* p, size_t n) {
+    a_ = b_ = 0;
+    n_ = n;
+    for (size_t i = 0; i < n; ++i) {
+        a_ += p[i];
+        b_ += static_cast<uint32_t>(n - i) * p[i];
+    }
+}
+
+Strong strong(const uint8_t* p, size_t n) {
+    Strong s{};
+    crypto_generichash(s.data(), s.size(), p, n, nullptr, 0);
+    return s;
+}
+
+Sig sign(const uint8_t* p, size_t n) {
+    Rolling r;
+    r.reset(p, n);
+    return Sig{r.value(), strong(p, n)};
+}
+
+uint32_t blockSize(uint64_t basisSize) {
+    uint64_t b = static_cast<uint64_t>(std::sqrt(static_cast<double>(basisSize)));
+    b = (b + 63) / 64 * 64;
+    return static_cast<uint32_t>(std::clamp<uint64_t>(b, 1024, 1 << 20));
+}
+
+std::vector<Ref> match(const std::vector<Sig>& sigs, uint32_t blockSize, uint64_t size, const Source& read) {
+    std::vector<Ref> refs;
+    if (sigs.empty() || blockSize == 0 || size < blockSize) return refs;
+    std::unordered_map<uint32_t, std::vector<uint32_t>> byWeak;
+    byWeak.reserve(sigs.size());
+    // a 16-bit tag rules out most offsets without touching the map, as in rsync
+    auto tag = [](uint32_t w){ return (w ^ (w >> 16)) & 0xFFFF; };
+    std::vector<bool> tags(1 << 16);
+    for (uint32_t i = 0; i < sigs.size(); ++i) {
+        byWeak[sigs[i].weak].push_back(i);
+        tags[tag(sigs[i].weak)] = true;
+    }
+
+    // a copied window of the file that always holds the block plus the next byte
+    const size_t seg = std::max<size_t>(size_t(1) << 20, size_t(blockSize) * 4);
+    std::vector<uint8_t> buf;
+    uint64_t bufAt = 0;
+    auto fill = [&](uint64_t at) {
+        size_t len = static_cast<size_t>(std::min<uint64_t>(seg, size - at));
+        auto v = read(at, len);
+        if (!v || v->size() != len) return false;
+        buf.assign(v->begin(), v->end());
+        bufAt = at;
+        return true;
+    };
+    if (!fill(0)) return {};
+    Rolling r;
+    bool fresh = true;
+    for (uint64_t i = 0; i + blockSize <= size; ) {
+        if (i + blockSize + 1 > bufAt + buf.size() && bufAt + buf.size() < size && !fill(i)) return {};
+        const uint8_t* p = buf.data() + (i - bufAt);
+        if (fresh) { r.reset(p, blockSize); fresh = false; }
+        auto it = tags[tag(r.value())] ? byWeak.find(r.value()) : byWeak.end();
+        if (it != byWeak.end()) {
+            Strong s = strong(p, blockSize);
+            auto hit = std::find_if(it->second.begin(), it->second.end(), [&](uint32_t b){
+                return std::memcmp(sigs[b].strong.data(), s.data(), s.size()) == 0;
+            });
+            if (hit != it->second.end()) {
+                refs.push_back(Ref{i, *hit});
+                i += blockSize;
+                fresh = true;
+                continue;
+            }
+        }
+        if (i + blockSize >= size) break;
+        r.roll(p[0], p[blockSize]);
+        ++i;
+    }
+    return refs;
+}
+
+} // namespace p2p::delta
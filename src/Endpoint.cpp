@@ -0,0 +1,73 @@
+#include "p2p/Endpoint.hpp"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#endif
+
+#include <cstdlib>
+
+namespace p2p {
+
+// "2" or an interface name; 0 if neither
+static uint32_t parseScope(const std::string& s) {
+    if (s.empty()) return 0;
+    char* end = nullptr;
+    unsigned long n = std::strtoul(s.c_str(), &end, 10);
+    if (*end == '\0') return static_cast<uint32_t>(n);
+#ifdef _WIN32
+    return 0;
+#else
+    return ::if_nametoindex(s.c_str());
+#endif
+}
+
+Endpoint::Endpoint(const std::string& ip, uint16_t p) : port(p) {
+    in_addr a4{};
+    in6_addr a6{};
+    size_t pct = ip.find('%');
+    if (::inet_pton(AF_INET, ip.c_str(), &a4) == 1) {
+        family = Family::V4;
+        std::memcpy(addr.data(), &a4, 4);
+    } else if (::inet_pton(AF_INET6, ip.substr(0, pct).c_str(), &a6) == 1) {
+        if (pct != std::string::npos && (scope = parseScope(ip.substr(pct + 1))) == 0) return;
+        family = Family::V6;
+        std::memcpy(addr.data(), &a6, 16);
+    }
+}
+
+Endpoint Endpoint::v4(const uint8_t bytes[4], uint16_t port) {
+    Endpoint e;
+    e.family = Family::V4;
+    e.port = port;
+    std::memcpy(e.addr.data(), bytes, 4);
+    return e;
+}
+
+Endpoint Endpoint::v6(const uint8_t bytes[16], uint16_t port, uint32_t scope) {
+    Endpoint e;
+    e.family = Family::V6;
+    e.port = port;
+    e.scope = scope;
+    std::memcpy(e.addr.data(), bytes, 16);
+    return e;
+}
+
+std::string Endpoint::ip() const {
+    char buf[INET6_ADDRSTRLEN] = {0};
+    if (family == Family::V4) ::inet_ntop(AF_INET, addr.data(), buf, sizeof(buf));
+    else if (family == Family::V6) ::inet_ntop(AF_INET6, addr.data(), buf, sizeof(buf));
+    if (family == Family::V6 && scope) return std::string(buf) + "%" + std::to_string(scope);
+    return buf;
+}
+
+std::string Endpoint::toString() const {
+    if (family == Family::V6) return "[" + ip() + "]:" + std::to_string(port);
+    return ip() + ":" + std::to_string(port);
+}
+
+} // namespace p2p
@@ -0,0 +1,292 @@
+#include "p2p/EventLoop.hpp"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <fcntl.h>
+#include <sys/select.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+#include <algorithm>
+
+namespace p2p {
+
+EventLoop::TimerId EventLoop::addTimer(std::chrono::milliseconds delay, TimerCallback cb, bool repeat) {
+    TimerId id;
+    {
+        std::lock_guard<std::mutex> lock(timerMtx_);
+        id = nextTimer_++;
+        timers_[id] = Timer{std::move(cb), delay, repeat};
+        heap_.push(Due{Clock::now() + delay, id});
+    }
+    wakeup();
+    return id;
+}
+
+void EventLoop::cancelTimer(TimerId id) {
+    // heap entry is dropped lazily when it comes due
+    std::lock_guard<std::mutex> lock(timerMtx_);
+    timers_.erase(id);
+}
+
+int EventLoop::nextTimeout(int maxWaitMs) {
+    std::lock_guard<std::mutex> lock(timerMtx_);
+    while (!heap_.empty() && !timers_.count(heap_.top().id)) heap_.pop();
+    if (heap_.empty()) return maxWaitMs;
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(heap_.top().at - Clock::now()).count();
+    if (left < 0) left = 0;
+    return static_cast<int>(std::min<long long>(left, maxWaitMs));
+}
+
+void EventLoop::fireTimers() {
+    auto now = Clock::now();
+    for (;;) {
+        TimerCallback cb;
+        {
+            std::lock_guard<std::mutex> lock(timerMtx_);
+            if (heap_.empty() || heap_.top().at > now) return;
+            Due d = heap_.top(); heap_.pop();
+            auto it = timers_.find(d.id);
+            if (it == timers_.end()) continue;
+            if (it->second.repeat) {
+                cb = it->second.cb;
+                // keep cadence; skip missed periods instead of bursting
+                auto next = d.at + it->second.interval;
+                if (next <= now) next = now + it->second.interval;
+                heap_.push(Due{next, d.id});
+            } else {
+                cb = std::move(it->second.cb);
+                timers_.erase(it);
+            }
+        }
+        if (cb) cb();
+    }
+}
+
+void EventLoop::runOnce(int maxWaitMs) {
+    wait(nextTimeout(maxWaitMs));
+    fireTimers();
+}
+
+namespace {
+
+// portable level-triggered backend with a self-pipe for cross-thread wakeups
+class SelectLoop : public EventLoop {
+public:
+    SelectLoop() {
+#ifdef _WIN32
+        // no pipes in select(): a loopback UDP socket that sends to itself
+        SOCKET s = ::socket(AF_INET, SOCK_DGRAM, 0);
+        if (s == INVALID_SOCKET) return;
+        sockaddr_in a{}; a.sin_family = AF_INET; a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        int alen = sizeof(a);
+        u_long mode = 1;
+        if (::bind(s, (sockaddr*)&a, alen) != 0 || ::getsockname(s, (sockaddr*)&a, &alen) != 0 ||
+            ::connect(s, (sockaddr*)&a, alen) != 0 || ioctlsocket(s, FIONBIO, &mode) != 0) {
+            ::closesocket(s);
+            return;
+        }
+        wakeRd_ = wakeWr_ = (int)s;
+#else
+        int p[2];
+        if (::pipe(p) != 0) return;
+        for (int fd : p) {
+            ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+            ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+        wakeRd_ = p[0]; wakeWr_ = p[1];
+#endif
+    }
+    ~SelectLoop() override {
+#ifdef _WIN32
+        if (wakeRd_ >= 0) ::closesocket((SOCKET)wakeRd_);
+#else
+        if (wakeRd_ >= 0) ::close(wakeRd_);
+        if (wakeWr_ >= 0) ::close(wakeWr_);
+#endif
+    }
+
+    bool edgeTriggered() const override { return false; }
+
+    bool add(int fd, uint32_t events, IoCallback cb) override {
+        std::lock_guard<std::mutex> lock(mtx_);
+        fds_[fd] = Watch{events, std::move(cb)};
+        return true;
+    }
+    bool modify(int fd, uint32_t events) override {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto it = fds_.find(fd);
+        if (it == fds_.end()) return false;
+        it->second.events = events;
+        // the set being waited on was built before this change
+        wakeup();
+        return true;
+    }
+    void remove(int fd) override {
+        std::lock_guard<std::mutex> lock(mtx_);
+        fds_.erase(fd);
+    }
+    void wakeup() override {
+        if (wakeWr_ < 0) return;
+        // a full pipe already holds a wakeup, so a failed write loses nothing
+        char one = 1;
+#ifdef _WIN32
+        ::send((SOCKET)wakeWr_, &one, 1, 0);
+#else
+        (void)!::write(wakeWr_, &one, 1);
+#endif
+    }
+
+protected:
+    void wait(int timeoutMs) override {
+        fd_set rfds, wfds;
+        FD_ZERO(&rfds); FD_ZERO(&wfds);
+        int maxFd = wakeRd_;
+        if (wakeRd_ >= 0) FD_SET(wakeRd_, &rfds);
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            for (auto& [fd, w] : fds_) {
+                if (w.events & Readable) FD_SET(fd, &rfds);
+                if (w.events & Writable) FD_SET(fd, &wfds);
+                maxFd = std::max(maxFd, fd);
+            }
+        }
+        timeval tv{ timeoutMs/1000, (timeoutMs%1000)*1000 };
+        if (maxFd < 0) {
+#ifdef _WIN32
+            Sleep(timeoutMs);
+#else
+            ::select(0, nullptr, nullptr, nullptr, &tv);
+#endif
+            return;
+        }
+        int r = ::select(maxFd+1, &rfds, &wfds, nullptr, &tv);
+        if (r <= 0) return;
+        if (wakeRd_ >= 0 && FD_ISSET(wakeRd_, &rfds)) {
+            char buf[64];
+#ifdef _WIN32
+            while (::recv((SOCKET)wakeRd_, buf, sizeof(buf), 0) > 0) {}
+#else
+            while (::read(wakeRd_, buf, sizeof(buf)) > 0) {}
+#endif
+        }
+        std::vector<std::pair<IoCallback, uint32_t>> ready;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            for (auto& [fd, w] : fds_) {
+                uint32_t ev = 0;
+                if (FD_ISSET(fd, &rfds)) ev |= Readable;
+                if (FD_ISSET(fd, &wfds)) ev |= Writable;
+                if (ev) ready.emplace_back(w.cb, ev);
+            }
+        }
+        for (auto& [cb, ev] : ready) cb(ev);
+    }
+
+private:
+    struct Watch { uint32_t events; IoCallback cb; };
+    int wakeRd_{-1};
+    int wakeWr_{-1}; // the same socket as wakeRd_ on windows
+    std::mutex mtx_;
+    std::unordered_map<int, Watch> fds_{};
+};
+
+#if defined(__linux__)
+// edge-triggered epoll backend with an eventfd for cross-thread wakeups
+class EpollLoop : public EventLoop {
+public:
+    EpollLoop() {
+        ep_ = ::epoll_create1(EPOLL_CLOEXEC);
+        wake_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        epoll_event ev{}; ev.events = EPOLLIN; ev.data.fd = wake_;
+        ::epoll_ctl(ep_, EPOLL_CTL_ADD, wake_, &ev);
+    }
+    ~EpollLoop() override {
+        if (wake_ >= 0) ::close(wake_);
+        if (ep_ >= 0) ::close(ep_);
+    }
+
+    bool ok() const { return ep_ >= 0 && wake_ >= 0; }
+    bool edgeTriggered() const override { return true; }
+
+    bool add(int fd, uint32_t events, IoCallback cb) override {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            cbs_[fd] = std::move(cb);
+        }
+        epoll_event ev{}; ev.events = mask(events); ev.data.fd = fd;
+        return ::epoll_ctl(ep_, EPOLL_CTL_ADD, fd, &ev) == 0;
+    }
+    bool modify(int fd, uint32_t events) override {
+        epoll_event ev{}; ev.events = mask(events); ev.data.fd = fd;
+        return ::epoll_ctl(ep_, EPOLL_CTL_MOD, fd, &ev) == 0;
+    }
+    void remove(int fd) override {
+        ::epoll_ctl(ep_, EPOLL_CTL_DEL, fd, nullptr);
+        std::lock_guard<std::mutex> lock(mtx_);
+        cbs_.erase(fd);
+    }
+    void wakeup() override {
+        uint64_t one = 1;
+        (void)!::write(wake_, &one, sizeof(one));
+    }
+
+protected:
+    void wait(int timeoutMs) override {
+        epoll_event evs[64];
+        int n = ::epoll_wait(ep_, evs, 64, timeoutMs);
+        for (int i = 0; i < n; ++i) {
+            int fd = evs[i].data.fd;
+            if (fd == wake_) {
+                uint64_t v; (void)!::read(wake_, &v, sizeof(v));
+                continue;
+            }
+            uint32_t ev = 0;
+            if (evs[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) ev |= Readable;
+            if (evs[i].events & EPOLLOUT) ev |= Writable;
+            IoCallback cb;
+            {
+                std::lock_guard<std::mutex> lock(mtx_);
+                auto it = cbs_.find(fd);
+                if (it == cbs_.end()) continue;
+                cb = it->second;
+            }
+            cb(ev);
+        }
+    }
+
+private:
+    static uint32_t mask(uint32_t events) {
+        uint32_t m = EPOLLET;
+        if (events & Readable) m |= EPOLLIN;
+        if (events & Writable) m |= EPOLLOUT;
+        return m;
+    }
+
+    int ep_{-1};
+    int wake_{-1};
+    std::mutex mtx_;
+    std::unordered_map<int, IoCallback> cbs_{};
+};
+#endif
+
+} // namespace
+
+std::unique_ptr<EventLoop> EventLoop::create(Backend backend) {
+#if defined(__linux__)
+    if (backend != Backend::Select) {
+        auto ep = std::make_unique<EpollLoop>();
+        if (ep->ok()) return ep;
+    }
+#else
+    (void)backend;
+#endif
+    return std::make_unique<SelectLoop>();
+}
+
+} // namespace p2p
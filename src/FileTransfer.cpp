@@ -4,114 +4,1878 @@
 #include <sodium.h>
 #include <filesystem>
 #include <cstring>
+#include <algorithm>
+#include <bitset>
+#include <cerrno>
+#include <cctype>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
 
 namespace p2p {
 
 static void ensure_init() {
-    static bool inited = false;
-    if (!inited) { if (sodium_init() == -1) { std::abort(); } inited = true; }
+    // function-local static: initialised once even with several shard threads
+    static const bool inited = sodium_init() != -1;
+    if (!inited) std::abort();
+}
+
+// a FILE_CHUNK (type|id|unit|bytes) that fills an mtu-byte datagram even in the
+// larger signed format, so chunks are never fragmented
+static size_t chunkFor(size_t mtu) { return mtu - Packet::kSignedOverhead - Router::kFrameBytes - (1+16+4); }
+
+static constexpr auto kMinRto = std::chrono::milliseconds(10); // receivers hold an ack for 1 ms at most (cf. RFC 9002)
+static constexpr auto kMaxRto = std::chrono::seconds(10);
+static constexpr size_t kReadWindow = 256 * 1024; // sendFile reads the source this much at a time
+
+// positional file I/O for the streaming receive
+static int openFile(const std::string& path, bool truncate) {
+#ifdef _WIN32
+    int flags = _O_BINARY | _O_CREAT | _O_RDWR | (truncate ? _O_TRUNC : 0);
+    return ::_open(path.c_str(), flags, _S_IREAD | _S_IWRITE);
+#else
+    int flags = O_CREAT | O_RDWR | O_CLOEXEC | (truncate ? O_TRUNC : 0);
+    return ::open(path.c_str(), flags, 0600);
+#endif
+}
+
+// reserve the blocks up front so a full disk fails here, not halfway through.
+// Only a filesystem that cannot preallocate gets a sparse file instead
+static bool reserve(int fd, uint64_t size) {
+#ifdef _WIN32
+    return ::_chsize_s(fd, static_cast<__int64>(size)) == 0;
+#elif defined(__linux__)
+    int err = ::posix_fallocate(fd, 0, static_cast<off_t>(size));
+    if (err == EOPNOTSUPP || err == EINVAL) return ::ftruncate(fd, static_cast<off_t>(size)) == 0;
+    return err == 0;
+#else
+    return ::ftruncate(fd, static_cast<off_t>(size)) == 0;
+#endif
+}
+
+static bool writeAt(int fd, uint64_t off, const uint8_t* p, size_t n) {
+#ifdef _WIN32
+    if (::_lseeki64(fd, static_cast<__int64>(off), SEEK_SET) < 0) return false;
+    return ::_write(fd, p, static_cast<unsigned>(n)) == static_cast<int>(n);
+#else
+    while (n > 0) {
+        ssize_t w = ::pwrite(fd, p, n, static_cast<off_t>(off));
+        if (w < 0) { if (errno == EINTR) continue; return false; }
+        p += w; off += static_cast<uint64_t>(w); n -= static_cast<size_t>(w);
+    }
+    return true;
+#endif
+}
+
+static int openRead(const std::string& path) {
+#ifdef _WIN32
+    return ::_open(path.c_str(), _O_BINARY | _O_RDONLY);
+#else
+    return ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+#endif
+}
+
+static bool readAt(int fd, uint64_t off, uint8_t* p, size_t n) {
+#ifdef _WIN32
+    if (::_lseeki64(fd, static_cast<__int64>(off), SEEK_SET) < 0) return false;
+    return ::_read(fd, p, static_cast<unsigned>(n)) == static_cast<int>(n);
+#else
+    while (n > 0) {
+        ssize_t r = ::pread(fd, p, n, static_cast<off_t>(off));
+        if (r < 0) { if (errno == EINTR) continue; return false; }
+        if (r == 0) return false;
+        p += r; off += static_cast<uint64_t>(r); n -= static_cast<size_t>(r);
+    }
+    return true;
+#endif
+}
+
+// a descriptor of its own, readable after the original is closed
+static int dupFile(int fd) {
+#ifdef _WIN32
+    return ::_dup(fd);
+#else
+    return ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+#endif
+}
+
+static void closeFile(int fd) {
+#ifdef _WIN32
+    ::_close(fd);
+#else
+    ::close(fd);
+#endif
+}
+
+static void put32(std::vector<uint8_t>& out, uint32_t v) {
+    out.push_back((v>>24)&0xFF); out.push_back((v>>16)&0xFF); out.push_back((v>>8)&0xFF); out.push_back(v&0xFF);
+}
+
+static uint32_t get32(const uint8_t* p) {
+    return (uint32_t(p[0])<<24) | (uint32_t(p[1])<<16) | (uint32_t(p[2])<<8) | p[3];
+}
+
+// progress file: "P2PS", version, root, size, chunkSize, then the unit bitmap
+// in host order from kStateHeader. Bits are only set after the data is written
+static constexpr size_t kStateHeader = 64;
+
+static std::vector<uint8_t> stateHeader(const merkle::Hash& root, uint64_t size, uint32_t chunkSize) {
+    std::vector<uint8_t> h(kStateHeader, 0);
+    std::memcpy(h.data(), "P2PS", 4);
+    h[4] = 1;
+    std::memcpy(h.data() + 8, root.data(), root.size());
+    std::memcpy(h.data() + 40, &size, sizeof(size));
+    std::memcpy(h.data() + 48, &chunkSize, sizeof(chunkSize));
+    return h;
+}
+
+static bool loadState(const std::string& path, const std::vector<uint8_t>& header, std::vector<uint64_t>& have) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    std::vector<uint8_t> h(kStateHeader);
+    if (!in.read(reinterpret_cast<char*>(h.data()), h.size()) || h != header) return false;
+    return static_cast<bool>(in.read(reinterpret_cast<char*>(have.data()), have.size() * sizeof(uint64_t)));
+}
+
+bool FileTransfer::Layout::make(uint64_t size, uint32_t chunkSize, Layout& out) {
+    if (size == 0 || chunkSize == 0) return false;
+    uint64_t chunks = (size + chunkSize - 1) / chunkSize;
+    uint64_t pages = (chunks + merkle::kPageLeaves - 1) / merkle::kPageLeaves;
+    if (chunks + pages > UINT32_MAX) return false;
+    out.size = size;
+    out.chunkSize = chunkSize;
+    out.chunks = static_cast<uint32_t>(chunks);
+    out.pages = static_cast<uint32_t>(pages);
+    return true;
+}
+
+size_t FileTransfer::Layout::chunkLen(uint32_t i) const {
+    return static_cast<size_t>(std::min<uint64_t>(chunkSize, size - uint64_t(i) * chunkSize));
+}
+
+bool FileTransfer::Layout::isChunk(uint32_t unit, uint32_t& chunk) {
+    uint32_t k = unit % (merkle::kPageLeaves + 1);
+    if (k == 0) return false;
+    chunk = unit / (merkle::kPageLeaves + 1) * merkle::kPageLeaves + k - 1;
+    return true;
 }
 
-FileTransfer::FileTransfer(Node& node) : node_(node) {
+FileTransfer::FileTransfer(Node& node) : FileTransfer(node, Options{}) {}
+
+FileTransfer::FileTransfer(Node& node, Options opts)
+    : node_(node), opts_(opts), guard_(std::make_shared<Guard>()) {
     ensure_init();
-    node_.onTypedMessage([this](const PeerId& from, MessageType type, const std::vector<uint8_t>& body){
-        if (type != MessageType::FILE_CHUNK) return;
-        // rebuild with type prefix
-        std::vector<uint8_t> data; data.reserve(1+body.size());
-        data.push_back(static_cast<uint8_t>(MessageType::FILE_CHUNK));
-        data.insert(data.end(), body.begin(), body.end());
-        FileId id{}; uint32_t index=0,total=0; std::string name; std::vector<uint8_t> chunk;
-        if (!parseChunk(data, id, index, total, name, chunk)) return;
-        auto key = toHex16(id);
-        auto it = in_.find(key);
-        if (it == in_.end()) {
-            Incoming inc; inc.name = name; inc.total = total; inc.received = 0; inc.chunks.resize(total);
-            it = in_.emplace(key, std::move(inc)).first;
-        }
-        Incoming& inc = it->second;
-        if (inc.total != total) inc.total = total;
-        if (!inc.chunks[index].has_value()) {
-            inc.chunks[index] = std::move(chunk);
-            inc.received++;
-        }
-        if (inc.received == inc.total) {
-            std::vector<uint8_t> file;
-            for (auto& opt : inc.chunks) { file.insert(file.end(), opt->begin(), opt->end()); }
-            if (onFile_) onFile_(from, inc.name, file);
-            in_.erase(it);
+    guard_->self = this;
+    // the node outlives us and keeps the handler; the guard cuts it off on destruction
+    node_.onTypedMessageView([g = guard_](const PeerId& from, MessageType type, ByteView body){
+        std::shared_lock<std::shared_mutex> lock(g->mtx);
+        if (!g->self) return;
+        switch (type) {
+        case MessageType::FILE_MANIFEST: g->self->handleManifest(from, body); break;
+        case MessageType::FILE_RESUME: g->self->handleResume(from, body); break;
+        case MessageType::FILE_CHUNK: g->self->handleChunk(from, body); break;
+        case MessageType::FILE_ACK: g->self->handleAck(from, body); break;
+        case MessageType::FILE_QUERY: g->self->handleQuery(from, body); break;
+        case MessageType::FILE_HAVE: g->self->handleHave(from, body); break;
+        case MessageType::FILE_REQUEST: g->self->handleRequest(from, body); break;
+        case MessageType::FILE_COPY: g->self->handleChunk(from, body, true); break;
+        case MessageType::FILE_SIGREQ: g->self->handleSigRequest(from, body); break;
+        case MessageType::FILE_SIGS: g->self->handleSigs(from, body); break;
+        default: break;
         }
     });
+    sweepTimer_ = node_.eventLoop().addTimer(std::chrono::seconds(1), [g = guard_]{
+        std::shared_lock<std::shared_mutex> lock(g->mtx);
+        if (g->self) g->self->sweep();
+    }, true);
+}
+
+FileTransfer::~FileTransfer() {
+    node_.eventLoop().cancelTimer(sweepTimer_);
+    { std::unique_lock<std::shared_mutex> l(guard_->mtx); guard_->self = nullptr; }
+    // partial files with anything verified stay on disk for the next attempt
+    std::lock_guard<std::mutex> lock(inMtx_);
+    for (auto it = in_.begin(); it != in_.end(); ) {
+        auto cur = it++;
+        if (!cur->second.verified()) { discard(cur); continue; }
+        saveProgress(cur->second);
+        closeIncoming(cur->second);
+    }
+    in_.clear();
+    std::lock_guard<std::mutex> sl(shareMtx_);
+    for (auto& [id, sh] : shares_) if (sh->fd >= 0) closeFile(sh->fd);
+}
+
+FileTransfer::Stats FileTransfer::stats() const {
+    Stats s;
+    s.incoming = incoming_.load(std::memory_order_relaxed);
+    s.reserved = reserved_.load(std::memory_order_relaxed);
+    s.diskReserved = diskReserved_.load(std::memory_order_relaxed);
+    s.evicted = evicted_.load(std::memory_order_relaxed);
+    s.rejected = rejected_.load(std::memory_order_relaxed);
+    s.stalled = stalled_.load(std::memory_order_relaxed);
+    return s;
+}
+
+uint64_t FileTransfer::footprint(const Layout& L, bool inMemory) {
+    uint64_t bitmap = (uint64_t(L.units()) + 63) / 64 * sizeof(uint64_t);
+    uint64_t hashes = (uint64_t(L.pages) + std::min<uint64_t>(L.pages, kMaxOpenPages) * merkle::kPageLeaves) * sizeof(merkle::Hash);
+    return bitmap + hashes + std::min<uint64_t>(L.size, kMaxEarlyBytes) + (inMemory ? L.size : 0);
+}
+
+FileTransfer::InIter FileTransfer::admit(const PeerId& from, const Manifest& m, bool download) {
+    const FileId id = idOf(m.root);
+    uint64_t cost = footprint(m.layout, saveDir_.empty());
+    uint64_t disk = saveDir_.empty() ? 0 : m.layout.size;
+    uint64_t peerCost = 0, peerDisk = 0;
+    for (const auto& [k, inc] : in_) {
+        if (download || inc.peer != from) continue;
+        peerCost += inc.cost;
+        peerDisk += inc.disk;
+    }
+    if (m.layout.units() > opts_.maxUnits || cost > opts_.maxBytes || disk > opts_.maxDiskBytes ||
+        (!download && (peerCost + cost > opts_.maxBytesPerPeer || peerDisk + disk > opts_.maxDiskBytesPerPeer))) {
+        rejected_++;
+        return in_.end();
+    }
+    // make room from the transfers idle longest; ones being downloaded are kept
+    auto now = Clock::now();
+    while (reserved_ + cost > opts_.maxBytes || diskReserved_ + disk > opts_.maxDiskBytes) {
+        auto victim = in_.end();
+        for (auto it = in_.begin(); it != in_.end(); ++it) {
+            if (pulls_.count(it->first) || now - it->second.activeAt < kEvictIdle) continue;
+            if (victim == in_.end() || it->second.activeAt < victim->second.activeAt) victim = it;
+        }
+        if (victim == in_.end()) { rejected_++; return in_.end(); }
+        evict(victim);
+    }
+    Incoming inc;
+    if (!startIncoming(m, inc)) { rejected_++; return in_.end(); }
+    if (!download) inc.peer = from;
+    inc.cost = cost;
+    inc.disk = disk;
+    inc.activeAt = now;
+    reserved_ += cost;
+    diskReserved_ += disk;
+    incoming_++;
+    return in_.emplace(id, std::move(inc)).first;
+}
+
+void FileTransfer::evict(InIter it) {
+    evicted_++;
+    // nothing verified yet is not worth keeping on disk
+    if (!it->second.verified()) { discard(it); return; }
+    // the sender gives up on its own; in disk mode the next offer resumes
+    saveProgress(it->second);
+    closeIncoming(it->second);
+    reserved_ -= it->second.cost;
+    diskReserved_ -= it->second.disk;
+    incoming_--;
+    in_.erase(it);
+}
+
+void FileTransfer::discard(InIter it) {
+    Incoming& inc = it->second;
+    closeIncoming(inc);
+    std::error_code ec;
+    if (!inc.partPath.empty()) std::filesystem::remove(inc.partPath, ec);
+    if (!inc.statePath.empty()) std::filesystem::remove(inc.statePath, ec);
+    reserved_ -= inc.cost;
+    diskReserved_ -= inc.disk;
+    incoming_--;
+    in_.erase(it);
+}
+
+void FileTransfer::sweep() {
+    std::string dir;
+    std::vector<std::string> open;
+    {
+        std::lock_guard<std::mutex> lock(inMtx_);
+        auto now = Clock::now();
+        for (auto it = in_.begin(); it != in_.end(); ) {
+            auto cur = it++;
+            if (!pulls_.count(cur->first) && now - cur->second.activeAt > opts_.idleTimeout) evict(cur);
+        }
+        if (saveDir_.empty() || now - scannedAt_ < kPartialScan) return;
+        scannedAt_ = now;
+        dir = saveDir_;
+        for (const auto& [id, inc] : in_) {
+            open.push_back(std::filesystem::path(inc.partPath).filename().string());
+            open.push_back(std::filesystem::path(inc.statePath).filename().string());
+        }
+    }
+    removeStale(dir, open);
+}
+
+void FileTransfer::removeStale(const std::string& dir, const std::vector<std::string>& open) const {
+    namespace fs = std::filesystem;
+    auto cutoff = fs::file_time_type::clock::now() - opts_.partialTtl;
+    std::error_code ec;
+    for (fs::directory_iterator e(dir, ec), end; !ec && e != end; e.increment(ec)) {
+        // ".<root in hex>.part" and ".<root in hex>.state"
+        std::string name = e->path().filename().string();
+        bool ours = name.size() > 66 && name[0] == '.' && name[65] == '.' &&
+                    (name.compare(66, std::string::npos, "part") == 0 || name.compare(66, std::string::npos, "state") == 0) &&
+                    std::all_of(name.begin() + 1, name.begin() + 65, [](char c){ return std::isxdigit(static_cast<unsigned char>(c)); });
+        if (!ours || std::find(open.begin(), open.end(), name) != open.end()) continue;
+        std::error_code fe;
+        auto t = e->last_write_time(fe);
+        if (!fe && t < cutoff) fs::remove(e->path(), fe);
+    }
+}
+
+void FileTransfer::receiveToDirectory(const std::string& dir, SavedHandler cb, bool replace) {
+    saveDir_ = dir;
+    onSaved_ = std::move(cb);
+    replace_ = replace;
+}
+
+bool FileTransfer::startIncoming(const Manifest& m, Incoming& inc) {
+    const Layout& L = m.layout;
+    inc.m = m;
+    inc.have.assign((L.units() + 63) / 64, 0);
+    if (saveDir_.empty()) {
+        // admit charged it already; never size a buffer past the budget regardless
+        if (L.size > opts_.maxBytes || L.size > inc.data.max_size()) return false;
+        inc.data.resize(L.size);
+        return true;
+    }
+    // named by the full root so a later offer of the same content finds them
+    std::string stem = "." + toHex(m.root.data(), m.root.size());
+    inc.partPath = (std::filesystem::path(saveDir_) / (stem + ".part")).string();
+    inc.statePath = (std::filesystem::path(saveDir_) / (stem + ".state")).string();
+    auto header = stateHeader(m.root, L.size, L.chunkSize);
+    std::error_code ec;
+    bool resumed = std::filesystem::exists(inc.partPath, ec) && loadState(inc.statePath, header, inc.have);
+    if (!resumed) {
+        std::fill(inc.have.begin(), inc.have.end(), 0);
+        // a size the disk cannot take is refused before anything is allocated
+        auto space = std::filesystem::space(saveDir_, ec);
+        if (ec || L.size > space.available) return false;
+    }
+
+    inc.fd = openFile(inc.partPath, !resumed);
+    if (inc.fd < 0) return false;
+    inc.stateFd = openFile(inc.statePath, !resumed);
+    if (inc.stateFd < 0 || !reserve(inc.fd, L.size) ||
+        (!resumed && !writeAt(inc.stateFd, 0, header.data(), header.size()))) {
+        closeIncoming(inc);
+        return false;
+    }
+    if (replace_) {
+        // the copy this one replaces, offered to the sender as a delta basis
+        auto basis = std::filesystem::path(saveDir_) / localName(m.name, toHex16(idOf(m.root)));
+        uint64_t size = std::filesystem::file_size(basis, ec);
+        if (!ec && size >= delta::blockSize(size)) {
+            inc.basisFd = openRead(basis.string());
+            inc.basisSize = size;
+            inc.blockSize = delta::blockSize(size);
+        }
+    }
+    if (!resumed) {
+        saveProgress(inc);
+        return true;
+    }
+    // page hashes are not kept: ask again for every page that still has holes
+    for (uint32_t p = 0; p < L.pages; ++p) {
+        uint32_t first = Layout::pageUnit(p) + 1, n = L.leavesIn(p);
+        bool full = true;
+        for (uint32_t u = first; u < first + n && full; ++u) full = inc.has(u);
+        if (!full) inc.have[Layout::pageUnit(p) / 64] &= ~(uint64_t(1) << (Layout::pageUnit(p) % 64));
+    }
+    if (L.units() % 64) inc.have.back() &= (uint64_t(1) << (L.units() % 64)) - 1;
+    for (uint64_t w : inc.have) inc.received += static_cast<uint32_t>(std::bitset<64>(w).count());
+    while (inc.next < L.units() && inc.has(inc.next)) ++inc.next;
+    for (uint32_t u = L.units(); u > 0; --u) if (inc.has(u - 1)) { inc.high = u; break; }
+    return true;
+}
+
+void FileTransfer::saveProgress(Incoming& inc) {
+    inc.unsaved = 0;
+    if (inc.stateFd < 0) return;
+    if (inc.dirtyLo >= inc.dirtyHi) { inc.dirtyLo = 0; inc.dirtyHi = static_cast<uint32_t>(inc.have.size()); }
+    // early chunks are acked but not yet on disk
+    std::vector<uint64_t> words(inc.have.begin() + inc.dirtyLo, inc.have.begin() + inc.dirtyHi);
+    for (const auto& e : inc.early) {
+        uint32_t u = Layout::pageUnit(e.first / merkle::kPageLeaves) + 1 + e.first % merkle::kPageLeaves;
+        if (u / 64 >= inc.dirtyLo && u / 64 < inc.dirtyHi) words[u / 64 - inc.dirtyLo] &= ~(uint64_t(1) << (u % 64));
+    }
+    writeAt(inc.stateFd, kStateHeader + uint64_t(inc.dirtyLo) * sizeof(uint64_t),
+            reinterpret_cast<const uint8_t*>(words.data()), words.size() * sizeof(uint64_t));
+    inc.dirtyLo = UINT32_MAX;
+    inc.dirtyHi = 0;
+}
+
+void FileTransfer::closeIncoming(Incoming& inc) {
+    if (inc.fd >= 0) closeFile(inc.fd);
+    if (inc.stateFd >= 0) closeFile(inc.stateFd);
+    if (inc.basisFd >= 0) closeFile(inc.basisFd);
+    inc.fd = inc.stateFd = inc.basisFd = -1;
+}
+
+std::string FileTransfer::finishOnDisk(Incoming& inc, const FileId& id) {
+    closeIncoming(inc);
+    std::error_code ec;
+    std::filesystem::remove(inc.statePath, ec);
+    std::string base = localName(inc.m.name, toHex16(id));
+    std::filesystem::path dir(saveDir_);
+    std::filesystem::path dst = dir / base;
+    for (int n = 1; !replace_ && std::filesystem::exists(dst, ec) && n < 1000; ++n) {
+        dst = dir / (base + "." + std::to_string(n));
+    }
+    std::filesystem::rename(inc.partPath, dst, ec);
+    if (ec) { std::filesystem::remove(inc.partPath, ec); return {}; }
+    return dst.string();
+}
+
+std::string FileTransfer::localName(const std::string& name, const std::string& key) {
+    // the name comes from the sender: keep only the last component
+    std::string base = std::filesystem::path(name).filename().string();
+    if (base.empty() || base == "." || base == "..") base = key;
+    return base;
+}
+
+void FileTransfer::finish(const PeerId& from, InIter it, std::unique_lock<std::mutex>& lock,
+                          const std::vector<uint8_t>& reply) {
+    const FileId id = it->first;
+    Incoming done = std::move(it->second);
+    in_.erase(it);
+    reserved_ -= done.cost;
+    diskReserved_ -= done.disk;
+    incoming_--;
+    finished_[id] = done.m.layout.units();
+    finishedOrder_.push_back(id);
+    if (finishedOrder_.size() > kFinishedMemory) {
+        finished_.erase(finishedOrder_.front());
+        finishedOrder_.pop_front();
+    }
+    std::string path = done.fd >= 0 ? finishOnDisk(done, id) : std::string();
+    auto pl = pulls_.find(id);
+    if (pl != pulls_.end()) pl->second->handover = true;
+    lock.unlock();
+    if (!reply.empty()) node_.sendMessage(from, reply);
+    if (!saveDir_.empty()) {
+        if (!path.empty() && onSaved_) onSaved_(from, done.m.name, path);
+    } else if (onFile_) {
+        onFile_(from, done.m.name, done.data);
+    }
+    // a download returns once the file has been handed over
+    lock.lock();
+    pl = pulls_.find(id);
+    if (pl == pulls_.end()) return;
+    Pull& pull = *pl->second;
+    pull.m = done.m;
+    if (done.rootsKnown == done.m.layout.pages) pull.pageRoots = std::move(done.pageRoots);
+    pull.data = std::move(done.data);
+    pull.path = path;
+    pull.done = true;
+    pull.cv.notify_one();
+}
+
+void FileTransfer::handleManifest(const PeerId& from, ByteView body) {
+    Manifest m;
+    if (!parseManifest(body, m)) return;
+    FileId id = idOf(m.root);
+    std::unique_lock<std::mutex> lock(inMtx_);
+    auto fin = finished_.find(id);
+    if (fin != finished_.end()) {
+        auto reply = buildResume(id, nullptr, fin->second);
+        lock.unlock();
+        node_.sendMessage(from, reply);
+        return;
+    }
+    auto it = in_.find(id);
+    if (it == in_.end()) {
+        it = admit(from, m, false);
+        if (it == in_.end()) return;
+    } else if (it->second.m.root != m.root || it->second.m.layout.size != m.layout.size ||
+               it->second.m.layout.chunkSize != m.layout.chunkSize) {
+        return;
+    }
+    // a resumed transfer may already be whole
+    auto reply = buildResume(id, &it->second, 0);
+    if (it->second.received == m.layout.units()) { finish(from, it, lock, reply); return; }
+    lock.unlock();
+    node_.sendMessage(from, reply);
+}
+
+void FileTransfer::handleResume(const PeerId& from, ByteView body) {
+    // body: id,n,n*(start,count)[,basisSize(u64),blockSize]
+    if (body.size() < 16+1) return;
+    size_t n = body[16];
+    size_t len = 17 + n * 8;
+    if (body.size() != len && body.size() != len + 12) return;
+    FileId id{}; std::memcpy(id.data(), body.data(), 16);
+    std::lock_guard<std::mutex> lock(outMtx_);
+    auto it = out_.find({from, id});
+    if (it == out_.end() || it->second->resumed) return;
+    Outgoing& o = *it->second;
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t start = get32(body.data() + 17 + i*8), count = get32(body.data() + 21 + i*8);
+        uint64_t end = std::min<uint64_t>(start + count, o.total);
+        if (start < end) o.held.emplace_back(static_cast<uint32_t>(start), static_cast<uint32_t>(end));
+    }
+    std::sort(o.held.begin(), o.held.end());
+    if (body.size() > len) {
+        uint64_t basisSize = (uint64_t(get32(body.data() + len)) << 32) | get32(body.data() + len + 4);
+        uint32_t blockSize = get32(body.data() + len + 8);
+        if (blockSize >= 64 && blockSize <= (1u << 20) && basisSize >= blockSize && basisSize / blockSize <= (1u << 22)) {
+            o.basisSize = basisSize;
+            o.blockSize = blockSize;
+        }
+    }
+    o.resumed = true;
+    o.resumedAt = Clock::now();
+    o.cv.notify_one();
+}
+
+FileTransfer::Accepted FileTransfer::accept(Incoming& inc, uint32_t unit, ByteView payload) {
+    const Layout& L = inc.m.layout;
+    uint32_t chunk = 0;
+    if (!Layout::isChunk(unit, chunk)) {
+        // a page: its leaf hashes plus the path up to the root
+        uint32_t p = unit / (merkle::kPageLeaves + 1);
+        uint32_t n = L.leavesIn(p);
+        unsigned plen = merkle::proofLength(L.pages);
+        if (payload.size() != (n + plen) * sizeof(merkle::Hash)) return Accepted::Invalid;
+        if (inc.leaves.size() >= kMaxOpenPages) return Accepted::NoRoom;
+        std::vector<merkle::Hash> hashes(n + plen);
+        std::memcpy(hashes.data(), payload.data(), payload.size());
+        if (!merkle::verifyPage(inc.m.root, L.pages, p, hashes.data(), n, hashes.data() + n)) return Accepted::Invalid;
+        hashes.resize(n);
+        if (inc.pageRoots.empty()) inc.pageRoots.resize(L.pages);
+        inc.pageRoots[p] = merkle::pageRoot(hashes.data(), n);
+        inc.rootsKnown++;
+        inc.leaves[p] = std::move(hashes);
+        // settle the chunks that came first; a bad one is un-acked, which only a
+        // lying sender can cause
+        for (uint32_t k = 0; k < n && !inc.early.empty(); ++k) {
+            auto e = inc.early.find(p * merkle::kPageLeaves + k);
+            if (e == inc.early.end()) continue;
+            uint32_t u = Layout::pageUnit(p) + 1 + k;
+            inc.dirtyLo = std::min(inc.dirtyLo, u / 64);
+            inc.dirtyHi = std::max(inc.dirtyHi, u / 64 + 1);
+            if (!store(inc, e->first, e->second)) {
+                inc.have[u / 64] &= ~(uint64_t(1) << (u % 64));
+                --inc.received;
+                inc.next = std::min(inc.next, u);
+            }
+            inc.earlyBytes -= e->second.size();
+            inc.early.erase(e);
+        }
+        return Accepted::Yes;
+    }
+    if (payload.size() != L.chunkLen(chunk)) return Accepted::Invalid;
+    if (!inc.leaves.count(chunk / merkle::kPageLeaves)) {
+        // hold it rather than make the sender repeat a whole page after one loss
+        if (inc.early.size() >= kMaxWindow || inc.earlyBytes + payload.size() > kMaxEarlyBytes) return Accepted::NoRoom;
+        inc.early.emplace(chunk, std::vector<uint8_t>(payload.begin(), payload.end()));
+        inc.earlyBytes += payload.size();
+        return Accepted::Yes;
+    }
+    // a write error is ours, not the sender's
+    if (merkle::leaf(payload) != inc.leaves[chunk / merkle::kPageLeaves][chunk % merkle::kPageLeaves]) return Accepted::Invalid;
+    return writeChunk(inc, chunk, payload) ? Accepted::Yes : Accepted::NoRoom;
+}
+
+bool FileTransfer::store(Incoming& inc, uint32_t chunk, ByteView payload) {
+    const auto& leaves = inc.leaves[chunk / merkle::kPageLeaves];
+    if (merkle::leaf(payload) != leaves[chunk % merkle::kPageLeaves]) return false;
+    return writeChunk(inc, chunk, payload);
+}
+
+bool FileTransfer::writeChunk(Incoming& inc, uint32_t chunk, ByteView payload) {
+    uint64_t off = uint64_t(chunk) * inc.m.layout.chunkSize;
+    if (inc.fd >= 0) return writeAt(inc.fd, off, payload.data(), payload.size());
+    std::memcpy(inc.data.data() + off, payload.data(), payload.size());
+    return true;
+}
+
+bool FileTransfer::applyCopy(Incoming& inc, uint32_t unit, ByteView body) {
+    // body: n,n*(at,basisOff(u64),len),page payload; the pieces cover whole chunks
+    const Layout& L = inc.m.layout;
+    uint32_t chunk = 0;
+    if (inc.basisFd < 0 || Layout::isChunk(unit, chunk) || body.empty()) return false;
+    size_t n = body[0];
+    if (n == 0 || n > kMaxPieces || body.size() < 1 + n * 16) return false;
+    const uint32_t p = unit / (merkle::kPageLeaves + 1), leaves = L.leavesIn(p), first = unit + 1;
+    const uint64_t start = uint64_t(p) * merkle::kPageLeaves * L.chunkSize;
+    const uint64_t len = std::min<uint64_t>(L.size - start, uint64_t(merkle::kPageLeaves) * L.chunkSize);
+    std::vector<uint8_t> bytes(len);
+    Pieces pieces(n);
+    uint64_t end = 0;
+    for (size_t i = 0; i < n; ++i) {
+        const uint8_t* q = body.data() + 1 + i * 16;
+        Piece& pc = pieces[i];
+        pc.at = get32(q);
+        pc.off = (uint64_t(get32(q + 4)) << 32) | get32(q + 8);
+        pc.len = get32(q + 12);
+        if (pc.len == 0 || pc.at < end || pc.len > len - pc.at || pc.off > inc.basisSize ||
+            pc.len > inc.basisSize - pc.off) return false;
+        end = uint64_t(pc.at) + pc.len;
+    }
+    auto covered = [&](uint32_t k) {
+        uint64_t cs = uint64_t(k) * L.chunkSize, ce = cs + L.chunkLen(p * merkle::kPageLeaves + k), sum = 0;
+        for (const Piece& pc : pieces) {
+            uint64_t lo = std::max<uint64_t>(cs, pc.at), hi = std::min<uint64_t>(ce, uint64_t(pc.at) + pc.len);
+            if (lo < hi) sum += hi - lo;
+        }
+        return sum == ce - cs;
+    };
+    // only the chunks still missing are read and checked
+    std::vector<uint32_t> fill;
+    for (uint32_t k = 0; k < leaves; ++k) if (!inc.has(first + k) && covered(k)) fill.push_back(k);
+    for (size_t i = 0; i < n && !fill.empty(); ++i) {
+        if (!readAt(inc.basisFd, pieces[i].off, bytes.data() + pieces[i].at, pieces[i].len)) return false;
+    }
+    ByteView payload = body.sub(1 + n * 16);
+    if (payload.size() < leaves * sizeof(merkle::Hash)) return false;
+    auto slice = [&](uint32_t k){
+        return ByteView(bytes.data() + uint64_t(k) * L.chunkSize, L.chunkLen(p * merkle::kPageLeaves + k));
+    };
+    // check every chunk before taking anything: the sender counts the page's
+    // ack as an ack of them. The leaves themselves are verified below
+    for (uint32_t k : fill) {
+        merkle::Hash want{};
+        if (inc.has(unit)) want = inc.leaves[p][k];
+        else std::memcpy(want.data(), payload.data() + k * want.size(), want.size());
+        if (merkle::leaf(slice(k)) != want) return false;
+    }
+    if (!inc.has(unit)) {
+        if (accept(inc, unit, payload) != Accepted::Yes) return false;
+        markHeld(inc, unit);
+    }
+    for (uint32_t k : fill) {
+        if (inc.has(first + k)) continue;
+        if (!writeChunk(inc, p * merkle::kPageLeaves + k, slice(k))) return false;
+        markHeld(inc, first + k);
+    }
+    return true;
+}
+
+void FileTransfer::markHeld(Incoming& inc, uint32_t unit) {
+    const Layout& L = inc.m.layout;
+    inc.set(unit);
+    ++inc.received;
+    inc.high = std::max(inc.high, unit + 1);
+    while (inc.next < L.units() && inc.has(inc.next)) ++inc.next;
+    inc.dirtyLo = std::min(inc.dirtyLo, unit / 64);
+    inc.dirtyHi = std::max(inc.dirtyHi, unit / 64 + 1);
+    // drop a page's hashes once all its chunks are in
+    uint32_t p = unit / (merkle::kPageLeaves + 1), first = Layout::pageUnit(p) + 1;
+    bool full = inc.has(first - 1);
+    for (uint32_t u = first; u < first + L.leavesIn(p) && full; ++u) full = inc.has(u);
+    if (full) inc.leaves.erase(p);
+    if (++inc.unsaved >= kStateFlush) saveProgress(inc);
+}
+
+void FileTransfer::handleChunk(const PeerId& from, ByteView body, bool copy) {
+    // body: id,unit,payload
+    if (body.size() < 16+4) return;
+    FileId id{}; std::memcpy(id.data(), body.data(), 16);
+    uint32_t unit = get32(body.data() + 16);
+    // units of different transfers may arrive on different shard threads
+    std::unique_lock<std::mutex> lock(inMtx_);
+    auto fin = finished_.find(id);
+    if (fin != finished_.end()) {
+        // our last ack got lost; tell the sender again that everything arrived
+        auto ack = buildAck(id, unit, fin->second, nullptr, 0);
+        lock.unlock();
+        node_.sendMessage(from, ack);
+        return;
+    }
+    auto it = in_.find(id);
+    if (it == in_.end()) return;
+    Incoming& inc = it->second;
+    const Layout& L = inc.m.layout;
+    if (unit >= L.units()) return;
+    inc.activeAt = Clock::now();
+    // a requested unit settles its request instead of being acked
+    bool requested = false;
+    uint32_t asked = UINT32_MAX; // the source it was requested from
+    auto pl = pulls_.find(id);
+    if (pl != pulls_.end()) {
+        Pull& pull = *pl->second;
+        auto r = pull.pending.find(unit);
+        if (r != pull.pending.end()) {
+            requested = true;
+            Source& src = pull.sources[r->second.source];
+            if (src.peer == from) {
+                asked = r->second.source;
+                auto now = Clock::now();
+                if (!r->second.moved) sampleRtt(src, now - r->second.sentAt);
+                src.ackedSeq = std::max(src.ackedSeq, r->second.seq);
+                src.window = std::min<double>(kMaxWindow, src.window + (src.window < src.ssthresh ? 1.0 : 1.0 / src.window));
+                src.inflight--;
+                pull.pending.erase(r);
+                pull.progressAt = now;
+                // rescheduling every few answers also catches overtaken requests early
+                if (++pull.arrived >= kPullWake || src.inflight <= src.window / 2) { pull.wake = true; pull.cv.notify_one(); }
+            }
+        }
+    }
+    bool fresh = !copy && !inc.has(unit);
+    if (copy) {
+        // unacked on failure, so the sender falls back to plain data
+        if (!applyCopy(inc, unit, body.sub(20))) return;
+    } else if (fresh) {
+        Accepted a = accept(inc, unit, body.sub(20));
+        if (a == Accepted::Invalid && asked != UINT32_MAX) {
+            // a holder that answers with something the root does not vouch
+            // for is not asked again; if it was the last one with this
+            // layout, the layout itself was probably the lie
+            Pull& pull = *pl->second;
+            Source& src = pull.sources[asked];
+            if (src.counted) countSource(pull, src, -1);
+            src.counted = false;
+            src.bad = true;
+            bool left = std::any_of(pull.sources.begin(), pull.sources.end(), [](const Source& s){ return s.counted; });
+            if (!left && !inc.verified()) switchLayout(pull, it, Clock::now());
+            pull.wake = true;
+            pull.cv.notify_one();
+        }
+        if (a != Accepted::Yes) return;
+        markHeld(inc, unit);
+    }
+    // every other unit arriving in order waits to share the next one's ack;
+    // anything else is acked at once, duplicates too: they usually mean the
+    // sender missed our ack
+    std::vector<uint8_t> ack;
+    bool hold = false;
+    if (!requested) {
+        hold = fresh && !inc.ackHeld && inc.next == inc.high && inc.received < L.units();
+        if (hold) {
+            inc.ackHeld = true;
+            inc.ackEcho = unit;
+            inc.ackTo = from;
+        } else {
+            inc.ackHeld = false;
+            ack = buildAck(id, unit, inc.next, &inc.have, inc.high);
+        }
+    }
+    if (inc.received == L.units()) { finish(from, it, lock, ack); return; }
+    lock.unlock();
+    if (!ack.empty()) node_.sendMessage(from, ack);
+    if (hold) {
+        node_.eventLoop().addTimer(kAckDelay, [g = guard_, id]{
+            std::shared_lock<std::shared_mutex> gl(g->mtx);
+            if (g->self) g->self->flushAck(id);
+        });
+    }
 }
 
-FileTransfer::FileId FileTransfer::randomId() {
-    FileId id{}; randombytes_buf(id.data(), id.size()); return id;
+void FileTransfer::flushAck(const FileId& id) {
+    std::unique_lock<std::mutex> lock(inMtx_);
+    auto it = in_.find(id);
+    if (it == in_.end() || !it->second.ackHeld) return;
+    Incoming& inc = it->second;
+    inc.ackHeld = false;
+    auto ack = buildAck(id, inc.ackEcho, inc.next, &inc.have, inc.high);
+    PeerId to = inc.ackTo;
+    lock.unlock();
+    node_.sendMessage(to, ack);
+}
+
+template <typename T>
+void FileTransfer::sampleRtt(T& o, Clock::duration r) {
+    // RFC 6298
+    if (!o.haveRtt) {
+        o.srtt = r; o.rttvar = r / 2; o.haveRtt = true;
+    } else {
+        Clock::duration err = o.srtt > r ? o.srtt - r : r - o.srtt;
+        o.rttvar = (3 * o.rttvar + err) / 4;
+        o.srtt = (7 * o.srtt + r) / 8;
+    }
+    Clock::duration rto = o.srtt + std::max<Clock::duration>(std::chrono::milliseconds(1), 4 * o.rttvar);
+    o.rto = std::clamp<Clock::duration>(rto, kMinRto, kMaxRto);
+}
+
+bool FileTransfer::onTimeout(Outgoing& o, Clock::time_point now, Clock::time_point& deadline) {
+    const size_t cap = o.ring.size();
+    Clock::time_point oldest = Clock::time_point::max();
+    Slot* newest = nullptr;
+    for (uint32_t i = o.base; i < o.next; ++i) {
+        Slot& s = o.ring[i % cap];
+        if (s.acked || s.lost || s.deferred) continue;
+        oldest = std::min(oldest, s.sentAt);
+        if (!newest || s.seq > newest->seq) newest = &s;
+    }
+    if (!newest) { deadline = now + o.rto; return true; }
+    // tail loss probe: after two quiet RTTs send one unit past the window (a
+    // new one, else the newest outstanding again) so its ack exposes the holes
+    // instead of waiting out the much longer RTO
+    if (o.haveRtt && !o.probed) {
+        Clock::time_point pto = newest->sentAt + std::max<Clock::duration>(2 * o.srtt, std::chrono::milliseconds(1));
+        if (pto < oldest + o.rto) {
+            if (pto > now) { deadline = pto; return true; }
+            o.probed = true;
+            o.probe = true;
+            if (o.next >= o.total || o.next - o.base >= cap) { newest->lost = true; --o.inflight; }
+            deadline = now;
+            return true;
+        }
+    }
+    if (oldest + o.rto > now) { deadline = oldest + o.rto; return true; }
+    // nothing came back for a whole RTO: back off and resend everything outstanding from a window of one
+    if (++o.backoffs > kMaxBackoffs) return false;
+    o.rto = std::min<Clock::duration>(o.rto * 2, kMaxRto);
+    o.ssthresh = std::max(o.inflight / 2.0, 2.0);
+    o.cwnd = 1;
+    for (uint32_t i = o.base; i < o.next; ++i) {
+        Slot& s = o.ring[i % cap];
+        if (!s.acked) s.lost = true;
+    }
+    o.inflight = 0;
+    o.recover = o.next;
+    deadline = now;
+    return true;
+}
+
+void FileTransfer::handleAck(const PeerId& from, ByteView body) {
+    // body: id,echo,cum,n,bitmap[n]; bit j of the bitmap is unit cum+j
+    if (body.size() < 16+4+4+1) return;
+    size_t n = body[24];
+    if (n > kSackBytes || body.size() != 25 + n) return;
+    FileId id{}; std::memcpy(id.data(), body.data(), 16);
+    uint32_t echo = get32(body.data() + 16), cum = get32(body.data() + 20);
+
+    std::lock_guard<std::mutex> lock(outMtx_);
+    auto it = out_.find({from, id});
+    if (it == out_.end()) return;
+    Outgoing& o = *it->second;
+    const size_t cap = o.ring.size();
+    auto now = Clock::now();
+    uint32_t newly = 0;
+    auto ackOne = [&](uint64_t i) {
+        if (i < o.base || i >= o.next) return;
+        Slot& s = o.ring[i % cap];
+        if (s.acked) return;
+        if (!s.lost && s.tx) --o.inflight;
+        // Karn: only a unit sent exactly once gives an unambiguous sample
+        if (i == echo && s.tx == 1) sampleRtt(o, now - s.sentAt);
+        s.acked = true;
+        s.lost = false;
+        o.ackedSeq = std::max(o.ackedSeq, s.seq);
+        ++newly;
+        // a copied page was only acked once its chunks were rebuilt
+        uint32_t c = 0, p = static_cast<uint32_t>(i / (merkle::kPageLeaves + 1));
+        if (o.copy.empty() || Layout::isChunk(static_cast<uint32_t>(i), c) || o.copy[p] != Copy::Sent) return;
+        o.copy[p] = Copy::Done;
+        for (uint64_t u = i + 1; u < std::min<uint64_t>(i + 1 + merkle::kPageLeaves, o.next); ++u) {
+            Slot& d = o.ring[u % cap];
+            if (d.acked || !(o.copied[p] >> (u - i - 1) & 1)) continue;
+            if (!d.lost && d.tx) --o.inflight;
+            d.acked = true;
+            d.lost = d.deferred = false;
+        }
+    };
+    for (uint32_t i = o.base; i < std::min(cum, o.next); ++i) ackOne(i);
+    for (size_t b = 0; b < n * 8; ++b) {
+        if (body[25 + b / 8] >> (b % 8) & 1) ackOne(uint64_t(cum) + b);
+    }
+    advance(o);
+
+    if (newly) {
+        o.backoffs = 0;
+        o.probed = false;
+        // slow start below ssthresh, then one unit per window
+        for (uint32_t k = 0; k < newly; ++k) o.cwnd += o.cwnd < o.ssthresh ? 1.0 : 1.0 / o.cwnd;
+        o.cwnd = std::min<double>(o.cwnd, kMaxWindow);
+    }
+    detectLosses(o, now);
+    o.cv.notify_one();
+}
+
+FileTransfer::Clock::time_point FileTransfer::detectLosses(Outgoing& o, Clock::time_point now) {
+    // RACK-style: a unit is lost once kReorderThresh later transmissions have
+    // arrived, or once any later one has and it is a quarter RTT overdue; the
+    // window halves once per round of losses
+    const size_t cap = o.ring.size();
+    Clock::duration wait = o.haveRtt ? o.srtt + o.srtt / 4 : Clock::duration(kMinRto);
+    Clock::time_point retry = Clock::time_point::max();
+    for (uint32_t i = o.base; i < o.next; ++i) {
+        Slot& s = o.ring[i % cap];
+        if (s.acked || s.lost || s.deferred || s.seq >= o.ackedSeq) continue;
+        if (s.seq + kReorderThresh > o.ackedSeq && s.sentAt + wait > now) {
+            retry = std::min(retry, s.sentAt + wait);
+            continue;
+        }
+        s.lost = true;
+        --o.inflight;
+        if (i >= o.recover) {
+            o.ssthresh = std::max(o.cwnd / 2, 2.0);
+            o.cwnd = o.ssthresh;
+            o.recover = o.next;
+        }
+    }
+    return retry;
+}
+
+void FileTransfer::advance(Outgoing& o) {
+    const size_t cap = o.ring.size();
+    while (o.base < o.next && o.ring[o.base % cap].acked) { o.ring[o.base % cap] = Slot{}; ++o.base; }
+}
+
+FileTransfer::FileId FileTransfer::idOf(const merkle::Hash& root) {
+    FileId id{}; std::memcpy(id.data(), root.data(), id.size()); return id;
 }
 
 std::string FileTransfer::toHex16(const FileId& id) { return toHex(id.data(), id.size()); }
 
-std::vector<uint8_t> FileTransfer::buildChunk(const FileId& id, uint32_t index, uint32_t total,
-                                              const std::string& name, const std::vector<uint8_t>& data) {
-    // msg: type,id,i,total,nameLen,name,dataLen,data,hash
+std::vector<uint8_t> FileTransfer::buildManifest(const Manifest& m) {
+    // msg: type,root,size(u64),chunkSize,nameLen,name
     std::vector<uint8_t> msg;
-    msg.reserve(1+16+4+4+1+name.size()+2+data.size()+32);
-    msg.push_back(0xF1);
-    msg.insert(msg.end(), id.begin(), id.end());
-    auto put32 = [&](uint32_t v){ msg.push_back((v>>24)&0xFF); msg.push_back((v>>16)&0xFF); msg.push_back((v>>8)&0xFF); msg.push_back(v&0xFF); };
-    put32(index); put32(total);
-    uint8_t nl = static_cast<uint8_t>(std::min<size_t>(255, name.size()));
+    uint8_t nl = static_cast<uint8_t>(std::min<size_t>(255, m.name.size()));
+    msg.reserve(1+32+8+4+1+nl);
+    msg.push_back(static_cast<uint8_t>(MessageType::FILE_MANIFEST));
+    msg.insert(msg.end(), m.root.begin(), m.root.end());
+    put32(msg, static_cast<uint32_t>(m.layout.size >> 32)); put32(msg, static_cast<uint32_t>(m.layout.size));
+    put32(msg, m.layout.chunkSize);
     msg.push_back(nl);
-    msg.insert(msg.end(), name.begin(), name.begin()+nl);
-    uint16_t dl = static_cast<uint16_t>(std::min<size_t>(65535, data.size()));
-    msg.push_back((dl>>8)&0xFF); msg.push_back(dl&0xFF);
-    msg.insert(msg.end(), data.begin(), data.begin()+dl);
-    std::vector<uint8_t> h(32);
-    crypto_generichash(h.data(), h.size(), data.data(), dl, nullptr, 0);
-    msg.insert(msg.end(), h.begin(), h.end());
+    msg.insert(msg.end(), m.name.begin(), m.name.begin()+nl);
     return msg;
 }
 
-bool FileTransfer::parseChunk(const std::vector<uint8_t>& msg, FileId& id, uint32_t& index, uint32_t& total,
-                              std::string& name, std::vector<uint8_t>& data) {
-    if (msg.size() < 1+16+4+4+1+2+32) return false;
-    size_t off = 0;
-    if (msg[off++] != 0xF1) return false;
-    std::memcpy(id.data(), msg.data()+off, 16); off += 16;
-    auto get32 = [&](uint32_t& v){ if (off+4>msg.size()) return false; v = (msg[off]<<24)|(msg[off+1]<<16)|(msg[off+2]<<8)|msg[off+3]; off+=4; return true; };
-    if (!get32(index) || !get32(total)) return false;
-    if (off>=msg.size()) return false; uint8_t nl = msg[off++];
-    if (off+nl+2>msg.size()) return false; name.assign((const char*)msg.data()+off, (size_t)nl); off += nl;
-    uint16_t dl = (msg[off]<<8)|msg[off+1]; off+=2;
-    if (off+dl+32>msg.size()) return false;
-    const uint8_t* dptr = msg.data()+off; off += dl;
-    const uint8_t* hptr = msg.data()+off; off += 32;
-    std::vector<uint8_t> h(32);
-    crypto_generichash(h.data(), h.size(), dptr, dl, nullptr, 0);
-    if (std::memcmp(h.data(), hptr, 32) != 0) return false;
-    data.assign(dptr, dptr+dl);
-    return true;
+bool FileTransfer::parseManifest(ByteView body, Manifest& m) {
+    if (body.size() < 32+8+4+1) return false;
+    std::memcpy(m.root.data(), body.data(), 32);
+    uint64_t size = (uint64_t(get32(body.data()+32)) << 32) | get32(body.data()+36);
+    uint32_t chunkSize = get32(body.data()+40);
+    size_t nl = body[44];
+    if (body.size() != 45 + nl || chunkSize > 65535) return false;
+    m.name.assign(reinterpret_cast<const char*>(body.data()+45), nl);
+    return Layout::make(size, chunkSize, m.layout);
 }
 
-bool FileTransfer::sendBuffer(const PeerId& dest, const std::string& name, const std::vector<uint8_t>& data, size_t chunkSize) {
-    if (chunkSize == 0) chunkSize = 1024;
-    FileId id = randomId();
-    uint32_t total = static_cast<uint32_t>((data.size() + chunkSize - 1) / chunkSize);
-    for (uint32_t i = 0; i < total; ++i) {
-        size_t start = i * chunkSize;
-        size_t end = std::min(start + chunkSize, data.size());
-        std::vector<uint8_t> chunk(data.begin()+start, data.begin()+end);
-        auto body = buildChunk(id, i, total, name, chunk);
-        // body already has type
-        if (!node_.sendMessage(dest, body)) return false;
+std::vector<uint8_t> FileTransfer::buildResume(const FileId& id, const Incoming* inc, uint32_t units) {
+    // msg: type,id,n,n*(start,count) units already held; everything when inc is null
+    std::vector<uint8_t> msg;
+    msg.push_back(static_cast<uint8_t>(MessageType::FILE_RESUME));
+    msg.insert(msg.end(), id.begin(), id.end());
+    msg.push_back(0);
+    uint8_t n = 0;
+    auto add = [&](uint32_t start, uint32_t end){ put32(msg, start); put32(msg, end - start); ++n; };
+    if (!inc) {
+        add(0, units);
+    } else {
+        uint32_t total = inc->m.layout.units();
+        for (uint32_t u = 0; u < total && n < kMaxRanges; ) {
+            if (!inc->has(u)) { ++u; continue; }
+            uint32_t start = u;
+            while (u < total && inc->has(u)) ++u;
+            add(start, u);
+        }
     }
-    return true;
+    msg[17] = n;
+    if (inc && inc->basisFd >= 0) {
+        put32(msg, static_cast<uint32_t>(inc->basisSize >> 32)); put32(msg, static_cast<uint32_t>(inc->basisSize));
+        put32(msg, inc->blockSize);
+    }
+    return msg;
+}
+
+std::vector<uint8_t> FileTransfer::buildChunk(const FileId& id, uint32_t unit, ByteView payload) {
+    // msg: type,id,unit,payload
+    std::vector<uint8_t> msg;
+    msg.reserve(1+16+4+payload.size());
+    msg.push_back(static_cast<uint8_t>(MessageType::FILE_CHUNK));
+    msg.insert(msg.end(), id.begin(), id.end());
+    put32(msg, unit);
+    msg.insert(msg.end(), payload.begin(), payload.end());
+    return msg;
+}
+
+std::vector<uint8_t> FileTransfer::buildCopy(const FileId& id, uint32_t unit, const Pieces& pieces, ByteView page) {
+    // msg: type,id,unit,n,n*(at,basisOff(u64),len),page payload
+    std::vector<uint8_t> msg;
+    msg.reserve(1+16+4+1+pieces.size()*16+page.size());
+    msg.push_back(static_cast<uint8_t>(MessageType::FILE_COPY));
+    msg.insert(msg.end(), id.begin(), id.end());
+    put32(msg, unit);
+    msg.push_back(static_cast<uint8_t>(pieces.size()));
+    for (const Piece& pc : pieces) {
+        put32(msg, pc.at);
+        put32(msg, static_cast<uint32_t>(pc.off >> 32)); put32(msg, static_cast<uint32_t>(pc.off));
+        put32(msg, pc.len);
+    }
+    msg.insert(msg.end(), page.begin(), page.end());
+    return msg;
+}
+
+std::vector<uint8_t> FileTransfer::buildAck(const FileId& id, uint32_t echo, uint32_t cum,
+                                            const std::vector<uint64_t>* have, uint32_t high) {
+    std::vector<uint8_t> msg;
+    msg.reserve(1+16+4+4+1+kSackBytes);
+    msg.push_back(static_cast<uint8_t>(MessageType::FILE_ACK));
+    msg.insert(msg.end(), id.begin(), id.end());
+    put32(msg, echo); put32(msg, cum);
+    size_t span = (have && high > cum) ? std::min<size_t>(high - cum, kSackBytes * 8) : 0;
+    size_t n = (span + 7) / 8;
+    msg.push_back(static_cast<uint8_t>(n));
+    size_t at = msg.size();
+    msg.resize(at + n, 0);
+    for (size_t b = 0; b < span; ++b) {
+        uint64_t i = uint64_t(cum) + b;
+        if ((*have)[i / 64] >> (i % 64) & 1) msg[at + b / 8] |= uint8_t(1u << (b % 8));
+    }
+    return msg;
+}
+
+bool FileTransfer::sendBuffer(const PeerId& dest, const std::string& name, const std::vector<uint8_t>& data, size_t chunkSize) {
+    return sendChunks(dest, name, data.size(), chunkSize, [&](uint64_t off, size_t len) -> std::optional<ByteView> {
+        return ByteView(data.data() + off, len);
+    });
 }
 
 bool FileTransfer::sendFile(const PeerId& dest, const std::string& path, size_t chunkSize) {
-    std::ifstream in(path, std::ios::binary);
-    if (!in) return false;
-    std::vector<uint8_t> buf((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
     std::string name = std::filesystem::path(path).filename().string();
-    return sendBuffer(dest, name, buf, chunkSize);
+    std::error_code ec;
+    uint64_t size = std::filesystem::file_size(path, ec);
+    if (ec) return false;
+    int fd = openRead(path);
+    if (fd < 0) return false;
+    // positional reads into one bounded window rather than a mapping: a file
+    // that shrinks under us fails a read and ends the transfer, where touching
+    // a mapping past its new end would raise SIGBUS
+    std::vector<uint8_t> window;
+    uint64_t winOff = 0;
+    size_t winLen = 0;
+    bool ok = sendChunks(dest, name, size, chunkSize, [&](uint64_t off, size_t len) -> std::optional<ByteView> {
+        if (off < winOff || off + len > winOff + winLen) {
+            if (off + len > size) return std::nullopt;
+            size_t n = static_cast<size_t>(std::max<uint64_t>(len, std::min<uint64_t>(kReadWindow, size - off)));
+            window.resize(n);
+            winLen = 0;
+            if (!readAt(fd, off, window.data(), n)) return std::nullopt;
+            winOff = off;
+            winLen = n;
+        }
+        return ByteView(window.data() + (off - winOff), len);
+    });
+    closeFile(fd);
+    return ok;
+}
+
+void FileTransfer::sentOut(const PeerId& dest, const FileId& id, uint32_t unit, uint8_t tx) {
+    auto now = Clock::now();
+    std::lock_guard<std::mutex> lock(outMtx_);
+    auto it = out_.find({dest, id});
+    if (it == out_.end()) return;
+    Outgoing& o = *it->second;
+    // acked meanwhile, or already sent again
+    if (unit < o.base || unit >= o.next) return;
+    Slot& s = o.ring[unit % o.ring.size()];
+    if (s.tx == tx && !s.acked) s.sentAt = now;
+}
+
+bool FileTransfer::sendChunks(const PeerId& dest, const std::string& name, uint64_t size, size_t chunkSize,
+                              const ChunkSource& read) {
+    if (size == 0) return true;
+    if (node_.onNodeThread()) return false;
+    // an automatic chunk size fits what the path is known to carry now; the
+    // probe started here lets a later transfer use larger ones
+    node_.probePath(dest);
+    if (chunkSize == 0) chunkSize = chunkFor(node_.pathMtu(dest));
+    chunkSize = std::min<size_t>(chunkSize, 65535);
+    Manifest m;
+    m.name = name;
+    if (!Layout::make(size, static_cast<uint32_t>(chunkSize), m.layout)) return false;
+    const Layout& L = m.layout;
+
+    // one hashing pass for the root; only the page roots are kept, a page's
+    // leaves are recomputed when it is sent
+    std::optional<merkle::PageTree> built = buildTree(L, read);
+    if (!built) return false;
+    merkle::PageTree tree = std::move(*built);
+    m.root = tree.root();
+    const FileId id = idOf(m.root);
+
+    Outgoing o;
+    o.peer = dest;
+    o.total = L.units();
+    o.ring.resize(std::min(o.total, kMaxWindow));
+    const size_t cap = o.ring.size();
+    std::unique_lock<std::mutex> lock(outMtx_);
+    if (!out_.emplace(std::make_pair(dest, id), &o).second) return false; // already sending it there
+
+    // the manifest goes first, repeated until the receiver says what it has
+    bool ok = true;
+    auto manifest = buildManifest(m);
+    for (unsigned tries = 0; !o.resumed; ++tries) {
+        if (tries > kMaxBackoffs) { ok = false; stalled_++; break; }
+        auto sentAt = Clock::now();
+        lock.unlock();
+        // a full send queue is only a delay; the manifest is repeated anyway
+        SendResult r = node_.send(dest, manifest);
+        ok = r == SendResult::Sent || r == SendResult::QueueFull;
+        lock.lock();
+        if (!ok) break;
+        o.cv.wait_until(lock, sentAt + o.rto, [&]{ return o.resumed; });
+        if (!o.resumed) o.rto = std::min<Clock::duration>(o.rto * 2, kMaxRto);
+        else if (tries == 0) sampleRtt(o, o.resumedAt - sentAt);
+    }
+    // the receiver is replacing an older copy: chunks lying entirely in its
+    // blocks go out as references to them, one list per page
+    std::vector<delta::Ref> refs;
+    Pieces pieces;
+    if (ok && o.blockSize) {
+        auto sigs = fetchSignatures(o, id, lock);
+        if (!sigs.empty()) {
+            lock.unlock();
+            refs = delta::match(sigs, o.blockSize, size, read);
+            lock.lock();
+        }
+        if (!refs.empty()) {
+            o.copy.assign(L.pages, Copy::Plain);
+            o.copied.assign(L.pages, 0);
+            for (uint32_t p = 0; p < L.pages; ++p) {
+                o.copied[p] = copyPieces(L, refs, o.blockSize, p, pieces);
+                if (o.copied[p]) o.copy[p] = Copy::Ready;
+            }
+        }
+    }
+
+    std::vector<uint32_t> picks;
+    std::vector<bool> copies; // per pick: send the page as a copy
+    std::vector<uint8_t> txs; // per pick: its transmission
+    std::vector<uint8_t> page;
+    auto held = [&](uint32_t u) {
+        while (o.heldAt < o.held.size() && o.held[o.heldAt].second <= u) ++o.heldAt;
+        return o.heldAt < o.held.size() && o.held[o.heldAt].first <= u;
+    };
+    while (ok && o.base < o.total) {
+        auto now = Clock::now();
+        Clock::time_point deadline;
+        if (!onTimeout(o, now, deadline)) { ok = false; stalled_++; break; }
+        deadline = std::min(deadline, detectLosses(o, now));
+        // retransmissions first, then new units, as far as the window allows
+        picks.clear();
+        copies.clear();
+        uint32_t win = static_cast<uint32_t>(o.cwnd);
+        size_t room = win > o.inflight ? win - o.inflight : 0;
+        if (o.probe) { room++; o.probe = false; }
+        for (uint32_t i = o.base; i < o.next && picks.size() < room; ++i) {
+            if (!o.ring[i % cap].lost) continue;
+            uint32_t c = 0, p = i / (merkle::kPageLeaves + 1);
+            bool again = !o.copy.empty() && !Layout::isChunk(i, c) && o.copy[p] == Copy::Sent;
+            // a copy is slower to take than a chunk and often only looks lost
+            if (again && o.ring[i % cap].tx >= kCopyTries) {
+                // it really could not be rebuilt: resend the page plainly and its chunks as data
+                again = false;
+                o.copy[p] = Copy::Plain;
+                for (uint32_t u = i + 1; u < std::min(i + 1 + L.leavesIn(p), o.next); ++u) {
+                    Slot& d = o.ring[u % cap];
+                    if (d.deferred) { d.deferred = false; d.lost = true; }
+                }
+            }
+            picks.push_back(i);
+            copies.push_back(again);
+        }
+        while (picks.size() < room && o.next < o.total && o.next - o.base < cap) {
+            // what the receiver kept from an earlier attempt counts as acknowledged
+            if (held(o.next)) { o.ring[o.next++ % cap].acked = true; advance(o); continue; }
+            uint32_t c = 0, p = o.next / (merkle::kPageLeaves + 1);
+            Copy st = o.copy.empty() ? Copy::Plain : o.copy[p];
+            if (!Layout::isChunk(o.next, c)) {
+                if (st == Copy::Ready) {
+                    o.copy[p] = Copy::Sent;
+                    picks.push_back(o.next++);
+                    copies.push_back(true);
+                    continue;
+                }
+            } else if (o.copied.size() > p && o.copied[p] >> (c % merkle::kPageLeaves) & 1) {
+                // rebuilt by the copy: held back until it is acked or given up
+                if (st == Copy::Sent) { o.ring[o.next++ % cap].deferred = true; continue; }
+                if (st == Copy::Done) { o.ring[o.next++ % cap].acked = true; advance(o); continue; }
+            }
+            picks.push_back(o.next++);
+            copies.push_back(false);
+        }
+        if (picks.empty()) {
+            if (o.base < o.total) o.cv.wait_until(lock, deadline);
+            continue;
+        }
+        txs.clear();
+        for (uint32_t i : picks) {
+            Slot& s = o.ring[i % cap];
+            s.lost = false;
+            s.deferred = false;
+            s.tx++;
+            s.sentAt = now; // until it leaves the send queue
+            s.seq = ++o.seq;
+            o.inflight++;
+            txs.push_back(s.tx);
+        }
+
+        lock.unlock();
+        // chunks queue as bulk, behind interactive traffic
+        size_t sent = picks.size();
+        bool readOk = true;
+        for (size_t j = 0; j < picks.size(); ++j) {
+            uint32_t unit = picks[j], chunk = 0;
+            std::vector<uint8_t> msg;
+            if (Layout::isChunk(unit, chunk)) {
+                auto data = read(uint64_t(chunk) * L.chunkSize, L.chunkLen(chunk));
+                if (!data) { readOk = false; sent = j; break; }
+                msg = buildChunk(id, unit, *data);
+            } else {
+                uint32_t p = unit / (merkle::kPageLeaves + 1);
+                if (!pagePayload(L, tree, p, read, page)) { readOk = false; sent = j; break; }
+                if (copies[j] && copyPieces(L, refs, o.blockSize, p, pieces)) msg = buildCopy(id, unit, pieces, page);
+                else msg = buildChunk(id, unit, page);
+            }
+            auto left = [g = guard_, dest, id, unit, tx = txs[j]](SendResult r) {
+                if (r != SendResult::Sent) return;
+                std::shared_lock<std::shared_mutex> gl(g->mtx);
+                if (g->self) g->self->sentOut(dest, id, unit, tx);
+            };
+            if (!node_.sendAsync(dest, std::move(msg), left, SendClass::Bulk)) { sent = j; break; }
+        }
+        lock.lock();
+        if (!readOk) { ok = false; break; } // the file went away or shrank under us
+        if (sent < picks.size()) {
+            // the send queue is full: the rest never left, so it is neither in
+            // flight nor a transmission; it goes again once the queue drains
+            for (size_t j = sent; j < picks.size(); ++j) {
+                Slot& s = o.ring[picks[j] % cap];
+                if (s.acked || s.lost) continue;
+                s.lost = true;
+                s.tx--;
+                o.inflight--;
+            }
+            o.cv.wait_for(lock, kQueueWait);
+        }
+    }
+    out_.erase({dest, id});
+    return ok;
+}
+
+std::vector<delta::Sig> FileTransfer::fetchSignatures(Outgoing& o, const FileId& id, std::unique_lock<std::mutex>& lock) {
+    const uint32_t blocks = static_cast<uint32_t>(o.basisSize / o.blockSize);
+    const uint32_t batches = (blocks + kSigBatch - 1) / kSigBatch;
+    o.sigs.assign(blocks, delta::Sig{});
+    o.sigGot.assign(batches, false);
+    o.sigsLeft = batches;
+    std::vector<Clock::time_point> askedAt(batches);
+    std::vector<uint8_t> tries(batches, 0);
+    std::vector<std::vector<uint8_t>> reqs;
+    // answers include the time to read and hash the blocks, so they get
+    // their own timer rather than the transfer's
+    struct {
+        bool haveRtt{false};
+        Clock::duration srtt{}, rttvar{}, rto{};
+    } timer;
+    timer.rto = o.rto;
+    unsigned timeouts = 0;
+    bool ok = true;
+    uint32_t seen = 0; // batches below are answered and timed
+    while (ok && o.sigsLeft) {
+        auto now = Clock::now();
+        for (uint32_t b = seen; b < batches && tries[b]; ++b) {
+            if (!o.sigGot[b]) continue;
+            if (tries[b] == 1) sampleRtt(timer, now - askedAt[b]);
+            tries[b] = 0xFF;
+        }
+        while (seen < batches && tries[seen] == 0xFF) ++seen;
+        // backs off only while nothing at all comes back
+        Clock::duration rto = std::min<Clock::duration>(timer.rto * (1u << timeouts), kMaxRto);
+        Clock::time_point deadline = now + rto;
+        size_t outstanding = 0;
+        bool expired = false;
+        reqs.clear();
+        for (uint32_t b = 0; b < batches && outstanding < kSigWindow; ++b) {
+            if (o.sigGot[b]) continue;
+            ++outstanding;
+            if (askedAt[b] != Clock::time_point{} && askedAt[b] + rto > now) {
+                deadline = std::min(deadline, askedAt[b] + rto);
+                continue;
+            }
+            expired |= askedAt[b] != Clock::time_point{};
+            askedAt[b] = now;
+            tries[b] = static_cast<uint8_t>(std::min(tries[b] + 1, 2));
+            // msg: type,id,first,count
+            std::vector<uint8_t> msg;
+            msg.push_back(static_cast<uint8_t>(MessageType::FILE_SIGREQ));
+            msg.insert(msg.end(), id.begin(), id.end());
+            put32(msg, b * kSigBatch);
+            msg.push_back(static_cast<uint8_t>(std::min(kSigBatch, blocks - b * kSigBatch)));
+            reqs.push_back(std::move(msg));
+        }
+        // a receiver that stops answering only costs the saving
+        if (expired && ++timeouts > kSigRetries) break;
+        uint32_t left = o.sigsLeft;
+        lock.unlock();
+        ok = node_.sendMessages(o.peer, reqs);
+        lock.lock();
+        o.cv.wait_until(lock, deadline, [&]{ return o.sigsLeft < left; });
+        if (o.sigsLeft < left) timeouts = 0;
+    }
+    std::vector<delta::Sig> sigs;
+    if (ok && !o.sigsLeft) sigs = std::move(o.sigs);
+    o.sigs.clear();
+    o.sigGot.clear();
+    return sigs;
+}
+
+uint16_t FileTransfer::copyPieces(const Layout& L, const std::vector<delta::Ref>& refs, uint32_t blockSize,
+                                  uint32_t p, Pieces& out) {
+    out.clear();
+    const uint64_t start = uint64_t(p) * merkle::kPageLeaves * L.chunkSize;
+    uint16_t mask = 0;
+    // the first block reaching past the page start
+    auto r = std::upper_bound(refs.begin(), refs.end(), start, [&](uint64_t v, const delta::Ref& x){
+        return v < x.at + blockSize;
+    });
+    Pieces run;
+    for (uint32_t k = 0; k < L.leavesIn(p); ++k) {
+        uint64_t at = start + uint64_t(k) * L.chunkSize;
+        const uint64_t end = at + L.chunkLen(p * merkle::kPageLeaves + k);
+        while (r != refs.end() && r->at + blockSize <= at) ++r;
+        // a chunk is copied when back-to-back blocks cover all of it
+        run = out;
+        for (auto q = r; at < end && q != refs.end() && q->at <= at; ++q) {
+            Piece pc{static_cast<uint32_t>(at - start), uint64_t(q->block) * blockSize + (at - q->at),
+                     static_cast<uint32_t>(std::min<uint64_t>(end, q->at + blockSize) - at)};
+            const Piece* b = run.empty() ? nullptr : &run.back();
+            if (b && b->at + b->len == pc.at && b->off + b->len == pc.off) run.back().len += pc.len;
+            else run.push_back(pc);
+            at += pc.len;
+        }
+        if (at < end || run.size() > kMaxPieces) continue;
+        out.swap(run);
+        mask |= uint16_t(1u << k);
+    }
+    return mask;
+}
+
+void FileTransfer::handleSigRequest(const PeerId& from, ByteView body) {
+    // body: id,first,count
+    if (body.size() != 16+4+1) return;
+    FileId id{}; std::memcpy(id.data(), body.data(), 16);
+    uint32_t first = get32(body.data() + 16), count = body[20];
+    int fd = -1;
+    uint32_t blockSize = 0;
+    {
+        // up to a batch of blocks is read and hashed without holding up other transfers
+        std::lock_guard<std::mutex> lock(inMtx_);
+        auto it = in_.find(id);
+        if (it == in_.end()) return;
+        const Incoming& inc = it->second;
+        if (inc.basisFd < 0 || count == 0 || count > kSigBatch) return;
+        uint64_t blocks = inc.basisSize / inc.blockSize;
+        if (uint64_t(first) + count > blocks) return;
+        fd = dupFile(inc.basisFd);
+        blockSize = inc.blockSize;
+    }
+    if (fd < 0) return;
+    std::vector<uint8_t> data(size_t(count) * blockSize);
+    bool ok = readAt(fd, uint64_t(first) * blockSize, data.data(), data.size());
+    closeFile(fd);
+    if (!ok) return;
+    // msg: type,id,first,count,count*(weak,strong)
+    std::vector<uint8_t> reply;
+    reply.reserve(1+16+4+1+count*(4+sizeof(delta::Strong)));
+    reply.push_back(static_cast<uint8_t>(MessageType::FILE_SIGS));
+    reply.insert(reply.end(), body.begin(), body.end());
+    for (uint32_t k = 0; k < count; ++k) {
+        auto sig = delta::sign(data.data() + size_t(k) * blockSize, blockSize);
+        put32(reply, sig.weak);
+        reply.insert(reply.end(), sig.strong.begin(), sig.strong.end());
+    }
+    node_.sendMessage(from, reply);
+}
+
+void FileTransfer::handleSigs(const PeerId& from, ByteView body) {
+    // body: id,first,count,count*(weak,strong)
+    constexpr size_t kSig = 4 + sizeof(delta::Strong);
+    if (body.size() < 16+4+1) return;
+    FileId id{}; std::memcpy(id.data(), body.data(), 16);
+    uint32_t first = get32(body.data() + 16), count = body[20];
+    if (body.size() != 21 + count * kSig) return;
+    std::lock_guard<std::mutex> lock(outMtx_);
+    auto it = out_.find({from, id});
+    if (it == out_.end()) return;
+    Outgoing& o = *it->second;
+    uint32_t b = first / kSigBatch;
+    if (first % kSigBatch || b >= o.sigGot.size() || o.sigGot[b] ||
+        count != std::min<uint64_t>(kSigBatch, o.sigs.size() - first)) return;
+    for (uint32_t k = 0; k < count; ++k) {
+        const uint8_t* q = body.data() + 21 + k * kSig;
+        o.sigs[first + k].weak = get32(q);
+        std::memcpy(o.sigs[first + k].strong.data(), q + 4, sizeof(delta::Strong));
+    }
+    o.sigGot[b] = true;
+    o.sigsLeft--;
+    o.cv.notify_one();
+}
+
+std::optional<merkle::PageTree> FileTransfer::buildTree(const Layout& L, const ChunkSource& read) {
+    std::vector<merkle::Hash> leaves(merkle::kPageLeaves);
+    std::vector<merkle::Hash> pageRoots(L.pages);
+    for (uint32_t p = 0; p < L.pages; ++p) {
+        uint32_t n = L.leavesIn(p);
+        for (uint32_t k = 0; k < n; ++k) {
+            uint32_t i = p * merkle::kPageLeaves + k;
+            auto data = read(uint64_t(i) * L.chunkSize, L.chunkLen(i));
+            if (!data) return std::nullopt;
+            leaves[k] = merkle::leaf(*data);
+        }
+        pageRoots[p] = merkle::pageRoot(leaves.data(), n);
+    }
+    return merkle::PageTree(std::move(pageRoots));
+}
+
+bool FileTransfer::pagePayload(const Layout& L, const merkle::PageTree& tree, uint32_t p,
+                               const ChunkSource& read, std::vector<uint8_t>& out) {
+    out.clear();
+    for (uint32_t k = 0; k < L.leavesIn(p); ++k) {
+        uint32_t i = p * merkle::kPageLeaves + k;
+        auto data = read(uint64_t(i) * L.chunkSize, L.chunkLen(i));
+        if (!data) return false;
+        auto h = merkle::leaf(*data);
+        out.insert(out.end(), h.begin(), h.end());
+    }
+    for (const auto& h : tree.proof(p)) out.insert(out.end(), h.begin(), h.end());
+    return true;
+}
+
+std::optional<merkle::Hash> FileTransfer::share(const std::string& path, size_t chunkSize) {
+    std::error_code ec;
+    uint64_t size = std::filesystem::file_size(path, ec);
+    if (ec) return std::nullopt;
+    int fd = openRead(path);
+    if (fd < 0) return std::nullopt;
+    Manifest m;
+    m.name = std::filesystem::path(path).filename().string();
+    std::vector<uint8_t> scratch;
+    auto read = [&](uint64_t off, size_t len) -> std::optional<ByteView> {
+        scratch.resize(len);
+        if (!readAt(fd, off, scratch.data(), len)) return std::nullopt;
+        return ByteView(scratch.data(), len);
+    };
+    if (!Layout::make(size, static_cast<uint32_t>(std::min<size_t>(chunkSize ? chunkSize : chunkFor(PathMtu::kBase), 65535)), m.layout)) {
+        closeFile(fd);
+        return std::nullopt;
+    }
+    auto tree = buildTree(m.layout, read);
+    if (!tree) { closeFile(fd); return std::nullopt; }
+    auto sh = std::make_unique<Share>(Share{m, std::move(*tree), {}, fd});
+    sh->m.root = sh->tree.root();
+    merkle::Hash root = sh->m.root;
+    addShare(std::move(sh));
+    return root;
+}
+
+std::optional<merkle::Hash> FileTransfer::shareBuffer(const std::string& name, std::vector<uint8_t> data, size_t chunkSize) {
+    Manifest m;
+    m.name = name;
+    if (!Layout::make(data.size(), static_cast<uint32_t>(std::min<size_t>(chunkSize ? chunkSize : chunkFor(PathMtu::kBase), 65535)), m.layout)) {
+        return std::nullopt;
+    }
+    auto read = [&](uint64_t off, size_t len) -> std::optional<ByteView> { return ByteView(data.data() + off, len); };
+    auto tree = buildTree(m.layout, read);
+    auto sh = std::make_unique<Share>(Share{m, std::move(*tree), std::move(data), -1});
+    sh->m.root = sh->tree.root();
+    merkle::Hash root = sh->m.root;
+    addShare(std::move(sh));
+    return root;
+}
+
+void FileTransfer::addShare(std::unique_ptr<Share> sh) {
+    std::lock_guard<std::mutex> lock(shareMtx_);
+    auto& slot = shares_[idOf(sh->m.root)];
+    if (slot && slot->fd >= 0) closeFile(slot->fd);
+    slot = std::move(sh);
+}
+
+void FileTransfer::unshare(const merkle::Hash& root) {
+    std::lock_guard<std::mutex> lock(shareMtx_);
+    auto it = shares_.find(idOf(root));
+    if (it == shares_.end() || it->second->m.root != root) return;
+    if (it->second->fd >= 0) closeFile(it->second->fd);
+    shares_.erase(it);
+}
+
+std::vector<uint8_t> FileTransfer::buildHave(const Manifest& m, const Incoming* inc) {
+    // msg: type,manifest body,seed,n,n*(start,count) chunks held; a seed has all of them
+    auto msg = buildManifest(m);
+    msg[0] = static_cast<uint8_t>(MessageType::FILE_HAVE);
+    msg.push_back(inc ? 0 : 1);
+    size_t at = msg.size();
+    msg.push_back(0);
+    if (!inc) return msg;
+    uint8_t n = 0;
+    // early chunks are not on disk yet, so they are not offered
+    auto held = [&](uint32_t c){ return inc->has(Layout::chunkUnit(c)) && !inc->early.count(c); };
+    for (uint32_t c = 0; c < m.layout.chunks && n < kMaxRanges; ) {
+        if (!held(c)) { ++c; continue; }
+        uint32_t start = c;
+        while (c < m.layout.chunks && held(c)) ++c;
+        put32(msg, start); put32(msg, c - start); ++n;
+    }
+    msg[at] = n;
+    return msg;
+}
+
+void FileTransfer::handleQuery(const PeerId& from, ByteView body) {
+    // body: id
+    if (body.size() != 16) return;
+    FileId id{}; std::memcpy(id.data(), body.data(), 16);
+    std::vector<uint8_t> reply;
+    {
+        std::lock_guard<std::mutex> lock(shareMtx_);
+        auto it = shares_.find(id);
+        if (it != shares_.end()) reply = buildHave(it->second->m, nullptr);
+    }
+    if (reply.empty()) {
+        std::lock_guard<std::mutex> lock(inMtx_);
+        auto it = in_.find(id);
+        if (it == in_.end() || it->second.received == 0) return;
+        reply = buildHave(it->second.m, &it->second);
+    }
+    node_.sendMessage(from, reply);
+}
+
+bool FileTransfer::Source::holds(uint32_t unit) const {
+    if (!counted) return false;
+    if (seed) return true;
+    // partial holders cannot prove pages, only chunks
+    uint32_t c = 0;
+    if (!Layout::isChunk(unit, c)) return false;
+    return have[c / 64] >> (c % 64) & 1;
+}
+
+void FileTransfer::countSource(Pull& pl, const Source& s, int d) {
+    if (s.seed) { pl.seeds += d; return; }
+    for (size_t w = 0; w < s.have.size(); ++w) {
+        uint32_t c = static_cast<uint32_t>(w * 64);
+        for (uint64_t bits = s.have[w]; bits; bits >>= 1, ++c) {
+            if (bits & 1) pl.partial[Layout::chunkUnit(c)] += d;
+        }
+    }
+}
+
+bool FileTransfer::switchLayout(Pull& pl, InIter& it, Clock::time_point now) {
+    pl.layoutAt = now;
+    const Layout* cur = it == in_.end() ? nullptr : &it->second.m.layout;
+    // the layout most of the holders still trusted agree on; every one of
+    // them tried already starts the round over
+    auto pick = [&]() -> const Source* {
+        const Source* best = nullptr;
+        size_t votes = 0;
+        for (const auto& s : pl.sources) {
+            if (s.bad || (cur && s.m.layout == *cur) ||
+                std::find(pl.tried.begin(), pl.tried.end(), s.m.layout) != pl.tried.end()) continue;
+            size_t v = std::count_if(pl.sources.begin(), pl.sources.end(),
+                                     [&](const Source& x){ return !x.bad && x.m.layout == s.m.layout; });
+            if (v > votes) { best = &s; votes = v; }
+        }
+        return best;
+    };
+    const Source* next = pick();
+    if (!next && !pl.tried.empty()) { pl.tried.clear(); next = pick(); }
+    if (!next) return false;
+    if (cur) {
+        pl.tried.push_back(*cur);
+        discard(it);
+        it = in_.end();
+        cur = nullptr;
+    }
+    pl.pending.clear();
+    pl.seeds = 0;
+    pl.partial.clear();
+    for (auto& s : pl.sources) { s.counted = false; s.inflight = 0; }
+    while (next) {
+        it = admit(next->peer, next->m, true);
+        if (it != in_.end()) break;
+        pl.tried.push_back(next->m.layout);
+        next = pick();
+    }
+    if (it == in_.end()) return false;
+    const Layout& L = it->second.m.layout;
+    pl.partial.assign(L.units(), 0);
+    for (auto& s : pl.sources) {
+        s.counted = !s.bad && s.m.layout == L;
+        if (s.counted) countSource(pl, s, +1);
+    }
+    pl.progressAt = now;
+    pl.wake = true;
+    return true;
+}
+
+void FileTransfer::handleHave(const PeerId& from, ByteView body) {
+    if (body.size() < 45) return;
+    size_t ml = 45 + body[44];
+    if (body.size() < ml + 2) return;
+    Manifest m;
+    if (!parseManifest(body.sub(0, ml), m)) return;
+    bool seed = body[ml] != 0;
+    size_t n = body[ml + 1];
+    if (body.size() != ml + 2 + n * 8) return;
+    const FileId id = idOf(m.root);
+    // the report as a bitmap of its own layout's chunks; overlapping ranges
+    // cannot count a holder twice
+    std::vector<uint64_t> have;
+    if (!seed) have.assign((uint64_t(m.layout.chunks) + 63) / 64, 0);
+    for (size_t i = 0; i < n && !seed; ++i) {
+        uint64_t c = get32(body.data() + ml + 2 + i*8);
+        uint64_t end = std::min<uint64_t>(c + get32(body.data() + ml + 6 + i*8), m.layout.chunks);
+        while (c < end) {
+            uint64_t lo = c % 64, span = std::min<uint64_t>(64 - lo, end - c);
+            have[c / 64] |= (span == 64 ? ~uint64_t(0) : ((uint64_t(1) << span) - 1)) << lo;
+            c += span;
+        }
+    }
+    std::lock_guard<std::mutex> lock(inMtx_);
+    auto pl = pulls_.find(id);
+    if (pl == pulls_.end() || pl->second->root != m.root) return;
+    Pull& pull = *pl->second;
+    auto src = std::find_if(pull.sources.begin(), pull.sources.end(), [&](const Source& s){ return s.peer == from; });
+    if (src == pull.sources.end()) {
+        pull.sources.push_back(Source{});
+        src = std::prev(pull.sources.end());
+        src->peer = from;
+    }
+    if (src->bad) return;
+    auto now = Clock::now();
+    auto it = in_.find(id);
+    bool counted = it != in_.end() && it->second.m.layout == m.layout;
+    if (counted && pull.partial.empty()) pull.partial.assign(m.layout.units(), 0);
+    if (counted && src->counted && !seed && !src->seed) {
+        // same layout, still partial: only the chunks that changed move the counts
+        for (size_t w = 0; w < have.size(); ++w) {
+            uint32_t c = static_cast<uint32_t>(w * 64);
+            for (uint64_t diff = have[w] ^ src->have[w]; diff; diff >>= 1, ++c) {
+                if (diff & 1) pull.partial[Layout::chunkUnit(c)] += (have[w] >> (c % 64) & 1) ? 1 : -1;
+            }
+        }
+        src->have = std::move(have);
+    } else {
+        if (src->counted) countSource(pull, *src, -1);
+        src->counted = counted;
+        src->seed = seed;
+        src->have = std::move(have);
+        if (counted) countSource(pull, *src, +1);
+    }
+    src->m = m;
+    // the first report picks what to fetch, and so does one arriving after
+    // every holder of the current layout turned out to lie; the others wait
+    // as candidates
+    if (it == in_.end() || (!it->second.verified() &&
+                            std::none_of(pull.sources.begin(), pull.sources.end(), [](const Source& s){ return s.counted; }))) {
+        switchLayout(pull, it, now);
+    }
+    pull.progressAt = now;
+    pull.wake = true;
+    pull.cv.notify_one();
+}
+
+void FileTransfer::handleRequest(const PeerId& from, ByteView body) {
+    // body: id,n,n*unit
+    if (body.size() < 17) return;
+    size_t n = body[16];
+    if (n > kPullBatch || body.size() != 17 + n * 4) return;
+    FileId id{}; std::memcpy(id.data(), body.data(), 16);
+    std::vector<std::vector<uint8_t>> batch;
+    std::vector<uint8_t> scratch, page;
+    {
+        std::lock_guard<std::mutex> lock(shareMtx_);
+        auto it = shares_.find(id);
+        if (it != shares_.end()) {
+            const Share& sh = *it->second;
+            const Layout& L = sh.m.layout;
+            auto read = [&](uint64_t off, size_t len) -> std::optional<ByteView> {
+                if (sh.fd < 0) return ByteView(sh.data.data() + off, len);
+                scratch.resize(len);
+                if (!readAt(sh.fd, off, scratch.data(), len)) return std::nullopt;
+                return ByteView(scratch.data(), len);
+            };
+            for (size_t i = 0; i < n; ++i) {
+                uint32_t unit = get32(body.data() + 17 + i*4), chunk = 0;
+                if (unit >= L.units()) continue;
+                if (Layout::isChunk(unit, chunk)) {
+                    if (auto data = read(uint64_t(chunk) * L.chunkSize, L.chunkLen(chunk))) batch.push_back(buildChunk(id, unit, *data));
+                } else if (pagePayload(L, sh.tree, unit / (merkle::kPageLeaves + 1), read, page)) {
+                    batch.push_back(buildChunk(id, unit, page));
+                }
+            }
+        }
+    }
+    if (batch.empty()) {
+        // a download in progress passes on the chunks it has verified
+        std::lock_guard<std::mutex> lock(inMtx_);
+        auto it = in_.find(id);
+        if (it == in_.end()) return;
+        const Incoming& inc = it->second;
+        const Layout& L = inc.m.layout;
+        for (size_t i = 0; i < n; ++i) {
+            uint32_t unit = get32(body.data() + 17 + i*4), chunk = 0;
+            if (unit >= L.units() || !Layout::isChunk(unit, chunk) || !inc.has(unit) || inc.early.count(chunk)) continue;
+            uint64_t off = uint64_t(chunk) * L.chunkSize;
+            size_t len = L.chunkLen(chunk);
+            if (inc.fd < 0) { batch.push_back(buildChunk(id, unit, ByteView(inc.data.data() + off, len))); continue; }
+            scratch.resize(len);
+            if (readAt(inc.fd, off, scratch.data(), len)) batch.push_back(buildChunk(id, unit, scratch));
+        }
+    }
+    for (auto& m : batch) node_.sendAsync(from, std::move(m), nullptr, SendClass::Bulk);
+}
+
+void FileTransfer::schedule(Pull& pl, const Incoming& inc, Clock::time_point now,
+                            std::vector<std::pair<PeerId, std::vector<std::vector<uint8_t>>>>& out) {
+    const Layout& L = inc.m.layout;
+    FileId id = idOf(pl.root);
+    // requests overtaken by later answers from the same holder, or overdue, go
+    // back to the pool; the holder's window halves once per round
+    for (auto r = pl.pending.begin(); r != pl.pending.end(); ) {
+        Source& s = pl.sources[r->second.source];
+        bool overtaken = r->second.seq + kReorderThresh <= s.ackedSeq;
+        bool overdue = now - r->second.sentAt >= s.rto;
+        if (!overtaken && !overdue && !inc.has(r->first)) { ++r; continue; }
+        s.inflight--;
+        if (!inc.has(r->first) && now - s.cutAt >= std::max<Clock::duration>(s.srtt, kMinRto)) {
+            s.ssthresh = std::max(2.0, s.window / 2);
+            s.window = std::max(1.0, s.window / 2);
+            if (overdue && !overtaken) s.rto = std::min<Clock::duration>(s.rto * 2, kMaxRto);
+            s.cutAt = now;
+        }
+        r = pl.pending.erase(r);
+    }
+    auto room = [&](const Source& s){ return static_cast<uint32_t>(s.window) > s.inflight ? static_cast<uint32_t>(s.window) - s.inflight : 0; };
+    std::vector<std::vector<uint32_t>> picks(pl.sources.size());
+    pl.arrived = 0;
+    pl.wake = false;
+    auto assign = [&](uint32_t unit, uint32_t src, bool moved) {
+        pl.pending[unit] = Request{src, now, ++pl.sources[src].seq, moved};
+        pl.sources[src].inflight++;
+        picks[src].push_back(unit);
+    };
+
+    // rarest first among the units just past the first missing one; looking
+    // a few windows ahead is enough to find the rare ones
+    size_t free = 0;
+    for (const auto& src : pl.sources) free += room(src);
+    std::vector<std::pair<uint32_t, uint32_t>> cands; // (holders, unit)
+    uint32_t end = static_cast<uint32_t>(std::min<uint64_t>(L.units(), uint64_t(inc.next) + kPullSpan));
+    for (uint32_t u = inc.next; u < end && free && cands.size() < 4 * free; ++u) {
+        if (inc.has(u) || pl.pending.count(u)) continue;
+        uint32_t holders = pl.seeds + (pl.partial.empty() ? 0 : pl.partial[u]);
+        if (holders) cands.emplace_back(holders, u);
+    }
+    std::stable_sort(cands.begin(), cands.end(), [](const auto& a, const auto& b){ return a.first < b.first; });
+    // each goes to the holder with the most free window, so faster peers take more
+    for (size_t k = 0; k < cands.size() && free; ++k) {
+        uint32_t u = cands[k].second, best = UINT32_MAX, bestRoom = 0;
+        for (uint32_t i = 0; i < pl.sources.size(); ++i) {
+            uint32_t r = room(pl.sources[i]);
+            if (r > bestRoom && pl.sources[i].holds(u)) { best = i; bestRoom = r; }
+        }
+        if (best != UINT32_MAX) { assign(u, best, false); --free; }
+    }
+    // nothing new to hand out: move requests a slow holder has sat on for two
+    // of a faster holder's RTTs over to the faster one
+    if (cands.empty() && free) {
+        for (auto& [u, r] : pl.pending) {
+            for (uint32_t i = 0; i < pl.sources.size(); ++i) {
+                Source& s = pl.sources[i];
+                if (i == r.source || !s.haveRtt || !room(s) || !s.holds(u) || now - r.sentAt < 2 * s.srtt) continue;
+                pl.sources[r.source].inflight--;
+                r = Request{i, now, ++s.seq, true};
+                s.inflight++;
+                picks[i].push_back(u);
+                break;
+            }
+        }
+    }
+    for (uint32_t i = 0; i < picks.size(); ++i) {
+        if (picks[i].empty()) continue;
+        std::vector<std::vector<uint8_t>> batch;
+        for (size_t k = 0; k < picks[i].size(); k += kPullBatch) {
+            // msg: type,id,n,n*unit
+            std::vector<uint8_t> msg;
+            size_t cnt = std::min(kPullBatch, picks[i].size() - k);
+            msg.reserve(1 + 16 + 1 + cnt * 4);
+            msg.push_back(static_cast<uint8_t>(MessageType::FILE_REQUEST));
+            msg.insert(msg.end(), id.begin(), id.end());
+            msg.push_back(static_cast<uint8_t>(cnt));
+            for (size_t j = k; j < k + cnt; ++j) put32(msg, picks[i][j]);
+            batch.push_back(std::move(msg));
+        }
+        out.emplace_back(pl.sources[i].peer, std::move(batch));
+    }
+}
+
+bool FileTransfer::download(const merkle::Hash& root, const std::vector<PeerId>& peers) {
+    if (node_.onNodeThread()) return false;
+    std::vector<PeerId> ask = peers;
+    if (ask.empty()) for (const auto& p : node_.peers()) ask.push_back(p.id);
+    if (ask.empty()) return false;
+    const FileId id = idOf(root);
+    std::vector<uint8_t> query;
+    query.push_back(static_cast<uint8_t>(MessageType::FILE_QUERY));
+    query.insert(query.end(), id.begin(), id.end());
+
+    Pull pl;
+    pl.root = root;
+    pl.progressAt = Clock::now();
+    std::unique_lock<std::mutex> lock(inMtx_);
+    if (finished_.count(id)) return true;
+    if (!pulls_.emplace(id, &pl).second) return false; // already downloading it
+    std::vector<std::pair<PeerId, std::vector<std::vector<uint8_t>>>> out;
+    Clock::time_point queried{};
+    while (!pl.done) {
+        if (pl.handover) { pl.cv.wait(lock, [&]{ return pl.done; }); break; }
+        auto now = Clock::now();
+        if (now - pl.progressAt > kPullStall) { stalled_++; break; }
+        out.clear();
+        // ask again whoever has not answered, and partial holders for news
+        if (now - queried >= kRequery) {
+            queried = now;
+            for (const auto& p : ask) {
+                auto s = std::find_if(pl.sources.begin(), pl.sources.end(), [&](const Source& x){ return x.peer == p; });
+                if (s == pl.sources.end() || !s->seed) out.push_back({p, {query}});
+            }
+        }
+        auto it = in_.find(id);
+        // nothing verified for a while: the holders of this layout may be the liars
+        if ((it == in_.end() || !it->second.verified()) && !pl.sources.empty() && now - pl.layoutAt > kLayoutTrial) {
+            switchLayout(pl, it, now);
+        }
+        if (it != in_.end() && it->second.m.root == root) schedule(pl, it->second, now, out);
+        Clock::time_point deadline = queried + kRequery;
+        for (const auto& [u, r] : pl.pending) deadline = std::min(deadline, r.sentAt + pl.sources[r.source].rto);
+        if (!out.empty()) {
+            lock.unlock();
+            for (const auto& [peer, batch] : out) node_.sendMessages(peer, batch);
+            lock.lock();
+        }
+        pl.cv.wait_until(lock, deadline, [&]{ return pl.done || pl.handover || pl.wake; });
+    }
+    pulls_.erase(id);
+    lock.unlock();
+    if (!pl.done || pl.m.layout.size == 0) return pl.done;
+    // stay a seed for whoever is still downloading
+    int fd = pl.path.empty() ? -1 : openRead(pl.path);
+    if (pl.data.empty() && fd < 0) return true;
+    std::vector<uint8_t> scratch;
+    auto read = [&](uint64_t off, size_t len) -> std::optional<ByteView> {
+        if (fd < 0) return ByteView(pl.data.data() + off, len);
+        scratch.resize(len);
+        if (!readAt(fd, off, scratch.data(), len)) return std::nullopt;
+        return ByteView(scratch.data(), len);
+    };
+    auto tree = pl.pageRoots.empty() ? buildTree(pl.m.layout, read) : merkle::PageTree(std::move(pl.pageRoots));
+    // changed on disk meanwhile
+    if (!tree || tree->root() != root) { if (fd >= 0) closeFile(fd); return true; }
+    addShare(std::make_unique<Share>(Share{pl.m, std::move(*tree), std::move(pl.data), fd}));
+    return true;
 }
 
 } // namespace p2p
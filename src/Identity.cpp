@@ -12,8 +12,8 @@ static PeerId hash32(const KeyBytes& in) {
 }
 
 Identity Identity::generate() {
-    static bool inited = false;
-    if (!inited) { if (sodium_init() == -1) { std::abort(); } inited = true; }
+    static const bool inited = sodium_init() != -1;
+    if (!inited) std::abort();
 
     Identity ident;
     // gen box keypair
@@ -0,0 +1,77 @@
+#include "p2p/Merkle.hpp"
+
+#include <sodium.h>
+#include <algorithm>
+
+namespace p2p::merkle {
+
+Hash leaf(ByteView chunk) {
+    Hash h{};
+    const uint8_t tag = 0x00;
+    crypto_generichash_state st;
+    crypto_generichash_init(&st, nullptr, 0, h.size());
+    crypto_generichash_update(&st, &tag, 1);
+    crypto_generichash_update(&st, chunk.data(), chunk.size());
+    crypto_generichash_final(&st, h.data(), h.size());
+    return h;
+}
+
+Hash parent(const Hash& left, const Hash& right) {
+    uint8_t buf[1 + 32 + 32];
+    buf[0] = 0x01;
+    std::copy(left.begin(), left.end(), buf + 1);
+    std::copy(right.begin(), right.end(), buf + 33);
+    Hash h{};
+    crypto_generichash(h.data(), h.size(), buf, sizeof(buf), nullptr, 0);
+    return h;
+}
+
+unsigned proofLength(uint32_t pages) {
+    unsigned n = 0;
+    for (uint64_t width = 1; width < pages; width <<= 1) ++n;
+    return n;
+}
+
+Hash pageRoot(const Hash* leaves, size_t n) {
+    Hash level[kPageLeaves]{};
+    for (size_t i = 0; i < n && i < kPageLeaves; ++i) level[i] = leaves[i];
+    for (size_t width = kPageLeaves; width > 1; width /= 2) {
+        for (size_t i = 0; i < width / 2; ++i) level[i] = parent(level[2*i], level[2*i+1]);
+    }
+    return level[0];
+}
+
+PageTree::PageTree(std::vector<Hash> pageRoots) {
+    if (pageRoots.empty()) pageRoots.push_back(Hash{});
+    levels_.push_back(std::move(pageRoots));
+    while (levels_.back().size() > 1) {
+        const auto& below = levels_.back();
+        std::vector<Hash> up((below.size() + 1) / 2);
+        for (size_t i = 0; i < up.size(); ++i) {
+            up[i] = parent(below[2*i], 2*i + 1 < below.size() ? below[2*i+1] : Hash{});
+        }
+        levels_.push_back(std::move(up));
+    }
+}
+
+std::vector<Hash> PageTree::proof(uint32_t page) const {
+    std::vector<Hash> out;
+    size_t idx = page;
+    for (size_t l = 0; l + 1 < levels_.size(); ++l, idx >>= 1) {
+        size_t sib = idx ^ 1;
+        out.push_back(sib < levels_[l].size() ? levels_[l][sib] : Hash{});
+    }
+    return out;
+}
+
+bool verifyPage(const Hash& root, uint32_t pages, uint32_t page, const Hash* leaves, size_t n, const Hash* proof) {
+    if (page >= pages) return false;
+    Hash node = pageRoot(leaves, n);
+    unsigned len = proofLength(pages);
+    for (unsigned l = 0; l < len; ++l) {
+        node = (page >> l) & 1 ? parent(proof[l], node) : parent(node, proof[l]);
+    }
+    return sodium_memcmp(node.data(), root.data(), root.size()) == 0;
+}
+
+} // namespace p2p::merkle
@@ -6,70 +6,222 @@
 #else
 #include <arpa/inet.h>
 #endif
+#include <algorithm>
 #include <cstring>
 
 namespace p2p {
 
-Node::Node(const std::string& bindIp, uint16_t bindPort)
-    : self_(Identity::generate()), router_(self_, transport_, peers_) {
-    transport_.bind(bindIp, bindPort);
+Node::Node(const std::string& bindIp, uint16_t bindPort, size_t shards, EventLoop::Backend backend)
+    : self_(Identity::generate()), router_(self_, transport_, peers_),
+      outbox_(std::make_unique<SendQueue>(SendQueue::Options{})) {
+    transport_.bind(bindIp, bindPort, shards);
+    for (size_t i = 0; i < std::max<size_t>(1, transport_.shardCount()); ++i) {
+        reactors_.push_back(EventLoop::create(backend));
+    }
+    // sends all leave through shard 0; queued async sends resume once it drains
+    transport_.setWritableHook([this](bool want){
+        reactors_[0]->modify(transport_.fd(0), EventLoop::Readable | (want ? EventLoop::Writable : 0u));
+        if (!want) scheduleDrain();
+    });
+    router_.setIntroHook([this](const Endpoint& to){ transport_.sendRaw(to, beacon()); });
+    router_.setTimerHook([this](std::chrono::milliseconds delay, std::function<void()> cb){
+        reactors_[0]->addTimer(delay, std::move(cb));
+    });
 }
 
-Node::~Node() { stop(); }
+Node::~Node() {
+    stop();
+    failQueued();
+}
 
 void Node::start() {
     if (running_) return;
     running_ = true;
-    loop_ = std::thread([this]{
-        auto lastBeacon = std::chrono::steady_clock::now();
-        while (running_) {
-            transport_.poll(100,
-                [this](const Packet& pkt, const std::string& ip, uint16_t port){
-                    router_.handleIncoming(pkt, ip, port);
-                },
-                [this](const std::vector<uint8_t>& bytes, const std::string& ip, uint16_t port){
-                    // parse DISC beacon
-                    if (bytes.size() < 4+2+32+32+32) return;
-                    if (!(bytes[0]=='D'&&bytes[1]=='I'&&bytes[2]=='S'&&bytes[3]=='C')) return;
-                    uint16_t p = (static_cast<uint16_t>(bytes[4])<<8) | bytes[5];
-                    KeyBytes boxPub{}; std::memcpy(boxPub.data(), bytes.data()+6, 32);
-                    SignPublic signPub{}; std::memcpy(signPub.data(), bytes.data()+6+32, 32);
-                    PeerId pid{}; std::memcpy(pid.data(), bytes.data()+6+32+32, 32);
-                    if (pid == self_.id) return; // ignore self
-                    peers_.upsertAddrAndKeys(pid, ip, p, boxPub, signPub);
-                }
-            );
-            // prune stale
-            peers_.removeStale(std::chrono::seconds(120));
-
-            // beacon every 2s
-            auto now = std::chrono::steady_clock::now();
-            if (now - lastBeacon > std::chrono::seconds(2)) {
-                lastBeacon = now;
-                std::vector<uint8_t> msg;
-                msg.reserve(4+2+32+32+32);
-                msg.push_back('D'); msg.push_back('I'); msg.push_back('S'); msg.push_back('C');
-                uint16_t lp = htons(transport_.localPort());
-                msg.push_back((lp>>8)&0xFF); msg.push_back(lp&0xFF);
-                msg.insert(msg.end(), self_.publicKey.begin(), self_.publicKey.end());
-                msg.insert(msg.end(), self_.signPublic.begin(), self_.signPublic.end());
-                msg.insert(msg.end(), self_.id.begin(), self_.id.end());
-                transport_.sendBroadcast(transport_.localPort(), msg);
+    for (size_t i = 0; i < transport_.shardCount(); ++i) {
+        uint32_t interest = EventLoop::Readable;
+        if (i == 0 && transport_.pendingCount()) interest |= EventLoop::Writable;
+        reactors_[i]->add(transport_.fd(i), interest, [this, i](uint32_t ev){
+            if (ev & EventLoop::Readable) {
+                transport_.drain(i,
+                    [this](PacketView& pkt, const Endpoint& from){ handlePacket(pkt, from); },
+                    [this](ByteView bytes, const Endpoint& from){ handleBeacon(bytes, from); });
             }
-        }
-    });
+            if (ev & EventLoop::Writable) transport_.flush();
+        });
+    }
+    if (pipeline_) pipeline_->start();
+    // beacon every 2s, prune stale once a second
+    beaconTimer_ = reactors_[0]->addTimer(std::chrono::seconds(2), [this]{ sendBeacon(); }, true);
+    pruneTimer_ = reactors_[0]->addTimer(std::chrono::seconds(1), [this]{ peers_.removeStale(std::chrono::seconds(120)); }, true);
+    dhtTimer_ = reactors_[0]->addTimer(std::chrono::seconds(1), [this]{ router_.maintain(); }, true);
+    drainQueued_ = false;
+    retryQueued_ = false;
+    scheduleDrain();
+    for (auto& r : reactors_) {
+        EventLoop* loop = r.get();
+        workers_.emplace_back([this, loop]{
+            while (running_) loop->runOnce(1000);
+        });
+    }
 }
 
 void Node::stop() {
     if (!running_) return;
+    router_.flushMessages();
     running_ = false;
-    if (loop_.joinable()) loop_.join();
+    for (auto& r : reactors_) r->wakeup();
+    for (auto& t : workers_) if (t.joinable()) t.join();
+    workers_.clear();
+    if (pipeline_) pipeline_->stop();
+    reactors_[0]->cancelTimer(beaconTimer_);
+    reactors_[0]->cancelTimer(pruneTimer_);
+    reactors_[0]->cancelTimer(dhtTimer_);
+    for (size_t i = 0; i < transport_.shardCount(); ++i) reactors_[i]->remove(transport_.fd(i));
+    failQueued();
 }
 
-void Node::addPeer(const Peer& p) { peers_.addOrUpdate(p); }
+void Node::enablePipeline(Pipeline::Options opts) {
+    if (running_) return;
+    pipeline_ = std::make_unique<Pipeline>(router_, std::move(opts));
+}
+
+void Node::handlePacket(PacketView& pkt, const Endpoint& from) {
+    if (!pipeline_) { router_.handleIncoming(pkt, from); return; }
+    if (!router_.admit(pkt, from)) return;
+    pipeline_->submit(std::move(pkt), from);
+}
+
+void Node::handleBeacon(ByteView bytes, const Endpoint& from) {
+    // parse DISC beacon
+    if (bytes.size() < 4+2+32+32+32) return;
+    if (!(bytes[0]=='D'&&bytes[1]=='I'&&bytes[2]=='S'&&bytes[3]=='C')) return;
+    uint16_t p = (static_cast<uint16_t>(bytes[4])<<8) | bytes[5];
+    KeyBytes boxPub{}; std::memcpy(boxPub.data(), bytes.data()+6, 32);
+    SignPublic signPub{}; std::memcpy(signPub.data(), bytes.data()+6+32, 32);
+    PeerId pid{}; std::memcpy(pid.data(), bytes.data()+6+32+32, 32);
+    if (pid == self_.id) return; // ignore self
+    // the beacon names the listening port; the address is wherever it came from
+    Endpoint ep = from;
+    ep.port = p;
+    peers_.upsertAddrAndKeys(pid, ep, boxPub, signPub);
+    router_.notePeer(pid);
+}
+
+std::vector<uint8_t> Node::beacon() const {
+    std::vector<uint8_t> msg;
+    msg.reserve(4+2+32+32+32);
+    msg.push_back('D'); msg.push_back('I'); msg.push_back('S'); msg.push_back('C');
+    uint16_t lp = transport_.localPort();
+    msg.push_back((lp>>8)&0xFF); msg.push_back(lp&0xFF);
+    msg.insert(msg.end(), self_.publicKey.begin(), self_.publicKey.end());
+    msg.insert(msg.end(), self_.signPublic.begin(), self_.signPublic.end());
+    msg.insert(msg.end(), self_.id.begin(), self_.id.end());
+    return msg;
+}
+
+void Node::sendBeacon() { transport_.sendBroadcast(transport_.localPort(), beacon()); }
+
+void Node::addPeer(const Peer& p) {
+    peers_.addOrUpdate(p);
+    router_.notePeer(p.id);
+}
+
+bool Node::onNodeThread() const {
+    auto self = std::this_thread::get_id();
+    for (const auto& t : workers_) if (t.get_id() == self) return true;
+    return pipeline_ && pipeline_->onWorker();
+}
 
 bool Node::sendMessage(const PeerId& dest, const std::vector<uint8_t>& data) { return router_.sendMessage(dest, data); }
 
+bool Node::sendMessages(const PeerId& dest, const std::vector<std::vector<uint8_t>>& batch) { return router_.sendMessages(dest, batch); }
+
+void Node::configureSendQueue(SendQueue::Options opts) {
+    if (running_) return;
+    failQueued();
+    outbox_ = std::make_unique<SendQueue>(std::move(opts));
+}
+
+bool Node::sendAsync(const PeerId& dest, std::vector<uint8_t> data, SendQueue::Completion done, SendClass cls) {
+    if (!outbox_->push(dest, data, done, cls)) {
+        if (done) done(SendResult::QueueFull);
+        return false;
+    }
+    scheduleDrain();
+    return true;
+}
+
+std::future<SendResult> Node::sendAsync(const PeerId& dest, std::vector<uint8_t> data, SendClass cls) {
+    auto p = std::make_shared<std::promise<SendResult>>();
+    auto f = p->get_future();
+    sendAsync(dest, std::move(data), [p](SendResult r){ p->set_value(r); }, cls);
+    return f;
+}
+
+void Node::scheduleDrain() {
+    if (!drainQueued_.exchange(true)) reactors_[0]->addTimer(std::chrono::milliseconds(0), [this]{ drainSends(); });
+}
+
+void Node::scheduleRetry(SendQueue::Clock::duration wait) {
+    if (retryQueued_.exchange(true)) return;
+    auto ms = std::max(std::chrono::ceil<std::chrono::milliseconds>(wait), std::chrono::milliseconds(1));
+    reactors_[0]->addTimer(ms, [this]{
+        retryQueued_ = false;
+        scheduleDrain();
+    });
+}
+
+void Node::drainSends() {
+    drainQueued_ = false;
+    SendQueue::Item item;
+    SendQueue::Clock::duration retry{};
+    // messages go out in bursts while they are for one peer; completions
+    // learn their result once the burst has been handed over
+    std::vector<std::vector<uint8_t>> burst;
+    std::vector<SendQueue::Completion> dones;
+    std::vector<SendClass> classes;
+    PeerId burstTo{};
+    // false once the transport is full; what it did not take, and next if
+    // given, go back to the head of the queue and the drain pauses like for
+    // a backed up socket
+    auto flush = [&](SendQueue::Item* next = nullptr) {
+        size_t taken = 0;
+        SendResult r = burst.empty() ? SendResult::Sent : router_.send(burstTo, burst, &taken);
+        for (size_t i = 0; i < taken; ++i) if (dones[i]) dones[i](SendResult::Sent);
+        std::vector<SendQueue::Item> back;
+        for (size_t i = taken; i < burst.size(); ++i) {
+            if (r == SendResult::QueueFull) back.push_back({burstTo, std::move(burst[i]), std::move(dones[i]), classes[i]});
+            else if (dones[i]) dones[i](r);
+        }
+        burst.clear();
+        dones.clear();
+        classes.clear();
+        if (r != SendResult::QueueFull) return true;
+        if (next) back.push_back(std::move(*next));
+        outbox_->requeue(back);
+        return false;
+    };
+    for (size_t n = 0; n < kDrainBudget; ++n) {
+        // paused while the socket is backed up; the writable hook resumes it
+        if (transport_.backlogged()) { flush(); return; }
+        if (!outbox_->pop(item, retry)) {
+            // only rate limits hold the rest back
+            if (flush() && retry != SendQueue::Clock::duration::max()) scheduleRetry(retry);
+            return;
+        }
+        if (!burst.empty() && (burstTo != item.peer || burst.size() == kDrainBurst) && !flush(&item)) return;
+        burstTo = item.peer;
+        burst.push_back(std::move(item.data));
+        dones.push_back(std::move(item.done));
+        classes.push_back(item.cls);
+    }
+    if (flush()) scheduleDrain();
+}
+
+void Node::failQueued() {
+    for (auto& item : outbox_->takeAll()) if (item.done) item.done(SendResult::Stopped);
+}
+
 bool Node::sendText(const PeerId& dest, const std::string& text) {
     std::vector<uint8_t> payload(text.begin(), text.end());
     auto packed = packMessage(MessageType::TEXT, payload);
@@ -18,8 +18,33 @@ static bool read_u32(const uint8_t* data, size_t len, size_t& off, uint32_t& v){
     return true;
 }
 
+static void write_u64(std::vector<uint8_t>& out, uint64_t v){
+    write_u32(out, static_cast<uint32_t>(v >> 32));
+    write_u32(out, static_cast<uint32_t>(v));
+}
+
+static bool read_u64(const uint8_t* data, size_t len, size_t& off, uint64_t& v){
+    uint32_t hi = 0, lo = 0;
+    if (!read_u32(data, len, off, hi) || !read_u32(data, len, off, lo)) return false;
+    v = (static_cast<uint64_t>(hi) << 32) | lo;
+    return true;
+}
+
 std::vector<uint8_t> Packet::serialize() const {
     std::vector<uint8_t> out;
+    if (kind == Kind::Session) {
+        // SESS|sender|dest|ttl|session|counter|len|payload
+        out.reserve(4+32+32+1+4+8+4+payload.size());
+        out.push_back('S'); out.push_back('E'); out.push_back('S'); out.push_back('S');
+        out.insert(out.end(), sender.begin(), sender.end());
+        out.insert(out.end(), dest.begin(), dest.end());
+        out.push_back(ttl);
+        write_u32(out, session);
+        write_u64(out, counter);
+        write_u32(out, static_cast<uint32_t>(payload.size()));
+        out.insert(out.end(), payload.begin(), payload.end());
+        return out;
+    }
     out.reserve(32+32+1+64+4+payload.size());
     out.insert(out.end(), sender.begin(), sender.end());
     out.insert(out.end(), dest.begin(), dest.end());
@@ -31,8 +56,24 @@ std::vector<uint8_t> Packet::serialize() const {
 }
 
 bool Packet::deserialize(const uint8_t* data, size_t len, Packet& outp) {
+    if (len >= 4 && data[0]=='S' && data[1]=='E' && data[2]=='S' && data[3]=='S') {
+        if (len < 4+32+32+1+4+8+4) return false;
+        size_t off = 4;
+        outp.kind = Kind::Session;
+        std::memcpy(outp.sender.data(), data + off, 32); off += 32;
+        std::memcpy(outp.dest.data(), data + off, 32); off += 32;
+        outp.ttl = data[off++];
+        if (!read_u32(data, len, off, outp.session)) return false;
+        if (!read_u64(data, len, off, outp.counter)) return false;
+        uint32_t plen = 0;
+        if (!read_u32(data, len, off, plen)) return false;
+        if (off + plen > len) return false;
+        outp.payload.assign(data + off, data + off + plen);
+        return true;
+    }
     if (len < 32+32+1+64+4) return false;
     size_t off = 0;
+    outp.kind = Kind::Signed;
     std::memcpy(outp.sender.data(), data + off, 32); off += 32;
     std::memcpy(outp.dest.data(), data + off, 32); off += 32;
     outp.ttl = data[off++];
@@ -44,4 +85,54 @@ bool Packet::deserialize(const uint8_t* data, size_t len, Packet& outp) {
     return true;
 }
 
+bool PacketView::parse(BufferRef& buf, size_t len, PacketView& out) {
+    const uint8_t* data = buf.data();
+    size_t off = 0;
+    uint32_t plen = 0;
+    if (len >= 4 && data[0]=='S' && data[1]=='E' && data[2]=='S' && data[3]=='S') {
+        if (len < 4+32+32+1+4+8+4) return false;
+        off = 4;
+        out.kind = Packet::Kind::Session;
+        std::memcpy(out.sender.data(), data + off, 32); off += 32;
+        std::memcpy(out.dest.data(), data + off, 32); off += 32;
+        out.ttlOff_ = off;
+        out.ttl = data[off++];
+        if (!read_u32(data, len, off, out.session)) return false;
+        if (!read_u64(data, len, off, out.counter)) return false;
+    } else {
+        if (len < 32+32+1+64+4) return false;
+        out.kind = Packet::Kind::Signed;
+        std::memcpy(out.sender.data(), data + off, 32); off += 32;
+        std::memcpy(out.dest.data(), data + off, 32); off += 32;
+        out.ttlOff_ = off;
+        out.ttl = data[off++];
+        out.sigOff_ = off; off += 64;
+        out.session = 0; out.counter = 0;
+    }
+    if (!read_u32(data, len, off, plen)) return false;
+    if (off + plen > len) return false;
+    out.payloadOff_ = off;
+    out.payloadLen_ = plen;
+    out.wireLen_ = len;
+    out.buf_ = std::move(buf);
+    return true;
+}
+
+void PacketView::adopt(BufferRef buf, size_t len) {
+    buf_ = std::move(buf);
+    wireLen_ = len;
+    ttlOff_ = sigOff_ = payloadOff_ = 0;
+    payloadLen_ = len;
+}
+
+Packet PacketView::toPacket() const {
+    Packet p{};
+    p.kind = kind; p.sender = sender; p.dest = dest; p.ttl = ttl;
+    p.session = session; p.counter = counter;
+    if (kind == Packet::Kind::Signed) std::memcpy(p.signature.data(), buf_.data() + sigOff_, 64);
+    auto pl = payload();
+    p.payload.assign(pl.begin(), pl.end());
+    return p;
+}
+
 } // namespace p2p
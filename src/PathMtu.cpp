@@ -0,0 +1,97 @@
+#include "p2p/PathMtu.hpp"
+
+#include <algorithm>
+
+namespace p2p {
+
+PathMtu::PathMtu(size_t ceiling, size_t capacity)
+    : ceiling_(std::max(ceiling, kBase)), capacity_(capacity ? capacity : 1) {}
+
+std::vector<size_t> PathMtu::sizesAbove(size_t mtu) const {
+    std::vector<size_t> out;
+    for (size_t s : kLadder) if (s > mtu && s <= ceiling_) out.push_back(s);
+    // and whatever the receive buffers allow, which loopback and jumbo LANs carry
+    if (ceiling_ > mtu && (out.empty() || out.back() != ceiling_)) out.push_back(ceiling_);
+    return out;
+}
+
+size_t PathMtu::mtu(const PeerId& peer) const {
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = paths_.find(peer);
+    return it == paths_.end() ? kBase : it->second.mtu;
+}
+
+void PathMtu::use(const PeerId& peer) {
+    auto now = Clock::now();
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = paths_.find(peer);
+    if (it == paths_.end()) {
+        if (paths_.size() >= capacity_) return; // stays at kBase
+        it = paths_.emplace(peer, Path{}).first;
+    }
+    it->second.usedAt = now;
+}
+
+bool PathMtu::searching(const PeerId& peer) const {
+    auto now = Clock::now();
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = paths_.find(peer);
+    if (it == paths_.end()) return false;
+    const Path& p = it->second;
+    return p.outstanding > 0 && now - p.roundAt < kProbeTimeout;
+}
+
+void PathMtu::round(const PeerId& peer, Path& p, Clock::time_point now, std::vector<Probe>& out) {
+    auto sizes = sizesAbove(p.mtu);
+    p.outstanding = sizes.size();
+    if (sizes.empty()) return;
+    if (p.tries++ == 0) p.searchAt = now;
+    p.nonce++;
+    p.roundAt = now;
+    for (size_t s : sizes) out.push_back(Probe{peer, p.nonce, s});
+}
+
+std::vector<PathMtu::Probe> PathMtu::due() {
+    auto now = Clock::now();
+    std::vector<Probe> out;
+    std::lock_guard<std::mutex> lock(mtx_);
+    for (auto it = paths_.begin(); it != paths_.end();) {
+        Path& p = it->second;
+        if (now - p.usedAt > kIdle) { it = paths_.erase(it); continue; }
+        if (p.tries > 0 && now - p.searchAt > kResearch) {
+            // start over from the floor, so a path that shrank is noticed too
+            p.mtu = kBase;
+            p.tries = 0;
+        }
+        bool roundOver = p.outstanding == 0 || now - p.roundAt >= kProbeTimeout;
+        if (p.tries == 0 || (roundOver && p.outstanding > 0 && p.tries < kTries)) round(it->first, p, now, out);
+        ++it;
+    }
+    return out;
+}
+
+std::vector<PathMtu::Probe> PathMtu::kick(const PeerId& peer) {
+    auto now = Clock::now();
+    std::vector<Probe> out;
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = paths_.find(peer);
+    if (it == paths_.end()) {
+        if (paths_.size() >= capacity_) return out;
+        it = paths_.emplace(peer, Path{}).first;
+    }
+    it->second.usedAt = now;
+    if (it->second.tries == 0) round(peer, it->second, now, out);
+    return out;
+}
+
+void PathMtu::acked(const PeerId& peer, uint32_t nonce, size_t size) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = paths_.find(peer);
+    if (it == paths_.end()) return;
+    Path& p = it->second;
+    if (nonce != p.nonce || p.outstanding == 0 || size > ceiling_) return;
+    p.outstanding--;
+    if (size > p.mtu) p.mtu = size;
+}
+
+} // namespace p2p
@@ -1,44 +1,149 @@
 #include "p2p/PeerDirectory.hpp"
 
-#include <algorithm>
-
 namespace p2p {
 
+using Clock = std::chrono::steady_clock;
+
+PeerDirectory::Record::Record(const Peer& p) : peer(p), seen_(p.lastSeen.time_since_epoch().count()) {}
+
+PeerDirectory::Record::~Record() { crypto::wipe(key_); }
+
+Clock::time_point PeerDirectory::Record::seen() const {
+    return Clock::time_point(Clock::duration(seen_.load(std::memory_order_relaxed)));
+}
+
+PeerDirectory::PeerDirectory() : snap_(std::make_shared<Snapshot>()) {}
+
+void PeerDirectory::put(const Peer& p) {
+    auto cur = snapshot();
+    auto it = cur->byId.find(p.id);
+    if (it != cur->byId.end()) {
+        const Peer& old = it->second->peer;
+        if (old.endpoint == p.endpoint && old.publicKey == p.publicKey && old.signPublic == p.signPublic) {
+            // nothing readers index on changed: no new snapshot
+            it->second->seen_.store(p.lastSeen.time_since_epoch().count(), std::memory_order_relaxed);
+            schedule(p.id, p.lastSeen.time_since_epoch().count());
+            return;
+        }
+    }
+    auto next = std::make_shared<Snapshot>(*cur);
+    if (it != cur->byId.end()) {
+        auto a = next->byAddr.find(it->second->peer.endpoint);
+        if (a != next->byAddr.end() && a->second == it->second) next->byAddr.erase(a);
+    }
+    auto rec = std::make_shared<const Record>(p);
+    next->byId[p.id] = rec;
+    if (p.endpoint.valid()) next->byAddr[p.endpoint] = rec;
+    publish(std::move(next));
+    schedule(p.id, p.lastSeen.time_since_epoch().count());
+}
+
+void PeerDirectory::publish(std::shared_ptr<const Snapshot> next) {
+#if defined(__cpp_lib_atomic_shared_ptr)
+    snap_.store(std::move(next), std::memory_order_release);
+#else
+    std::atomic_store_explicit(&snap_, std::move(next), std::memory_order_release);
+#endif
+}
+
+void PeerDirectory::schedule(const PeerId& id, Rep seen) {
+    if (seen == 0) return; // pinned
+    if (!queued_.insert(id).second) return; // the queued entry re-checks the live value
+    expiry_.push(Due{seen, id});
+}
+
 void PeerDirectory::addOrUpdate(const Peer& p) {
-    std::lock_guard<std::mutex> lock(mtx_);
-    auto it = std::find_if(peers_.begin(), peers_.end(), [&](const Peer& x){ return x.id == p.id; });
-    if (it == peers_.end()) peers_.push_back(p);
-    else *it = p;
+    std::lock_guard<std::mutex> lock(writeMtx_);
+    put(p);
 }
 
 std::vector<Peer> PeerDirectory::list() const {
-    std::lock_guard<std::mutex> lock(mtx_);
-    return peers_;
+    auto snap = snapshot();
+    std::vector<Peer> out;
+    out.reserve(snap->byId.size());
+    for (const auto& [id, r] : snap->byId) {
+        out.push_back(r->peer);
+        out.back().lastSeen = r->seen();
+    }
+    return out;
+}
+
+PeerDirectory::RecordPtr PeerDirectory::find(const PeerId& id) const {
+    auto snap = snapshot();
+    auto it = snap->byId.find(id);
+    return it == snap->byId.end() ? nullptr : it->second;
 }
 
 std::optional<Peer> PeerDirectory::findById(const PeerId& id) const {
-    std::lock_guard<std::mutex> lock(mtx_);
-    auto it = std::find_if(peers_.begin(), peers_.end(), [&](const Peer& x){ return x.id == id; });
-    if (it == peers_.end()) return std::nullopt;
-    return *it;
+    auto r = find(id);
+    if (!r) return std::nullopt;
+    Peer p = r->peer;
+    p.lastSeen = r->seen();
+    return p;
+}
+
+void PeerDirectory::touch(const Endpoint& from) {
+    auto snap = snapshot();
+    auto it = snap->byAddr.find(from);
+    if (it == snap->byAddr.end()) return;
+    Rep now = Clock::now().time_since_epoch().count();
+    Rep prev = it->second->seen_.exchange(now, std::memory_order_relaxed);
+    if (prev != 0) return;
+    // first traffic from a pinned peer: from now on it can expire
+    std::lock_guard<std::mutex> lock(writeMtx_);
+    schedule(it->second->peer.id, now);
 }
 
 void PeerDirectory::removeStale(std::chrono::seconds maxAge) {
-    std::lock_guard<std::mutex> lock(mtx_);
-    auto now = std::chrono::steady_clock::now();
-    peers_.erase(std::remove_if(peers_.begin(), peers_.end(), [&](const Peer& p){
-        if (p.lastSeen.time_since_epoch().count() == 0) return false;
-        return (now - p.lastSeen) > maxAge;
-    }), peers_.end());
+    std::lock_guard<std::mutex> lock(writeMtx_);
+    auto now = Clock::now();
+    Rep cutoff = (now - maxAge).time_since_epoch().count();
+    if (expiry_.empty() || expiry_.top().seen >= (now - maxAge - kSweepSlack).time_since_epoch().count()) return;
+    auto cur = snapshot();
+    std::shared_ptr<Snapshot> next;
+    while (!expiry_.empty() && expiry_.top().seen < cutoff) {
+        PeerId id = expiry_.top().id;
+        expiry_.pop();
+        const Snapshot& view = next ? *next : *cur;
+        auto it = view.byId.find(id);
+        Rep seen = it == view.byId.end() ? 0 : it->second->seen_.load(std::memory_order_relaxed);
+        if (seen >= cutoff) { expiry_.push(Due{seen, id}); continue; } // heard from since
+        queued_.erase(id);
+        if (seen == 0) continue; // gone or pinned again
+        if (!next) next = std::make_shared<Snapshot>(*cur);
+        auto r = next->byId.find(id);
+        auto a = next->byAddr.find(r->second->peer.endpoint);
+        if (a != next->byAddr.end() && a->second == r->second) next->byAddr.erase(a);
+        next->byId.erase(r);
+    }
+    // the dropped records (and their keys) go once the last reader lets go
+    if (next) publish(std::move(next));
 }
 
-void PeerDirectory::upsertAddrAndKeys(const PeerId& id, const std::string& ip, uint16_t port, const KeyBytes& boxPub, const SignPublic& signPub) {
-    std::lock_guard<std::mutex> lock(mtx_);
-    auto it = std::find_if(peers_.begin(), peers_.end(), [&](const Peer& x){ return x.id == id; });
+void PeerDirectory::upsertAddrAndKeys(const PeerId& id, const Endpoint& ep, const KeyBytes& boxPub, const SignPublic& signPub) {
+    std::lock_guard<std::mutex> lock(writeMtx_);
     Peer p{};
-    if (it != peers_.end()) p = *it;
-    p.id = id; p.ip = ip; p.port = port; p.publicKey = boxPub; p.signPublic = signPub; p.lastSeen = std::chrono::steady_clock::now();
-    if (it == peers_.end()) peers_.push_back(p); else *it = p;
+    if (auto r = find(id)) p = r->peer;
+    p.id = id; p.endpoint = ep; p.publicKey = boxPub; p.signPublic = signPub; p.lastSeen = Clock::now();
+    put(p);
+}
+
+const crypto::SharedKey* PeerDirectory::boxKey(const Record& r, const KeyBytes& selfPriv) {
+    std::call_once(r.keyOnce_, [&]{
+        auto k = crypto::beforenm(selfPriv, r.peer.publicKey);
+        if (!k) return;
+        r.key_ = *k;
+        r.keyOk_ = true;
+    });
+    return r.keyOk_ ? &r.key_ : nullptr;
+}
+
+std::optional<crypto::SharedKey> PeerDirectory::boxKey(const PeerId& id, const KeyBytes& selfPriv) const {
+    auto r = find(id);
+    if (!r) return std::nullopt;
+    const crypto::SharedKey* k = boxKey(*r, selfPriv);
+    if (!k) return std::nullopt;
+    return *k;
 }
 
 } // namespace p2p
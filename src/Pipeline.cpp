@@ -0,0 +1,97 @@
+#include "p2p/Pipeline.hpp"
+#include "p2p/Router.hpp"
+
+namespace p2p {
+
+Pipeline::Pipeline(Router& router, Options opts)
+    : router_(router), opts_(std::move(opts)), delivery_(opts_.queueCapacity) {
+    if (opts_.workers == 0) opts_.workers = 1;
+    for (size_t i = 0; i < opts_.workers; ++i) {
+        workers_.push_back(std::make_unique<Stage<Inbound>>(opts_.queueCapacity));
+    }
+}
+
+Pipeline::~Pipeline() { stop(); }
+
+void Pipeline::start() {
+    if (running_) return;
+    running_ = true;
+    for (auto& w : workers_) {
+        Stage<Inbound>* st = w.get();
+        threads_.emplace_back([this, st]{ workerLoop(*st); });
+    }
+    threads_.emplace_back([this]{ deliveryLoop(); });
+}
+
+void Pipeline::stop() {
+    if (!running_) return;
+    running_ = false;
+    for (auto& w : workers_) { std::lock_guard<std::mutex> l(w->mtx); w->cv.notify_one(); }
+    { std::lock_guard<std::mutex> l(delivery_.mtx); delivery_.cv.notify_one(); }
+    for (auto& t : threads_) if (t.joinable()) t.join();
+    threads_.clear();
+}
+
+bool Pipeline::submit(PacketView&& pkt, const Endpoint& from) {
+    submitted_.fetch_add(1, std::memory_order_relaxed);
+    // sender affinity keeps per-peer order through the parallel stage
+    auto& st = *workers_[PeerIdHash{}(pkt.sender) % workers_.size()];
+    if (st.push(Inbound{std::move(pkt), from})) return true;
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+bool Pipeline::onWorker() const {
+    auto self = std::this_thread::get_id();
+    for (const auto& t : threads_) if (t.get_id() == self) return true;
+    return false;
+}
+
+Pipeline::Stats Pipeline::stats() const {
+    Stats s;
+    s.submitted = submitted_.load(std::memory_order_relaxed);
+    s.dropped = dropped_.load(std::memory_order_relaxed);
+    return s;
+}
+
+template <typename T>
+bool Pipeline::next(Stage<T>& st, T& out) {
+    for (int spin = 0; spin < 64; ++spin) {
+        if (st.q.pop(out)) return true;
+        if (!running_) return false;
+        std::this_thread::yield();
+    }
+    std::unique_lock<std::mutex> lock(st.mtx);
+    st.parked.store(true);
+    while (running_) {
+        if (st.q.pop(out)) { st.parked.store(false); return true; }
+        st.cv.wait_for(lock, std::chrono::milliseconds(50));
+    }
+    st.parked.store(false);
+    return false;
+}
+
+void Pipeline::workerLoop(Stage<Inbound>& st) {
+    Inbound in;
+    while (next(st, in)) {
+        Delivery d;
+        if (!router_.open(in.pkt, in.from, d.plaintext)) continue;
+        d.pkt = std::move(in.pkt);
+        if (!delivery_.push(std::move(d))) dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void Pipeline::deliveryLoop() {
+    Delivery d;
+    while (next(delivery_, d)) {
+        if (opts_.executor) {
+            auto shared = std::make_shared<Delivery>(std::move(d));
+            opts_.executor([this, shared]{ router_.deliver(shared->pkt.sender, shared->plaintext); });
+        } else {
+            router_.deliver(d.pkt.sender, d.plaintext);
+        }
+        d = Delivery{}; // hand the buffer back before parking
+    }
+}
+
+} // namespace p2p
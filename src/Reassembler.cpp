@@ -0,0 +1,109 @@
+#include "p2p/Reassembler.hpp"
+
+#include <cstring>
+#include <iterator>
+
+namespace p2p {
+
+Reassembler::Reassembler(size_t maxBytes, size_t maxPerPeer, std::chrono::milliseconds timeout)
+    : maxBytes_(maxBytes), maxPerPeer_(maxPerPeer), timeout_(timeout) {}
+
+void Reassembler::drop(PeerState& st, std::unordered_map<uint32_t, Partial>::iterator it) {
+    st.bytes -= it->second.bytes;
+    bytes_ -= it->second.bytes;
+    st.partials.erase(it);
+}
+
+bool Reassembler::add(const PeerId& from, ByteView body, BufferRef& out, size_t& len) {
+    if (body.size() <= kHeader) return false;
+    const uint8_t* p = body.data();
+    uint32_t id = (uint32_t(p[0])<<24) | (uint32_t(p[1])<<16) | (uint32_t(p[2])<<8) | p[3];
+    uint16_t index = static_cast<uint16_t>((p[4]<<8) | p[5]);
+    uint16_t count = static_cast<uint16_t>((p[6]<<8) | p[7]);
+    ByteView bytes = body.sub(kHeader);
+    if (count == 0 || index >= count) return false;
+
+    std::lock_guard<std::mutex> lock(mtx_);
+    // a peer's state is only created once one of its fragments is kept
+    auto pit = peers_.find(from);
+    std::unordered_map<uint32_t, Partial>::iterator it;
+    bool known = pit != peers_.end() && (it = pit->second.partials.find(id)) != pit->second.partials.end();
+    size_t cost = bytes.size();
+    if (known) {
+        const Partial& m = it->second;
+        if (m.count != count || !m.pieces[index].empty()) return false; // inconsistent or a duplicate
+    } else {
+        if (pit != peers_.end() && pit->second.partials.size() >= kMaxPartials) {
+            ++dropped_;
+            return false;
+        }
+        // the piece table is charged up front, so a huge count cannot dodge the budget
+        cost += count * sizeof(std::vector<uint8_t>);
+    }
+    size_t held = pit == peers_.end() ? 0 : pit->second.bytes;
+    if (held + cost > maxPerPeer_ || bytes_ + cost > maxBytes_) {
+        ++dropped_;
+        if (known) {
+            // this message can no longer complete; free what it holds
+            drop(pit->second, it);
+            if (pit->second.partials.empty()) peers_.erase(pit);
+        }
+        return false;
+    }
+    if (pit == peers_.end()) pit = peers_.emplace(from, PeerState{}).first;
+    PeerState& st = pit->second;
+    if (!known) {
+        it = st.partials.emplace(id, Partial{}).first;
+        it->second.count = count;
+        it->second.pieces.resize(count);
+    }
+    Partial& m = it->second;
+    m.pieces[index] = bytes.toVector();
+    m.bytes += cost;
+    st.bytes += cost;
+    bytes_ += cost;
+    m.touched = Clock::now();
+    if (++m.got < m.count) return false;
+
+    len = 0;
+    for (const auto& piece : m.pieces) len += piece.size();
+    out = BufferPool::allocate(len);
+    size_t off = 0;
+    for (const auto& piece : m.pieces) {
+        std::memcpy(out.data() + off, piece.data(), piece.size());
+        off += piece.size();
+    }
+    drop(st, it);
+    if (st.partials.empty()) peers_.erase(pit);
+    return true;
+}
+
+void Reassembler::expire() {
+    auto now = Clock::now();
+    std::lock_guard<std::mutex> lock(mtx_);
+    for (auto pit = peers_.begin(); pit != peers_.end();) {
+        PeerState& st = pit->second;
+        for (auto it = st.partials.begin(); it != st.partials.end();) {
+            if (now - it->second.touched > timeout_) {
+                ++dropped_;
+                auto dead = it++;
+                drop(st, dead);
+            } else {
+                ++it;
+            }
+        }
+        pit = st.partials.empty() ? peers_.erase(pit) : std::next(pit);
+    }
+}
+
+size_t Reassembler::pending() const {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return bytes_;
+}
+
+uint64_t Reassembler::dropped() const {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return dropped_;
+}
+
+} // namespace p2p
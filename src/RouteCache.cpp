@@ -0,0 +1,61 @@
+#include "p2p/RouteCache.hpp"
+
+namespace p2p {
+
+RouteCache::RouteCache(size_t capacity, std::chrono::seconds maxAge)
+    : capacity_(capacity ? capacity : 1), maxAge_(maxAge) {}
+
+void RouteCache::put(const PeerId& dest, const Endpoint& hop, bool trusted) {
+    auto now = Clock::now();
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = index_.find(dest);
+    if (it != index_.end()) {
+        Entry& e = *it->second;
+        // a live trusted route is only ever replaced by another
+        if (e.trusted && !trusted && now - e.learned <= maxAge_) return;
+        e.hop = hop;
+        e.learned = now;
+        e.trusted = trusted;
+        lru_.splice(lru_.begin(), lru_, it->second);
+        return;
+    }
+    if (lru_.size() >= capacity_) {
+        index_.erase(lru_.back().dest);
+        lru_.pop_back();
+    }
+    lru_.push_front(Entry{dest, hop, now, trusted});
+    index_[dest] = lru_.begin();
+}
+
+void RouteCache::learn(const PeerId& dest, const Endpoint& hop) { put(dest, hop, true); }
+
+void RouteCache::hint(const PeerId& dest, const Endpoint& hop) { put(dest, hop, false); }
+
+std::optional<RouteCache::Route> RouteCache::lookup(const PeerId& dest) {
+    auto now = Clock::now();
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = index_.find(dest);
+    if (it == index_.end()) return std::nullopt;
+    if (now - it->second->learned > maxAge_) {
+        lru_.erase(it->second);
+        index_.erase(it);
+        return std::nullopt;
+    }
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return Route{it->second->hop, it->second->trusted};
+}
+
+void RouteCache::fail(const PeerId& dest) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = index_.find(dest);
+    if (it == index_.end()) return;
+    lru_.erase(it->second);
+    index_.erase(it);
+}
+
+size_t RouteCache::size() const {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return lru_.size();
+}
+
+} // namespace p2p
@@ -1,71 +1,734 @@
 #include "p2p/Router.hpp"
 
 #include <algorithm>
+#include <cstring>
 #include <sodium.h>
 
 namespace p2p {
 
+static void put32(std::vector<uint8_t>& out, uint32_t v) {
+    out.push_back((v>>24)&0xFF); out.push_back((v>>16)&0xFF); out.push_back((v>>8)&0xFF); out.push_back(v&0xFF);
+}
+
+static uint32_t get32(const uint8_t* p) {
+    return (static_cast<uint32_t>(p[0])<<24) | (static_cast<uint32_t>(p[1])<<16) | (static_cast<uint32_t>(p[2])<<8) | p[3];
+}
+
+static std::vector<uint8_t> framed(Frame f, const std::vector<uint8_t>& data) {
+    std::vector<uint8_t> out;
+    out.reserve(1 + data.size());
+    out.push_back(static_cast<uint8_t>(f));
+    out.insert(out.end(), data.begin(), data.end());
+    return out;
+}
+
 Router::Router(const Identity& self, Transport& transport, PeerDirectory& peers)
-    : self_(self), transport_(transport), peers_(peers) {}
+    : self_(self), transport_(transport), peers_(peers), table_(self.id) {
+    randombytes_buf(digestKey_.data(), digestKey_.size());
+    nextLookup_ = randombytes_random();
+    nextFragment_ = randombytes_random();
+}
+
+uint64_t Router::digest(const PacketView& pkt) const {
+    // keyed SipHash over everything but the ttl: a relay cannot make two
+    // different packets collide, and a copy seen via another path matches
+    uint8_t head[32+32+64+8+8];
+    size_t n = 0;
+    std::memcpy(head+n, pkt.sender.data(), 32); n += 32;
+    std::memcpy(head+n, pkt.dest.data(), 32); n += 32;
+    if (pkt.kind == Packet::Kind::Session) {
+        for (int i = 0; i < 4; ++i) head[n++] = (pkt.session >> (24 - 8*i)) & 0xFF;
+        for (int i = 0; i < 8; ++i) head[n++] = (pkt.counter >> (56 - 8*i)) & 0xFF;
+    } else {
+        std::memcpy(head+n, pkt.signature().data(), 64); n += 64;
+    }
+    crypto_shorthash(head+n, pkt.payload().data(), pkt.payload().size(), digestKey_.data()); n += 8;
+    uint8_t out[8];
+    crypto_shorthash(out, head, n, digestKey_.data());
+    uint64_t d = 0;
+    for (int i = 0; i < 8; ++i) d = (d << 8) | out[i];
+    return d;
+}
 
 void Router::onMessage(MessageHandler cb) { handlers_.push_back(std::move(cb)); }
 void Router::onTypedMessage(TypedHandler cb) { typedHandlers_.push_back(std::move(cb)); }
+void Router::onMessageView(ViewHandler cb) { viewHandlers_.push_back(std::move(cb)); }
+void Router::onTypedMessageView(TypedViewHandler cb) { typedViewHandlers_.push_back(std::move(cb)); }
 
-void Router::handleIncoming(const Packet& pkt, const std::string& fromIp, uint16_t fromPort) {
+void Router::handleIncoming(PacketView& pkt, const Endpoint& from) {
+    if (!admit(pkt, from)) return;
+    ByteView plaintext;
+    if (open(pkt, from, plaintext)) deliver(pkt.sender, plaintext);
+}
+
+bool Router::admit(PacketView& pkt, const Endpoint& from) {
     // update lastSeen for matching addr
-    auto lp = peers_.list();
-    for (auto& p : lp) {
-        if (p.ip == fromIp && p.port == fromPort) {
-            Peer np = p; np.lastSeen = std::chrono::steady_clock::now();
-            peers_.addOrUpdate(np); break;
+    peers_.touch(from);
+
+    // drop our own echoes and anything already seen via another path,
+    // before any verify, decrypt or forward work
+    if (pkt.sender == self_.id) return false;
+    if (!seen_.insert(digest(pkt))) return false;
+
+    // ours: caller opens it, and learns the route once the sender is proven
+    if (pkt.dest == self_.id) return true;
+
+    // not ours and not authenticated: where it came from is only a hint for
+    // forwarding the other way
+    routes_.hint(pkt.sender, from);
+
+    // forward if ttl: the received bytes go out again with only the ttl
+    // byte rewritten (neither the signature nor the AEAD covers it)
+    if (pkt.ttl == 0) return false;
+    pkt.setTtl(pkt.ttl - 1);
+    relay(pkt.dest, pkt.wire(), from);
+    return false;
+}
+
+bool Router::open(PacketView& pkt, const Endpoint& from, ByteView& plaintext) {
+    if (pkt.kind == Packet::Kind::Session) {
+        auto r = sessions_.open(pkt, plaintext);
+        if (r == SessionTable::OpenResult::UnknownSession && peers_.find(pkt.sender)) {
+            // sender holds a session we lost (restart?); tell it so. Anyone
+            // can claim any sender here, so only known peers hear of it, the
+            // table rate-limits it, and the sender challenges us before it resets
+            auto reset = sessions_.resync(pkt.sender, pkt.session);
+            if (!reset.empty()) sendSigned(pkt.sender, reset);
         }
+        if (r != SessionTable::OpenResult::Ok) return false;
+        table_.touch(pkt.sender);
+        // the replay window makes this packet fresh as well as authentic, so
+        // where it came from is a route back that nobody else could have set
+        routes_.learn(pkt.sender, from);
+        return !handleControl(pkt, plaintext);
     }
+    auto sp = peers_.find(pkt.sender);
+    if (!sp) return false; // unknown sender
+    if (!verifyPacket(sp->peer, pkt)) return false; // bad sig
+    // decrypt over the receive buffer: box nonce first, then the plaintext
+    const crypto::SharedKey* key = PeerDirectory::boxKey(*sp, self_.privateKey);
+    if (!key) return false; // no usable box key: refused
+    size_t ptLen = 0;
+    uint8_t* buf = pkt.mutablePayload();
+    if (!crypto::decryptAfternmInPlace(*key, buf, pkt.payload().size(), ptLen)) return false;
+    plaintext = ByteView(buf + crypto_box_NONCEBYTES, ptLen);
+    table_.touch(pkt.sender);
+    // a signed packet may be a recording replayed from anywhere once the seen
+    // cache forgets it, so its arrival hop is only a forwarding hint
+    routes_.hint(pkt.sender, from);
+    return !handleControl(pkt, plaintext);
+}
 
-    // deliver if for me
-    if (pkt.dest == self_.id) {
-        auto sp = peers_.findById(pkt.sender);
-        if (!sp) return; // unknown sender
-        if (!verifyPacket(*sp, pkt)) return; // bad sig
-        auto plaintext = crypto::decrypt(self_.privateKey, sp->publicKey, pkt.payload);
-        // typed first
+void Router::deliver(const PeerId& from, ByteView plaintext) {
+    if (plaintext.empty()) return;
+    if (plaintext[0] == static_cast<uint8_t>(Frame::DATA)) {
+        dispatch(from, plaintext.sub(1));
+        return;
+    }
+    if (plaintext[0] != static_cast<uint8_t>(Frame::BATCH)) return;
+    // BATCH: n*(len u16|message), application messages only
+    size_t off = 1;
+    while (off + 2 <= plaintext.size()) {
+        size_t len = (size_t(plaintext[off]) << 8) | plaintext[off+1];
+        off += 2;
+        if (len == 0 || off + len > plaintext.size()) return;
+        ByteView m = plaintext.sub(off, len);
+        off += len;
+        dispatch(from, m);
+    }
+}
+
+void Router::dispatch(const PeerId& from, ByteView plaintext) {
+    // typed first; view handlers see the receive buffer, vector handlers get a copy
+    MessageType mt; ByteView body;
+    if (unpackMessage(plaintext, mt, body)) {
+        for (auto& h : typedViewHandlers_) h(from, mt, body);
         if (!typedHandlers_.empty()) {
-            MessageType mt; std::vector<uint8_t> body;
-            if (unpackMessage(plaintext, mt, body)) {
-                for (auto& h : typedHandlers_) h(pkt.sender, mt, body);
-            }
+            std::vector<uint8_t> copy = body.toVector();
+            for (auto& h : typedHandlers_) h(from, mt, copy);
         }
-        for (auto& h : handlers_) h(pkt.sender, plaintext);
-        return;
     }
+    for (auto& h : viewHandlers_) h(from, plaintext);
+    if (!handlers_.empty()) {
+        std::vector<uint8_t> copy = plaintext.toVector();
+        for (auto& h : handlers_) h(from, copy);
+    }
+}
 
-    // forward if ttl
-    if (pkt.ttl == 0) return;
-    Packet fwd = pkt; fwd.ttl = pkt.ttl - 1;
-    forward(fwd, fromIp, fromPort);
+bool Router::handleControl(PacketView& pkt, ByteView& plaintext) {
+    if (plaintext.empty()) return true; // not even a frame byte
+    if (plaintext[0] == static_cast<uint8_t>(Frame::FRAGMENT)) {
+        BufferRef whole;
+        size_t len = 0;
+        if (!frags_.add(pkt.sender, plaintext.sub(1), whole, len)) return true;
+        // the reassembled message stands in for the packet from here on
+        pkt.adopt(std::move(whole), len);
+        plaintext = pkt.payload();
+        if (plaintext.empty() || plaintext[0] == static_cast<uint8_t>(Frame::FRAGMENT)) return true;
+    }
+    const PeerId& from = pkt.sender;
+    auto frame = static_cast<Frame>(plaintext[0]);
+    // application messages are left for deliver
+    if (frame == Frame::DATA || frame == Frame::BATCH) return false;
+    std::vector<uint8_t> body = plaintext.sub(1).toVector();
+    switch (frame) {
+    case Frame::SESSION_HELLO: {
+        auto reply = sessions_.accept(from, body);
+        if (!reply.empty()) sendSigned(from, reply);
+        return true;
+    }
+    case Frame::SESSION_ACCEPT:
+        sessions_.complete(from, body);
+        return true;
+    case Frame::SESSION_RESET: {
+        auto reply = sessions_.challenge(from, body);
+        if (!reply.empty()) sendSigned(from, reply);
+        return true;
+    }
+    case Frame::SESSION_CHALLENGE: {
+        auto reply = sessions_.answer(from, body);
+        if (!reply.empty()) sendSigned(from, reply);
+        return true;
+    }
+    case Frame::FIND_NODE:
+        answerFindNode(from, body);
+        return true;
+    case Frame::NODES:
+        handleNodes(from, body);
+        return true;
+    case Frame::MTU_PROBE: {
+        // MTU_PROBE: nonce|size|padding; MTU_ACK: nonce|size
+        if (body.size() < 4+2) return true;
+        std::vector<uint8_t> ack{static_cast<uint8_t>(Frame::MTU_ACK)};
+        ack.insert(ack.end(), body.begin(), body.begin()+6);
+        sendNow(from, ack);
+        return true;
+    }
+    case Frame::MTU_ACK:
+        if (body.size() == 4+2) paths_.acked(from, get32(body.data()), (size_t(body[4])<<8) | body[5]);
+        return true;
+    default:
+        return true; // unknown frame: dropped
+    }
 }
 
-bool Router::forward(const Packet& pkt, const std::string& exceptIp, uint16_t exceptPort) {
-    bool any = false;
-    for (const auto& p : peers_.list()) {
-        if (p.ip == exceptIp && p.port == exceptPort) continue;
-        if (p.ip.empty() || p.port == 0) continue;
-        if (transport_.send(p.ip, p.port, pkt)) any = true;
+bool Router::route(const Peer& dest, const Packet& pkt) {
+    auto bytes = pkt.serialize();
+    return relay(dest.id, bytes, Endpoint{});
+}
+
+bool Router::relay(const PeerId& dest, ByteView wire, const Endpoint& from) {
+    // the path dest's authenticated traffic reaches us by (its address when
+    // it talks to us directly), else its address, else a forwarding hint
+    // (only for packets we relay), else greedy next hop, else flood
+    auto rt = routes_.lookup(dest);
+    if (rt && rt->trusted && rt->hop != from) {
+        if (transport_.sendRaw(rt->hop, wire)) return true;
+        routes_.fail(dest);
+    }
+    auto dr = peers_.find(dest);
+    if (dr && dr->peer.endpoint.valid() && dr->peer.endpoint != from) {
+        if (transport_.sendRaw(dr->peer.endpoint, wire)) return true;
+    }
+    if (rt && !rt->trusted && from.valid() && rt->hop != from) {
+        if (transport_.sendRaw(rt->hop, wire)) return true;
+        routes_.fail(dest);
+    }
+    if (auto nh = nextHop(dest, from)) {
+        if (transport_.sendRaw(nh->peer.endpoint, wire)) return true;
     }
-    return any;
+    return forward(wire, from);
 }
 
-bool Router::sendMessage(const PeerId& dest, const std::vector<uint8_t>& data) {
-    auto dp = peers_.findById(dest);
-    if (!dp) return false; // need target
+PeerDirectory::RecordPtr Router::nextHop(const PeerId& dest, const Endpoint& except) {
+    for (const auto& id : table_.closest(dest, RoutingTable::kBucketSize)) {
+        // only ever hand a packet to someone strictly closer than us, so it cannot loop
+        if (!RoutingTable::closer(dest, id, self_.id)) break;
+        auto r = peers_.find(id);
+        if (!r) { table_.remove(id); continue; }
+        if (!r->peer.endpoint.valid() || r->peer.endpoint == except) continue;
+        return r;
+    }
+    return nullptr;
+}
 
+bool Router::sendSigned(const PeerId& dest, const std::vector<uint8_t>& data) {
+    auto dr = peers_.find(dest);
+    if (!dr) return false;
+    const crypto::SharedKey* key = PeerDirectory::boxKey(*dr, self_.privateKey);
+    if (!key) return false;
+    return route(dr->peer, seal(dest, *key, data));
+}
+
+bool Router::forward(ByteView wire, const Endpoint& except) {
+    // one buffer, one sendmmsg per batch of neighbours; the address list is reused per thread
+    thread_local std::vector<Endpoint> dests;
+    dests.clear();
+    auto snap = peers_.snapshot();
+    for (const auto& [addr, r] : snap->byAddr) {
+        if (addr == except) continue;
+        dests.push_back(addr);
+    }
+    if (dests.empty()) return false;
+    return transport_.sendBatch(dests, wire) > 0;
+}
+
+Packet Router::seal(const PeerId& dest, const crypto::SharedKey& key, const std::vector<uint8_t>& data) const {
     // encrypt for dest
-    auto ct = crypto::encrypt(self_.privateKey, dp->publicKey, data);
+    auto ct = crypto::encryptAfternm(key, data);
     Packet pkt{}; pkt.sender = self_.id; pkt.dest = dest; pkt.ttl = 8; pkt.payload = std::move(ct);
     pkt.signature = signPacket(self_, pkt);
+    return pkt;
+}
+
+size_t Router::room(const PeerId& dest) const {
+    size_t over = sessions_.active(dest) ? Packet::kSessionOverhead : Packet::kSignedOverhead;
+    return paths_.mtu(dest) - over;
+}
+
+size_t Router::maxPayload(const PeerId& dest) const {
+    return room(dest) - kFrameBytes;
+}
 
-    // try direct else flood
-    if (transport_.send(dp->ip, dp->port, pkt)) return true;
-    return forward(pkt, "", 0);
+void Router::fragment(const std::vector<uint8_t>& data, size_t room, std::vector<std::vector<uint8_t>>& out) {
+    // FRAGMENT: id|index|count|bytes; pieces are near-equal so none is a runt
+    const size_t cap = room - 1 - Reassembler::kHeader;
+    const size_t count = (data.size() + cap - 1) / cap;
+    const size_t piece = (data.size() + count - 1) / count;
+    const uint32_t id = nextFragment_.fetch_add(1, std::memory_order_relaxed);
+    for (size_t i = 0; i < count; ++i) {
+        size_t off = i * piece, len = std::min(piece, data.size() - off);
+        std::vector<uint8_t> msg;
+        msg.reserve(1 + Reassembler::kHeader + len);
+        msg.push_back(static_cast<uint8_t>(Frame::FRAGMENT));
+        put32(msg, id);
+        msg.push_back((i>>8)&0xFF); msg.push_back(i&0xFF);
+        msg.push_back((count>>8)&0xFF); msg.push_back(count&0xFF);
+        msg.insert(msg.end(), data.begin() + off, data.begin() + off + len);
+        out.push_back(std::move(msg));
+    }
+}
+
+bool Router::sendMessage(const PeerId& dest, const std::vector<uint8_t>& data) {
+    return send(dest, data) == SendResult::Sent;
+}
+
+SendResult Router::send(const PeerId& dest, const std::vector<uint8_t>& data) {
+    if (coalescing_.load(std::memory_order_acquire)) {
+        if (!data.empty()) return park(dest, data);
+        // an empty message has no place in a batch; it goes after what is parked
+        SendResult r = flushPeer(dest);
+        if (r != SendResult::Sent) return r;
+    }
+    return sendNow(dest, framed(Frame::DATA, data));
+}
+
+SendResult Router::sendNow(const PeerId& dest, const std::vector<uint8_t>& data) {
+    auto dr = peers_.find(dest);
+    if (!dr) return SendResult::NoRoute; // need target
+    const crypto::SharedKey* key = PeerDirectory::boxKey(*dr, self_.privateKey);
+    if (!key) return SendResult::NoRoute; // its public key is unusable
+    // the transport's overflow queue is full: say so instead of trying every other path
+    if (transport_.full()) return SendResult::QueueFull;
+    paths_.use(dest);
+    if (data.size() > room(dest)) {
+        if (data.size() > kFrameBytes + kMaxMessage) return SendResult::TooLarge;
+        std::vector<std::vector<uint8_t>> parts;
+        fragment(data, room(dest), parts);
+        return sendAll(dest, parts);
+    }
+
+    Packet pkt{};
+    if (!sessions_.seal(self_.id, dest, data, pkt)) {
+        // unknown peer or handshake pending: signed format
+        pkt = seal(dest, *key, data);
+        if (sessionsEnabled_) {
+            auto hello = sessions_.initiate(dest);
+            if (!hello.empty()) route(dr->peer, seal(dest, *key, hello));
+        }
+    }
+    if (route(dr->peer, pkt)) return SendResult::Sent;
+    return transport_.full() ? SendResult::QueueFull : SendResult::NoRoute;
+}
+
+bool Router::sendMessages(const PeerId& dest, const std::vector<std::vector<uint8_t>>& batch) {
+    return send(dest, batch) == SendResult::Sent;
+}
+
+SendResult Router::send(const PeerId& dest, const std::vector<std::vector<uint8_t>>& batch, size_t* taken) {
+    if (taken) *taken = 0;
+    // whatever is parked for dest is sent first, or this waits behind it
+    if (coalescing_.load(std::memory_order_acquire)) {
+        SendResult r = flushPeer(dest);
+        if (r != SendResult::Sent) return r;
+    }
+    std::vector<std::vector<uint8_t>> msgs;
+    msgs.reserve(batch.size());
+    for (const auto& data : batch) msgs.push_back(framed(Frame::DATA, data));
+    return sendAll(dest, msgs, taken);
+}
+
+SendResult Router::sendAll(const PeerId& dest, const std::vector<std::vector<uint8_t>>& batch, size_t* taken) {
+    if (taken) *taken = 0;
+    auto dr = peers_.find(dest);
+    if (!dr) return SendResult::NoRoute; // need target
+    const crypto::SharedKey* key = PeerDirectory::boxKey(*dr, self_.privateKey);
+    if (!key) return SendResult::NoRoute; // its public key is unusable
+    if (transport_.full()) return SendResult::QueueFull;
+    const Peer* dp = &dr->peer;
+    paths_.use(dest);
+
+    if (sessionsEnabled_) {
+        auto hello = sessions_.initiate(dest);
+        if (!hello.empty()) route(*dp, seal(dest, *key, hello));
+    }
+
+    // oversized messages are swapped for their fragments, in place in the order
+    const size_t room = this->room(dest);
+    const std::vector<std::vector<uint8_t>>* items = &batch;
+    std::vector<std::vector<uint8_t>> split;
+    std::vector<size_t> owner; // split: the message each packet belongs to
+    if (std::any_of(batch.begin(), batch.end(), [&](const std::vector<uint8_t>& d){ return d.size() > room; })) {
+        for (size_t m = 0; m < batch.size(); ++m) {
+            const auto& data = batch[m];
+            if (data.size() > kFrameBytes + kMaxMessage) return SendResult::TooLarge;
+            if (data.size() > room) fragment(data, room, split); else split.push_back(data);
+            owner.resize(split.size(), m);
+        }
+        items = &split;
+    }
+    // a message cut short counts as not handed over
+    auto upTo = [&](size_t pkt){ if (taken) *taken = owner.empty() ? pkt : owner[pkt]; };
+
+    std::vector<Packet> pkts;
+    pkts.reserve(items->size());
+    std::vector<Transport::Datagram> out;
+    out.reserve(items->size());
+    for (const auto& data : *items) {
+        Packet pkt{};
+        if (!sessions_.seal(self_.id, dest, data, pkt)) pkt = seal(dest, *key, data);
+        pkts.push_back(std::move(pkt));
+        out.push_back({dp->endpoint, pkts.back().serialize()});
+    }
+
+    // try direct else route whatever did not go out
+    std::vector<size_t> unsent;
+    if (dp->endpoint.valid()) transport_.sendBatch(out, &unsent);
+    else for (size_t i = 0; i < pkts.size(); ++i) unsent.push_back(i);
+    for (size_t i : unsent) {
+        if (transport_.full()) { upTo(i); return SendResult::QueueFull; }
+        if (!route(*dp, pkts[i])) { upTo(i); return SendResult::NoRoute; }
+    }
+    if (taken) *taken = batch.size();
+    return SendResult::Sent;
+}
+
+void Router::enableCoalescing(CoalesceOptions opts) {
+    {
+        std::lock_guard<std::mutex> lock(batchMtx_);
+        coalesce_ = opts;
+    }
+    coalescing_.store(true, std::memory_order_release);
+}
+
+void Router::disableCoalescing() {
+    coalescing_.store(false, std::memory_order_release);
+    flushMessages();
+}
+
+SendResult Router::park(const PeerId& dest, const std::vector<uint8_t>& data) {
+    if (!timer_) return sendNow(dest, framed(Frame::DATA, data));
+    if (!peers_.find(dest)) return SendResult::NoRoute; // need target
+    const size_t room = this->room(dest);
+    for (;;) {
+        bool alone = false, full = false;
+        uint64_t gen = 0;
+        std::chrono::milliseconds deadline{};
+        {
+            std::lock_guard<std::mutex> lock(batchMtx_);
+            const size_t limit = coalesce_.maxBytes ? std::min(coalesce_.maxBytes, room) : room;
+            deadline = coalesce_.deadline;
+            alone = 1 + 2 + data.size() > limit; // too big to share a packet
+            auto it = batches_.find(dest);
+            full = it != batches_.end() && it->second.frames && it->second.bytes.size() + 2 + data.size() > limit;
+            if (!alone && !full) {
+                if (it == batches_.end()) it = batches_.emplace(dest, Batch{}).first;
+                Batch& b = it->second;
+                if (b.frames == 0) {
+                    b.bytes.reserve(limit);
+                    b.bytes.push_back(static_cast<uint8_t>(Frame::BATCH));
+                    b.gen = gen = ++batchGen_;
+                }
+                b.bytes.push_back((data.size()>>8)&0xFF); b.bytes.push_back(data.size()&0xFF);
+                b.bytes.insert(b.bytes.end(), data.begin(), data.end());
+                b.frames++;
+            }
+        }
+        if (alone || full) {
+            // what is parked goes first; if it cannot, neither can this
+            SendResult r = flushPeer(dest);
+            if (r != SendResult::Sent) return r;
+            if (alone) return sendNow(dest, framed(Frame::DATA, data));
+            continue;
+        }
+        // a new batch: flush it at its deadline unless it fills up first
+        if (gen) timer_(deadline, [this, dest, gen]{ flushPeer(dest, gen); });
+        return SendResult::Sent;
+    }
+}
+
+SendResult Router::flushPeer(const PeerId& dest, uint64_t gen) {
+    // waits out a flush of dest already under way, which took older messages
+    std::lock_guard<std::mutex> order(flushMtx_);
+    std::deque<std::vector<uint8_t>> out;
+    {
+        std::lock_guard<std::mutex> lock(batchMtx_);
+        auto it = batches_.find(dest);
+        if (it == batches_.end() || (gen && it->second.gen != gen)) return SendResult::Sent;
+        Batch& b = it->second;
+        out = std::move(b.stuck);
+        // a lone message goes out as plain DATA, in place of its length's low byte
+        if (b.frames == 1) {
+            out.emplace_back(b.bytes.begin() + 2, b.bytes.end());
+            out.back()[0] = static_cast<uint8_t>(Frame::DATA);
+        } else if (b.frames) out.push_back(std::move(b.bytes));
+        batches_.erase(it);
+    }
+    SendResult r = SendResult::Sent;
+    while (!out.empty() && (r = sendNow(dest, out.front())) == SendResult::Sent) out.pop_front();
+    // no route or too large: those are lost either way
+    if (r != SendResult::QueueFull || !timer_) return r;
+    // the transport is full: keep the rest ahead of whatever was parked since and try again later
+    uint64_t retry = 0;
+    std::chrono::milliseconds deadline{};
+    {
+        std::lock_guard<std::mutex> lock(batchMtx_);
+        Batch& b = batches_[dest];
+        for (auto i = out.rbegin(); i != out.rend(); ++i) b.stuck.push_front(std::move(*i));
+        b.gen = retry = ++batchGen_;
+        deadline = coalesce_.deadline;
+    }
+    timer_(deadline, [this, dest, retry]{ flushPeer(dest, retry); });
+    return r;
+}
+
+void Router::flushMessages() {
+    std::vector<PeerId> dests;
+    {
+        std::lock_guard<std::mutex> lock(batchMtx_);
+        dests.reserve(batches_.size());
+        for (const auto& [dest, b] : batches_) dests.push_back(dest);
+    }
+    for (const auto& dest : dests) flushPeer(dest);
+}
+
+bool Router::probePath(const PeerId& dest) {
+    sendProbes(paths_.kick(dest));
+    return paths_.searching(dest);
+}
+
+void Router::sendProbes(const std::vector<PathMtu::Probe>& probes) {
+    for (const auto& pr : probes) {
+        // direct only: a probe that dies must not be retried through a relay or flooded
+        auto dr = peers_.find(pr.peer);
+        if (!dr || !dr->peer.endpoint.valid()) continue;
+        std::vector<uint8_t> msg{static_cast<uint8_t>(Frame::MTU_PROBE)};
+        put32(msg, pr.nonce);
+        msg.push_back((pr.size>>8)&0xFF); msg.push_back(pr.size&0xFF);
+        // padded so the sealed datagram is exactly the size under test
+        Packet pkt{};
+        msg.resize(pr.size - Packet::kSessionOverhead, 0);
+        if (!sessions_.seal(self_.id, pr.peer, msg, pkt)) {
+            msg.resize(pr.size - Packet::kSignedOverhead);
+            const crypto::SharedKey* key = PeerDirectory::boxKey(*dr, self_.privateKey);
+            if (!key) continue;
+            pkt = seal(pr.peer, *key, msg);
+        }
+        transport_.sendRaw(dr->peer.endpoint, pkt.serialize());
+    }
+}
+
+static std::vector<uint8_t> findNodeMsg(uint32_t lookup, const PeerId& target) {
+    // FIND_NODE: lookup|target
+    std::vector<uint8_t> msg;
+    msg.reserve(1+4+32);
+    msg.push_back(static_cast<uint8_t>(Frame::FIND_NODE));
+    put32(msg, lookup);
+    msg.insert(msg.end(), target.begin(), target.end());
+    return msg;
+}
+
+void Router::answerFindNode(const PeerId& from, const std::vector<uint8_t>& body) {
+    if (body.size() != 4+32) return;
+    PeerId target{};
+    std::copy(body.begin()+4, body.end(), target.begin());
+    // NODES: lookup|n|n*(id|boxPub|signPub|family|addr(4 or 16)|port)
+    std::vector<uint8_t> msg;
+    msg.push_back(static_cast<uint8_t>(Frame::NODES));
+    msg.insert(msg.end(), body.begin(), body.begin()+4);
+    msg.push_back(0);
+    uint8_t n = 0;
+    for (const auto& id : table_.closest(target, RoutingTable::kBucketSize)) {
+        if (id == from) continue;
+        auto r = peers_.find(id);
+        if (!r || !r->peer.endpoint.valid()) continue;
+        const Peer* p = &r->peer;
+        msg.insert(msg.end(), p->id.begin(), p->id.end());
+        msg.insert(msg.end(), p->publicKey.begin(), p->publicKey.end());
+        msg.insert(msg.end(), p->signPublic.begin(), p->signPublic.end());
+        const Endpoint& ep = p->endpoint;
+        msg.push_back(static_cast<uint8_t>(ep.family));
+        msg.insert(msg.end(), ep.addr.begin(), ep.addr.begin() + ep.addrLen());
+        msg.push_back((ep.port>>8)&0xFF); msg.push_back(ep.port&0xFF);
+        ++n;
+    }
+    msg[5] = n;
+    sendNow(from, msg);
+}
+
+void Router::handleNodes(const PeerId& from, const std::vector<uint8_t>& body) {
+    if (body.size() < 4+1) return;
+    uint32_t lookup = get32(body.data());
+    size_t n = body[4], off = 5;
+    struct Contact {
+        PeerId id;
+        KeyBytes boxPub;
+        SignPublic signPub;
+        Endpoint ep;
+    };
+    std::vector<Contact> contacts;
+    std::vector<PeerId> found;
+    // a link-local address only means something on the link the reply came over
+    uint32_t scope = 0;
+    if (auto r = peers_.find(from)) scope = r->peer.endpoint.scope;
+    for (size_t i = 0; i < n; ++i) {
+        if (off + 32*3 + 1 > body.size()) return;
+        PeerId id{}; KeyBytes boxPub{}; SignPublic signPub{};
+        std::copy(body.begin()+off, body.begin()+off+32, id.begin()); off += 32;
+        std::copy(body.begin()+off, body.begin()+off+32, boxPub.begin()); off += 32;
+        std::copy(body.begin()+off, body.begin()+off+32, signPub.begin()); off += 32;
+        uint8_t family = body[off++];
+        size_t addrLen = family == 4 ? 4 : family == 6 ? 16 : 0;
+        if (addrLen == 0 || off + addrLen + 2 > body.size()) return;
+        const uint8_t* addr = body.data() + off; off += addrLen;
+        uint16_t port = static_cast<uint16_t>((body[off]<<8) | body[off+1]); off += 2;
+        bool linkLocal = family == 6 && addr[0] == 0xFE && (addr[1] & 0xC0) == 0x80;
+        Endpoint ep = family == 4 ? Endpoint::v4(addr, port) : Endpoint::v6(addr, port, linkLocal ? scope : 0);
+        if (id == self_.id) continue;
+        // ids are hash(box key): a third party cannot pair an id with other keys
+        PeerId check{};
+        crypto_generichash(check.data(), check.size(), boxPub.data(), boxPub.size(), nullptr, 0);
+        if (check != id) continue;
+        contacts.push_back(Contact{id, boxPub, signPub, ep});
+        found.push_back(id);
+    }
+
+    std::vector<std::pair<PeerId, std::vector<uint8_t>>> sends;
+    LookupHandler done;
+    PeerId target{};
+    std::vector<PeerId> result;
+    {
+        std::lock_guard<std::mutex> lock(lookupMtx_);
+        auto it = lookups_.find(lookup);
+        if (it == lookups_.end()) return;
+        Lookup& lk = it->second;
+        if (!lk.inflight.erase(from)) return; // unsolicited
+        for (const auto& id : found) {
+            if (std::find(lk.shortlist.begin(), lk.shortlist.end(), id) == lk.shortlist.end()) lk.shortlist.push_back(id);
+        }
+        auto cmp = [&](const PeerId& a, const PeerId& b){ return RoutingTable::closer(lk.target, a, b); };
+        std::sort(lk.shortlist.begin(), lk.shortlist.end(), cmp);
+        if (lk.shortlist.size() > RoutingTable::kBucketSize) lk.shortlist.resize(RoutingTable::kBucketSize);
+        if (step(lookup, lk, sends)) {
+            done = std::move(lk.done); target = lk.target; result = std::move(lk.shortlist);
+            lookups_.erase(it);
+        }
+    }
+    // only a reply we asked for teaches contacts. New ones get our beacon so
+    // they will answer us, but at most kMaxIntros per reply and one per host:
+    // the addresses are the replier's word, and must not let it aim our
+    // beacons at a third party
+    std::vector<Endpoint> introduced;
+    for (const auto& c : contacts) {
+        // never let a third party rewrite what we already know about a peer
+        if (peers_.find(c.id)) continue;
+        peers_.upsertAddrAndKeys(c.id, c.ep, c.boxPub, c.signPub);
+        if (!intro_ || introduced.size() >= kMaxIntros) continue;
+        if (std::any_of(introduced.begin(), introduced.end(), [&](const Endpoint& e){ return e.sameHost(c.ep); })) continue;
+        introduced.push_back(c.ep);
+        intro_(c.ep);
+    }
+    for (auto& [to, msg] : sends) sendNow(to, msg);
+    if (done) done(target, result);
+}
+
+bool Router::step(uint32_t id, Lookup& lk, std::vector<std::pair<PeerId, std::vector<uint8_t>>>& sends) {
+    auto now = Clock::now();
+    for (const auto& pid : lk.shortlist) {
+        if (lk.inflight.size() >= kAlpha) break;
+        if (!lk.queried.insert(pid).second) continue;
+        lk.inflight[pid] = now;
+        sends.emplace_back(pid, findNodeMsg(id, lk.target));
+    }
+    return lk.inflight.empty();
+}
+
+void Router::findNode(const PeerId& target, LookupHandler done) {
+    std::vector<std::pair<PeerId, std::vector<uint8_t>>> sends;
+    bool finished = false;
+    std::vector<PeerId> result;
+    {
+        std::lock_guard<std::mutex> lock(lookupMtx_);
+        uint32_t id = nextLookup_++;
+        Lookup& lk = lookups_[id];
+        lk.target = target;
+        lk.started = Clock::now();
+        lk.shortlist = table_.closest(target, RoutingTable::kBucketSize);
+        lk.done = done;
+        if (step(id, lk, sends)) {
+            finished = true;
+            result = std::move(lk.shortlist);
+            lookups_.erase(id);
+        }
+    }
+    for (auto& [to, msg] : sends) sendNow(to, msg);
+    if (finished && done) done(target, result);
+}
+
+void Router::notePeer(const PeerId& id) { table_.touch(id); }
+
+void Router::maintain() {
+    std::vector<std::pair<PeerId, std::vector<uint8_t>>> sends;
+    std::vector<std::pair<LookupHandler, std::pair<PeerId, std::vector<PeerId>>>> finished;
+    bool bootstrap = false;
+    {
+        std::lock_guard<std::mutex> lock(lookupMtx_);
+        auto now = Clock::now();
+        for (auto it = lookups_.begin(); it != lookups_.end();) {
+            Lookup& lk = it->second;
+            // unanswered queries count as failures; move on to the next candidates
+            for (auto q = lk.inflight.begin(); q != lk.inflight.end();) {
+                if (now - q->second > std::chrono::seconds(2)) q = lk.inflight.erase(q); else ++q;
+            }
+            bool over = now - lk.started > std::chrono::seconds(30) || step(it->first, lk, sends);
+            if (over) {
+                finished.push_back({std::move(lk.done), {lk.target, std::move(lk.shortlist)}});
+                it = lookups_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        if (!bootstrapped_ && table_.size() > 0) bootstrap = bootstrapped_ = true;
+    }
+    for (auto& [to, msg] : sends) sendNow(to, msg);
+    for (auto& [cb, res] : finished) if (cb) cb(res.first, res.second);
+
+    // join: look ourselves up once we know anyone; then keep quiet buckets fresh
+    if (bootstrap) findNode(self_.id);
+    for (const auto& t : table_.staleBucketTargets(std::chrono::minutes(10))) findNode(t);
+
+    sendProbes(paths_.due());
+    frags_.expire();
 }
 
 std::array<uint8_t,64> Router::signPacket(const Identity& self, const Packet& pkt) {
@@ -89,4 +752,15 @@ bool Router::verifyPacket(const Peer& senderPeer, const Packet& pkt) {
     return crypto::verify(senderPeer.signPublic, m, sig);
 }
 
+bool Router::verifyPacket(const Peer& senderPeer, const PacketView& pkt) {
+    // the signed bytes are not contiguous on the wire; reuse one scratch buffer per thread
+    thread_local std::vector<uint8_t> m;
+    auto pl = pkt.payload();
+    m.resize(32+32+pl.size());
+    std::memcpy(m.data(), pkt.sender.data(), 32);
+    std::memcpy(m.data()+32, pkt.dest.data(), 32);
+    std::memcpy(m.data()+64, pl.data(), pl.size());
+    return crypto_sign_verify_detached(pkt.signature().data(), m.data(), m.size(), senderPeer.signPublic.data()) == 0;
+}
+
 } // namespace p2p
@@ -0,0 +1,104 @@
+#include "p2p/RoutingTable.hpp"
+
+#include <sodium.h>
+#include <algorithm>
+
+namespace p2p {
+
+RoutingTable::RoutingTable(const PeerId& self) : self_(self) {}
+
+size_t RoutingTable::commonPrefix(const PeerId& a, const PeerId& b) {
+    for (size_t i = 0; i < a.size(); ++i) {
+        uint8_t x = a[i] ^ b[i];
+        if (x == 0) continue;
+        size_t bits = 0;
+        while (!(x & 0x80)) { x <<= 1; ++bits; }
+        return i * 8 + bits;
+    }
+    return a.size() * 8;
+}
+
+bool RoutingTable::closer(const PeerId& target, const PeerId& a, const PeerId& b) {
+    for (size_t i = 0; i < target.size(); ++i) {
+        uint8_t da = a[i] ^ target[i], db = b[i] ^ target[i];
+        if (da != db) return da < db;
+    }
+    return false;
+}
+
+void RoutingTable::touch(const PeerId& id) {
+    size_t idx = commonPrefix(self_, id);
+    if (idx >= kBuckets) return; // ourselves
+    auto now = Clock::now();
+    std::lock_guard<std::mutex> lock(mtx_);
+    Bucket& b = buckets_[idx];
+    b.touched = now;
+    auto it = std::find_if(b.entries.begin(), b.entries.end(), [&](const Entry& e){ return e.id == id; });
+    if (it != b.entries.end()) {
+        b.entries.erase(it);
+    } else if (b.entries.size() >= kBucketSize) {
+        // Kademlia keeps long-lived peers; only evict one that went quiet
+        if (now - b.entries.front().seen < kQuiet) return;
+        b.entries.pop_front();
+    }
+    b.entries.push_back(Entry{id, now});
+}
+
+void RoutingTable::remove(const PeerId& id) {
+    size_t idx = commonPrefix(self_, id);
+    if (idx >= kBuckets) return;
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto& es = buckets_[idx].entries;
+    es.erase(std::remove_if(es.begin(), es.end(), [&](const Entry& e){ return e.id == id; }), es.end());
+}
+
+std::vector<PeerId> RoutingTable::closest(const PeerId& target, size_t n) const {
+    std::vector<PeerId> out;
+    {
+        // by XOR metric: bucket c (c = prefix shared by target and us) is
+        // nearest, then every deeper bucket, then shallower ones in turn
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto take = [&](size_t i){ for (const auto& e : buckets_[i].entries) out.push_back(e.id); };
+        size_t c = std::min(commonPrefix(self_, target), kBuckets - 1);
+        take(c);
+        if (out.size() < n) for (size_t i = c + 1; i < kBuckets; ++i) take(i);
+        for (size_t i = c; i-- > 0 && out.size() < n;) take(i);
+    }
+    auto cmp = [&](const PeerId& a, const PeerId& b){ return closer(target, a, b); };
+    if (out.size() > n) {
+        std::nth_element(out.begin(), out.begin() + n, out.end(), cmp);
+        out.resize(n);
+    }
+    std::sort(out.begin(), out.end(), cmp);
+    return out;
+}
+
+std::vector<PeerId> RoutingTable::staleBucketTargets(std::chrono::seconds maxAge) {
+    std::vector<PeerId> out;
+    auto now = Clock::now();
+    std::lock_guard<std::mutex> lock(mtx_);
+    for (size_t i = 0; i < kBuckets; ++i) {
+        Bucket& b = buckets_[i];
+        if (b.entries.empty() || now - b.touched < maxAge) continue;
+        b.touched = now;
+        // keep our first i bits, flip bit i, randomise the rest
+        PeerId t{};
+        randombytes_buf(t.data(), t.size());
+        size_t byte = i / 8, bit = i % 8;
+        for (size_t k = 0; k < byte; ++k) t[k] = self_[k];
+        uint8_t keep = static_cast<uint8_t>(0xFF00 >> bit); // bits above `bit`
+        uint8_t flip = static_cast<uint8_t>(0x80 >> bit);
+        t[byte] = (self_[byte] & keep) | (~self_[byte] & flip) | (t[byte] & ~(keep | flip));
+        out.push_back(t);
+    }
+    return out;
+}
+
+size_t RoutingTable::size() const {
+    std::lock_guard<std::mutex> lock(mtx_);
+    size_t n = 0;
+    for (const auto& b : buckets_) n += b.entries.size();
+    return n;
+}
+
+} // namespace p2p
@@ -0,0 +1,55 @@
+#include "p2p/SeenCache.hpp"
+
+#include <algorithm>
+
+namespace p2p {
+
+SeenCache::SeenCache(size_t capacity, std::chrono::seconds window)
+    : perGen_(capacity / kStripes / 2 + 1), half_(window / 2) {
+    size_t n = 2;
+    while (n < perGen_ * 2) n <<= 1;
+    for (auto& st : stripes_) {
+        st.cur.slots.assign(n, 0);
+        st.prev.slots.assign(n, 0);
+    }
+}
+
+bool SeenCache::Gen::contains(uint64_t d) const {
+    size_t mask = slots.size() - 1;
+    // low bits already picked the stripe
+    for (size_t i = (d >> 4) & mask;; i = (i + 1) & mask) {
+        if (slots[i] == d) return true;
+        if (slots[i] == 0) return false;
+    }
+}
+
+void SeenCache::Gen::insert(uint64_t d) {
+    size_t mask = slots.size() - 1;
+    size_t i = (d >> 4) & mask;
+    while (slots[i] != 0) i = (i + 1) & mask;
+    slots[i] = d;
+    ++count;
+}
+
+void SeenCache::Gen::clear() {
+    std::fill(slots.begin(), slots.end(), 0);
+    count = 0;
+}
+
+bool SeenCache::insert(uint64_t digest) {
+    if (digest == 0) digest = 1; // 0 marks empty slots
+    // low bits pick the stripe, the tables probe on the rest
+    Stripe& st = stripes_[digest % kStripes];
+    std::lock_guard<std::mutex> lock(st.mtx);
+    if (st.cur.contains(digest) || st.prev.contains(digest)) return false;
+    auto now = Clock::now();
+    if (st.cur.count >= perGen_ || now - st.rotated >= half_) {
+        std::swap(st.prev, st.cur);
+        st.cur.clear();
+        st.rotated = now;
+    }
+    st.cur.insert(digest);
+    return true;
+}
+
+} // namespace p2p
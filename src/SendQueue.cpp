@@ -0,0 +1,232 @@
+#include "p2p/SendQueue.hpp"
+
+#include <algorithm>
+
+namespace p2p {
+
+SendQueue::SendQueue(Options opts) : opts_(std::move(opts)) {
+    if (opts_.highWatermark > opts_.maxBytes) opts_.highWatermark = opts_.maxBytes;
+    if (opts_.lowWatermark > opts_.highWatermark) opts_.lowWatermark = opts_.highWatermark;
+    // a tiny quantum only makes a large message take more turns to earn
+    for (auto& q : opts_.quantum) q = std::max<size_t>(q, 512);
+    if (opts_.burst == 0) opts_.burst = 1;
+}
+
+SendClass SendQueue::classify(MessageType type) {
+    switch (type) {
+    case MessageType::FILE_CHUNK:
+    case MessageType::FILE_COPY:
+    case MessageType::FILE_SIGS:
+        return SendClass::Bulk;
+    default:
+        // file-transfer protocol and router messages are small and gate progress
+        return static_cast<uint8_t>(type) >= static_cast<uint8_t>(MessageType::FILE_COPY)
+            ? SendClass::Control : SendClass::Interactive;
+    }
+}
+
+uint64_t SendQueue::rateOf(const PeerId& peer, size_t cls) const {
+    auto it = rates_.find(peer);
+    return it == rates_.end() ? opts_.peerRate[cls] : it->second[cls];
+}
+
+SendQueue::PeerQueue& SendQueue::queueFor(const PeerId& peer, Clock::time_point now) {
+    prune(now);
+    auto [it, fresh] = queues_.try_emplace(peer);
+    if (fresh) for (auto& b : it->second.buckets) b = Bucket{double(opts_.burst), now};
+    return it->second;
+}
+
+bool SendQueue::ready(const PeerId& peer, PeerQueue& q, size_t cls, Clock::time_point now, Clock::duration& wait) {
+    uint64_t rate = rateOf(peer, cls);
+    if (rate == 0) return true;
+    Bucket& b = q.buckets[cls];
+    double secs = std::chrono::duration<double>(now - b.at).count();
+    b.tokens = std::min(double(opts_.burst), b.tokens + secs * double(rate));
+    b.at = now;
+    if (b.tokens > 0) return true;
+    // in debt from the last message; back once it is paid off
+    auto until = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>((1 - b.tokens) / double(rate)));
+    wait = std::min(wait, until);
+    return false;
+}
+
+bool SendQueue::settled(const PeerId& peer, const PeerQueue& q, Clock::time_point now) const {
+    for (size_t c = 0; c < kClasses; ++c) {
+        uint64_t rate = rateOf(peer, c);
+        if (!rate) continue;
+        const Bucket& b = q.buckets[c];
+        if (b.tokens + std::chrono::duration<double>(now - b.at).count() * double(rate) < double(opts_.burst)) return false;
+    }
+    return true;
+}
+
+void SendQueue::release(const PeerId& peer, Clock::time_point now) {
+    auto it = queues_.find(peer);
+    if (it == queues_.end()) return;
+    PeerQueue& q = it->second;
+    for (const auto& items : q.items) if (!items.empty()) return;
+    if (settled(peer, q, now)) {
+        queues_.erase(it);
+    } else if (!q.idle) {
+        // a rate-limited peer is kept while it owes tokens, so that emptying
+        // the queue does not hand it a fresh burst; prune drops it later
+        q.idle = true;
+        idle_.push_back(peer);
+    }
+}
+
+void SendQueue::prune(Clock::time_point now) {
+    if (idle_.empty() || now - prunedAt_ < kPrune) return;
+    prunedAt_ = now;
+    for (size_t n = idle_.size(); n > 0; --n) {
+        PeerId peer = idle_.front();
+        idle_.pop_front();
+        auto it = queues_.find(peer);
+        if (it == queues_.end()) continue;
+        PeerQueue& q = it->second;
+        q.idle = false;
+        bool empty = std::all_of(q.items.begin(), q.items.end(), [](const auto& d){ return d.empty(); });
+        // busy again: pop releases it once it empties
+        if (!empty) continue;
+        if (settled(peer, q, now)) queues_.erase(it);
+        else { q.idle = true; idle_.push_back(peer); }
+    }
+}
+
+bool SendQueue::push(const PeerId& peer, std::vector<uint8_t>& data, Completion& done, SendClass cls) {
+    if (cls == SendClass::Auto)
+        cls = data.empty() ? SendClass::Interactive : classify(static_cast<MessageType>(data[0]));
+    const size_t c = static_cast<size_t>(cls);
+    bool crossed = false;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        PeerQueue& q = queueFor(peer, Clock::now());
+        bool empty = std::all_of(q.items.begin(), q.items.end(), [](const auto& d){ return d.empty(); });
+        // an empty queue takes any one message, so a large one is never refused for good
+        if (!empty && q.bytes + data.size() > opts_.maxBytes) return false;
+        if (q.items[c].empty()) turn_[c].push_back(peer);
+        q.bytes += data.size();
+        bytes_ += data.size();
+        q.items[c].push_back(Item{peer, std::move(data), std::move(done), cls});
+        if (!q.above && q.bytes >= opts_.highWatermark) crossed = q.above = true;
+    }
+    if (crossed && opts_.onWatermark) opts_.onWatermark(peer, true);
+    return true;
+}
+
+bool SendQueue::pop(Item& out, Clock::duration& retry) {
+    retry = Clock::duration::max();
+    auto now = Clock::now();
+    bool got = false, crossed = false;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        prune(now);
+        for (size_t idle = 0; idle < kClasses && !got;) {
+            const size_t c = cls_;
+            auto& turn = turn_[c];
+            // the class's first peer within its rate
+            size_t i = 0;
+            while (i < turn.size() && !ready(turn[i], queues_.find(turn[i])->second, c, now, retry)) ++i;
+            if (i == turn.size()) {
+                // nothing it can send: an idle class keeps no credit
+                deficit_[c] = 0;
+                cls_ = (cls_ + 1) % kClasses;
+                fresh_ = true;
+                ++idle;
+                continue;
+            }
+            idle = 0;
+            if (fresh_) { deficit_[c] += opts_.quantum[c]; fresh_ = false; }
+            PeerId peer = turn[i];
+            PeerQueue& q = queues_.find(peer)->second;
+            size_t size = q.items[c].front().data.size();
+            if (size > deficit_[c]) {
+                // not enough credit yet; it carries over to the class's next turn
+                cls_ = (cls_ + 1) % kClasses;
+                fresh_ = true;
+                continue;
+            }
+            deficit_[c] -= size;
+            out = std::move(q.items[c].front());
+            q.items[c].pop_front();
+            turn.erase(turn.begin() + static_cast<std::ptrdiff_t>(i));
+            if (!q.items[c].empty()) turn.push_back(peer);
+            else if (turn.empty()) deficit_[c] = 0;
+            if (rateOf(peer, c)) q.buckets[c].tokens -= double(size);
+            q.bytes -= size;
+            bytes_ -= size;
+            if (q.above && q.bytes < opts_.lowWatermark) { q.above = false; crossed = true; }
+            release(peer, now);
+            got = true;
+        }
+    }
+    if (crossed && opts_.onWatermark) opts_.onWatermark(out.peer, false);
+    return got;
+}
+
+void SendQueue::requeue(std::vector<Item>& items) {
+    std::vector<PeerId> crossed;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto now = Clock::now();
+        for (auto i = items.rbegin(); i != items.rend(); ++i) {
+            const size_t c = static_cast<size_t>(i->cls);
+            const size_t size = i->data.size();
+            PeerQueue& q = queueFor(i->peer, now);
+            // its peer goes next in the class
+            auto& turn = turn_[c];
+            auto t = std::find(turn.begin(), turn.end(), i->peer);
+            if (t != turn.end()) turn.erase(t);
+            turn.push_front(i->peer);
+            if (rateOf(i->peer, c)) q.buckets[c].tokens += double(size);
+            deficit_[c] += size;
+            q.bytes += size;
+            bytes_ += size;
+            if (!q.above && q.bytes >= opts_.highWatermark) { q.above = true; crossed.push_back(i->peer); }
+            q.items[c].push_front(std::move(*i));
+        }
+    }
+    items.clear();
+    if (opts_.onWatermark) for (const auto& p : crossed) opts_.onWatermark(p, true);
+}
+
+std::vector<SendQueue::Item> SendQueue::takeAll() {
+    std::vector<Item> out;
+    std::vector<PeerId> relieved;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        for (auto& [peer, q] : queues_) {
+            if (q.above) relieved.push_back(peer);
+            for (auto& items : q.items) for (auto& item : items) out.push_back(std::move(item));
+        }
+        queues_.clear();
+        for (auto& t : turn_) t.clear();
+        idle_.clear();
+        deficit_ = {};
+        bytes_ = 0;
+    }
+    if (opts_.onWatermark) for (const auto& p : relieved) opts_.onWatermark(p, false);
+    return out;
+}
+
+void SendQueue::setRate(const PeerId& peer, SendClass cls, uint64_t bytesPerSec) {
+    if (cls == SendClass::Auto) return;
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = rates_.try_emplace(peer, opts_.peerRate).first;
+    it->second[static_cast<size_t>(cls)] = bytesPerSec;
+    if (it->second == opts_.peerRate) rates_.erase(it);
+}
+
+size_t SendQueue::queuedBytes(const PeerId& peer) const {
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = queues_.find(peer);
+    return it == queues_.end() ? 0 : it->second.bytes;
+}
+
+size_t SendQueue::queuedBytes() const {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return bytes_;
+}
+
+} // namespace p2p
@@ -0,0 +1,338 @@
+#include "p2p/Session.hpp"
+#include "p2p/Message.hpp"
+
+#include <sodium.h>
+#include <algorithm>
+#include <cstring>
+
+namespace p2p {
+
+static void put32(std::vector<uint8_t>& out, uint32_t v) {
+    out.push_back((v>>24)&0xFF); out.push_back((v>>16)&0xFF); out.push_back((v>>8)&0xFF); out.push_back(v&0xFF);
+}
+
+static uint32_t get32(const uint8_t* p) {
+    return (static_cast<uint32_t>(p[0])<<24) | (static_cast<uint32_t>(p[1])<<16) | (static_cast<uint32_t>(p[2])<<8) | p[3];
+}
+
+// keys are per direction and per session, so session|counter never repeats under one key
+static crypto::AeadNonce makeNonce(uint32_t session, uint64_t counter) {
+    crypto::AeadNonce n{};
+    for (int i = 0; i < 4; ++i) n[i] = (session >> (24 - 8*i)) & 0xFF;
+    for (int i = 0; i < 8; ++i) n[4+i] = (counter >> (56 - 8*i)) & 0xFF;
+    return n;
+}
+
+// everything in the header but the ttl, which relays rewrite
+using Ad = std::array<uint8_t, 32+32+4+8>;
+static Ad makeAd(const PeerId& sender, const PeerId& dest, uint32_t session, uint64_t counter) {
+    Ad ad{};
+    std::memcpy(ad.data(), sender.data(), 32);
+    std::memcpy(ad.data()+32, dest.data(), 32);
+    for (int i = 0; i < 4; ++i) ad[64+i] = (session >> (24 - 8*i)) & 0xFF;
+    for (int i = 0; i < 8; ++i) ad[68+i] = (counter >> (56 - 8*i)) & 0xFF;
+    return ad;
+}
+
+SessionTable::~SessionTable() {
+    for (auto& [id, st] : peers_) {
+        for (auto& s : st.sessions) wipe(s);
+        if (st.pending) sodium_memzero(st.pending->sec.data(), st.pending->sec.size());
+    }
+    for (auto& [id, p] : resyncs_) sodium_memzero(p.sec.data(), p.sec.size());
+}
+
+void SessionTable::wipe(Session& s) {
+    sodium_memzero(s.rx.data(), s.rx.size());
+    sodium_memzero(s.tx.data(), s.tx.size());
+}
+
+void SessionTable::install(PeerState& st, Session s) {
+    auto same = std::find_if(st.sessions.begin(), st.sessions.end(), [&](const Session& x){ return x.id == s.id; });
+    if (same != st.sessions.end()) { wipe(*same); st.sessions.erase(same); }
+    while (st.sessions.size() >= kMaxSessions) {
+        // oldest first, but never the one we are sending on
+        auto victim = std::find_if(st.sessions.begin(), st.sessions.end(), [&](const Session& x){ return x.id != st.active; });
+        if (victim == st.sessions.end()) victim = st.sessions.begin();
+        if (victim->id == st.active) st.active = 0;
+        wipe(*victim);
+        st.sessions.erase(victim);
+    }
+    if (s.confirmed) st.active = s.id;
+    st.sessions.push_back(s);
+}
+
+SessionTable::Pending SessionTable::makePending(Clock::time_point now) {
+    Pending p{};
+    do { p.id = randombytes_random(); } while (p.id == 0);
+    crypto_kx_keypair(p.pub.data(), p.sec.data());
+    p.sentAt = now;
+    return p;
+}
+
+std::vector<uint8_t> SessionTable::hello(const Pending& p, const uint8_t* nonce) {
+    std::vector<uint8_t> msg;
+    msg.reserve(1+1+4+32+kNonceBytes);
+    msg.push_back(static_cast<uint8_t>(Frame::SESSION_HELLO));
+    msg.push_back(nonce ? 1 : 0); // reset flag
+    put32(msg, p.id);
+    msg.insert(msg.end(), p.pub.begin(), p.pub.end());
+    if (nonce) msg.insert(msg.end(), nonce, nonce + kNonceBytes);
+    return msg;
+}
+
+template <typename Map, typename At>
+bool SessionTable::makeRoom(Map& m, Clock::time_point now, At at) {
+    if (m.size() < kMaxResyncs) return true;
+    for (auto it = m.begin(); it != m.end();) {
+        if (now - at(it->second) < kResetEvery) { ++it; continue; }
+        it = m.erase(it);
+    }
+    return m.size() < kMaxResyncs;
+}
+
+std::vector<uint8_t> SessionTable::initiate(const PeerId& peer) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    PeerState& st = peers_[peer];
+    if (st.active != 0) return {};
+    auto now = Clock::now();
+    if (st.pending && now - st.pending->sentAt < std::chrono::seconds(1)) return {};
+    if (st.pending) sodium_memzero(st.pending->sec.data(), st.pending->sec.size());
+    st.pending = makePending(now);
+    return hello(*st.pending);
+}
+
+std::vector<uint8_t> SessionTable::resync(const PeerId& peer, uint32_t session) {
+    auto now = Clock::now();
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = resets_.find(peer);
+    if (it != resets_.end() && now - it->second < kResetEvery) return {};
+    if (it == resets_.end() && !makeRoom(resets_, now, [](Clock::time_point t){ return t; })) return {};
+    resets_[peer] = now;
+    std::vector<uint8_t> msg;
+    msg.reserve(1+4);
+    msg.push_back(static_cast<uint8_t>(Frame::SESSION_RESET));
+    put32(msg, session);
+    return msg;
+}
+
+std::vector<uint8_t> SessionTable::challenge(const PeerId& peer, const std::vector<uint8_t>& reset) {
+    if (reset.size() != 4) return {};
+    uint32_t id = get32(reset.data());
+    auto now = Clock::now();
+    std::lock_guard<std::mutex> lock(mtx_);
+    // a RESET for anything but the session we send on is stale or forged
+    auto st = peers_.find(peer);
+    if (id == 0 || st == peers_.end() || st->second.active != id) return {};
+    auto it = challenges_.find(peer);
+    if (it != challenges_.end() && now - it->second.sentAt < kResetEvery) return {};
+    if (it == challenges_.end() && !makeRoom(challenges_, now, [](const Challenge& c){ return c.sentAt; })) return {};
+    Challenge& c = challenges_[peer];
+    randombytes_buf(c.nonce.data(), c.nonce.size());
+    c.sentAt = now;
+    std::vector<uint8_t> msg;
+    msg.reserve(1+4+kNonceBytes);
+    msg.push_back(static_cast<uint8_t>(Frame::SESSION_CHALLENGE));
+    put32(msg, id);
+    msg.insert(msg.end(), c.nonce.begin(), c.nonce.end());
+    return msg;
+}
+
+std::vector<uint8_t> SessionTable::answer(const PeerId& peer, const std::vector<uint8_t>& challenge) {
+    if (challenge.size() != 4+kNonceBytes) return {};
+    uint32_t id = get32(challenge.data());
+    auto now = Clock::now();
+    std::lock_guard<std::mutex> lock(mtx_);
+    // we still have it: nothing to reset, whoever sent the packet that started this
+    auto st = peers_.find(peer);
+    if (st != peers_.end() && std::any_of(st->second.sessions.begin(), st->second.sessions.end(),
+                                          [&](const Session& s){ return s.id == id; })) return {};
+    auto it = resyncs_.find(peer);
+    if (it != resyncs_.end()) {
+        if (now - it->second.sentAt < kResetEvery) return {};
+        sodium_memzero(it->second.sec.data(), it->second.sec.size());
+        resyncs_.erase(it);
+    }
+    if (resyncs_.size() >= kMaxResyncs) {
+        for (auto r = resyncs_.begin(); r != resyncs_.end();) {
+            if (now - r->second.sentAt < kResetEvery) { ++r; continue; }
+            sodium_memzero(r->second.sec.data(), r->second.sec.size());
+            r = resyncs_.erase(r);
+        }
+        if (resyncs_.size() >= kMaxResyncs) return {};
+    }
+    const Pending& p = resyncs_.emplace(peer, makePending(now)).first->second;
+    return hello(p, challenge.data() + 4);
+}
+
+std::vector<uint8_t> SessionTable::accept(const PeerId& peer, const std::vector<uint8_t>& hello) {
+    if (hello.empty()) return {};
+    bool reset = hello[0] & 1;
+    if (hello.size() != 1+4+32 + (reset ? kNonceBytes : 0)) return {};
+    uint32_t id = get32(hello.data()+1);
+    if (id == 0) return {};
+    const uint8_t* clientPub = hello.data()+5;
+    if (reset) {
+        // only the answer to our own open challenge, and only once
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto c = challenges_.find(peer);
+        if (c == challenges_.end() || Clock::now() - c->second.sentAt >= kResetEvery ||
+            sodium_memcmp(c->second.nonce.data(), hello.data()+1+4+32, kNonceBytes) != 0) return {};
+        challenges_.erase(c);
+    }
+
+    KeyBytes pub{}, sec{};
+    crypto_kx_keypair(pub.data(), sec.data());
+    Session s{};
+    s.id = id;
+    int rc = crypto_kx_server_session_keys(s.rx.data(), s.tx.data(), pub.data(), sec.data(), clientPub);
+    sodium_memzero(sec.data(), sec.size());
+    if (rc != 0) return {};
+
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        PeerState& st = peers_[peer];
+        if (reset) {
+            // the peer lost its state; nothing we hold is usable any more
+            for (auto& x : st.sessions) wipe(x);
+            st.sessions.clear();
+            st.active = 0;
+        }
+        install(st, s);
+    }
+    wipe(s);
+
+    std::vector<uint8_t> msg;
+    msg.reserve(1+4+32);
+    msg.push_back(static_cast<uint8_t>(Frame::SESSION_ACCEPT));
+    put32(msg, id);
+    msg.insert(msg.end(), pub.begin(), pub.end());
+    return msg;
+}
+
+bool SessionTable::complete(const PeerId& peer, const std::vector<uint8_t>& acceptBody) {
+    if (acceptBody.size() != 4+32) return false;
+    uint32_t id = get32(acceptBody.data());
+    const uint8_t* serverPub = acceptBody.data()+4;
+
+    std::lock_guard<std::mutex> lock(mtx_);
+    Pending p{};
+    auto it = peers_.find(peer);
+    if (it != peers_.end() && it->second.pending && it->second.pending->id == id) {
+        p = *it->second.pending;
+        sodium_memzero(it->second.pending->sec.data(), it->second.pending->sec.size());
+        it->second.pending.reset();
+    } else {
+        // the answer to a reset; the entry stays behind as the rate limit
+        auto r = resyncs_.find(peer);
+        if (r == resyncs_.end() || r->second.id != id) return false;
+        p = r->second;
+        sodium_memzero(r->second.sec.data(), r->second.sec.size());
+        r->second.id = 0;
+    }
+    Session s{};
+    s.id = id;
+    s.confirmed = true;
+    int rc = crypto_kx_client_session_keys(s.rx.data(), s.tx.data(), p.pub.data(), p.sec.data(), serverPub);
+    sodium_memzero(p.sec.data(), p.sec.size());
+    if (rc != 0) return false;
+    // the ACCEPT came signed, so the peer is who it says
+    install(peers_[peer], s);
+    wipe(s);
+    return true;
+}
+
+bool SessionTable::seal(const PeerId& self, const PeerId& dest, const std::vector<uint8_t>& plaintext, Packet& out) {
+    crypto::AeadKey key{};
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto it = peers_.find(dest);
+        if (it == peers_.end() || it->second.active == 0) return false;
+        PeerState& st = it->second;
+        auto s = std::find_if(st.sessions.begin(), st.sessions.end(), [&](const Session& x){ return x.id == st.active; });
+        if (s == st.sessions.end()) return false;
+        key = s->tx;
+        out.session = s->id;
+        out.counter = ++s->txCounter;
+    }
+    out.kind = Packet::Kind::Session;
+    out.sender = self;
+    out.dest = dest;
+    out.ttl = 8;
+    auto ad = makeAd(out.sender, out.dest, out.session, out.counter);
+    out.payload = crypto::aeadEncrypt(key, makeNonce(out.session, out.counter), std::vector<uint8_t>(ad.begin(), ad.end()), plaintext);
+    sodium_memzero(key.data(), key.size());
+    return !out.payload.empty();
+}
+
+bool SessionTable::replayed(const Session& s, uint64_t counter) {
+    if (counter == 0) return true;
+    if (counter > s.rxHighest) return false;
+    uint64_t behind = s.rxHighest - counter;
+    if (behind >= kReplayWindow) return true;
+    return (s.rxWindow >> behind) & 1;
+}
+
+void SessionTable::markSeen(Session& s, uint64_t counter) {
+    if (counter > s.rxHighest) {
+        uint64_t shift = counter - s.rxHighest;
+        s.rxWindow = shift >= kReplayWindow ? 0 : (s.rxWindow << shift);
+        s.rxWindow |= 1;
+        s.rxHighest = counter;
+    } else {
+        s.rxWindow |= 1ull << (s.rxHighest - counter);
+    }
+}
+
+SessionTable::OpenResult SessionTable::open(PacketView& pkt, ByteView& plaintext) {
+    crypto::AeadKey key{};
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto it = peers_.find(pkt.sender);
+        if (it == peers_.end()) return OpenResult::UnknownSession;
+        auto& ss = it->second.sessions;
+        auto s = std::find_if(ss.begin(), ss.end(), [&](const Session& x){ return x.id == pkt.session; });
+        if (s == ss.end()) return OpenResult::UnknownSession;
+        if (replayed(*s, pkt.counter)) return OpenResult::Rejected;
+        key = s->rx;
+    }
+    auto ad = makeAd(pkt.sender, pkt.dest, pkt.session, pkt.counter);
+    size_t ptLen = 0;
+    bool ok = crypto::aeadDecryptInPlace(key, makeNonce(pkt.session, pkt.counter), ad.data(), ad.size(),
+                                         pkt.mutablePayload(), pkt.payload().size(), ptLen);
+    sodium_memzero(key.data(), key.size());
+    if (!ok) return OpenResult::Rejected;
+    plaintext = ByteView(pkt.mutablePayload(), ptLen);
+
+    // commit under the lock: a duplicate may have raced us from another shard
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = peers_.find(pkt.sender);
+    if (it == peers_.end()) return OpenResult::Rejected;
+    PeerState& st = it->second;
+    auto s = std::find_if(st.sessions.begin(), st.sessions.end(), [&](const Session& x){ return x.id == pkt.session; });
+    if (s == st.sessions.end() || replayed(*s, pkt.counter)) return OpenResult::Rejected;
+    markSeen(*s, pkt.counter);
+    if (!s->confirmed) {
+        // the initiator has the keys now; switch our sends over
+        s->confirmed = true;
+        st.active = s->id;
+    }
+    return OpenResult::Ok;
+}
+
+bool SessionTable::active(const PeerId& peer) const {
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = peers_.find(peer);
+    return it != peers_.end() && it->second.active != 0;
+}
+
+void SessionTable::drop(const PeerId& peer) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    auto it = peers_.find(peer);
+    if (it == peers_.end()) return;
+    for (auto& s : it->second.sessions) wipe(s);
+    if (it->second.pending) sodium_memzero(it->second.pending->sec.data(), it->second.pending->sec.size());
+    peers_.erase(it);
+}
+
+} // namespace p2p
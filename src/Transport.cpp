@@ -14,10 +14,70 @@ using ssize_t = SSIZE_T;
 #include <fcntl.h>
 #endif
 
+#include <algorithm>
+#include <cerrno>
 #include <cstring>
 
 namespace p2p {
 
+// v4 endpoints go out of a v6 socket as v4-mapped addresses; 0 if this socket cannot reach ep
+static socklen_t toSockaddr(const Endpoint& ep, int family, sockaddr_storage& ss) {
+    std::memset(&ss, 0, sizeof(ss));
+    if (family == AF_INET) {
+        if (ep.family != Endpoint::Family::V4) return 0;
+        auto* a = reinterpret_cast<sockaddr_in*>(&ss);
+        a->sin_family = AF_INET;
+        a->sin_port = htons(ep.port);
+        std::memcpy(&a->sin_addr, ep.addr.data(), 4);
+        return sizeof(sockaddr_in);
+    }
+    auto* a = reinterpret_cast<sockaddr_in6*>(&ss);
+    a->sin6_family = AF_INET6;
+    a->sin6_port = htons(ep.port);
+    if (ep.family == Endpoint::Family::V6) {
+        std::memcpy(&a->sin6_addr, ep.addr.data(), 16);
+        a->sin6_scope_id = ep.scope;
+    } else if (ep.family == Endpoint::Family::V4) {
+        uint8_t* b = reinterpret_cast<uint8_t*>(&a->sin6_addr);
+        b[10] = 0xFF; b[11] = 0xFF;
+        std::memcpy(b + 12, ep.addr.data(), 4);
+    } else {
+        return 0;
+    }
+    return sizeof(sockaddr_in6);
+}
+
+static Endpoint fromSockaddr(const sockaddr_storage& ss) {
+    if (ss.ss_family == AF_INET) {
+        const auto* a = reinterpret_cast<const sockaddr_in*>(&ss);
+        return Endpoint::v4(reinterpret_cast<const uint8_t*>(&a->sin_addr), ntohs(a->sin_port));
+    }
+    if (ss.ss_family == AF_INET6) {
+        const auto* a = reinterpret_cast<const sockaddr_in6*>(&ss);
+        const uint8_t* b = reinterpret_cast<const uint8_t*>(&a->sin6_addr);
+        static const uint8_t kMapped[12] = {0,0,0,0,0,0,0,0,0,0,0xFF,0xFF};
+        if (std::memcmp(b, kMapped, 12) == 0) return Endpoint::v4(b + 12, ntohs(a->sin6_port));
+        return Endpoint::v6(b, ntohs(a->sin6_port), a->sin6_scope_id);
+    }
+    return Endpoint{};
+}
+
+// parses in place: a packet takes the slot's buffer with it, anything else leaves it for reuse
+static void dispatch(BufferRef& slot, size_t n, const sockaddr_storage& src,
+                     const Transport::PacketHandler& pktHandler, const Transport::RawHandler& rawHandler) {
+    Endpoint from = fromSockaddr(src);
+    const uint8_t* buf = slot.data();
+    // Discovery beacons start with "DISC"
+    if (n >= 4 && buf[0]=='D' && buf[1]=='I' && buf[2]=='S' && buf[3]=='C') {
+        if (rawHandler) rawHandler(ByteView(buf, n), from);
+    } else {
+        PacketView pkt;
+        if (PacketView::parse(slot, n, pkt)) {
+            if (pktHandler) pktHandler(pkt, from);
+        }
+    }
+}
+
 Transport::Transport() {
 #ifdef _WIN32
     WSADATA wsaData;
@@ -25,73 +85,311 @@ Transport::Transport() {
 #endif
 }
 
-Transport::~Transport() {
-    if (sock_ >= 0) {
+static void closeSocket(int s) {
 #ifdef _WIN32
-        closesocket(sock_);
+    closesocket(s);
 #else
-        close(sock_);
+    close(s);
 #endif
-    }
+}
+
+Transport::~Transport() {
+    for (int s : socks_) closeSocket(s);
+    if (bcast_ >= 0) closeSocket(bcast_);
 #ifdef _WIN32
     WSACleanup();
 #endif
 }
 
-bool Transport::bind(const std::string& ip, uint16_t port) {
-    sock_ = ::socket(AF_INET, SOCK_DGRAM, 0);
-    if (sock_ < 0) return false;
+// an IPv6 bind address gets a dual-stack socket; anything else stays IPv4
+static int openSocket(const std::string& ip, uint16_t port, bool reusePort, int& family) {
+    Endpoint local(ip, port);
+    family = local.family == Endpoint::Family::V6 ? AF_INET6 : AF_INET;
+    if (!ip.empty() && local.family == Endpoint::Family::None) return -1;
+    int s = ::socket(family, SOCK_DGRAM, 0);
+    if (s < 0) return -1;
 
     int yes = 1;
-    ::setsockopt(sock_, SOL_SOCKET, SO_REUSEADDR, (const char*)&yes, sizeof(yes));
-    ::setsockopt(sock_, SOL_SOCKET, SO_BROADCAST, (const char*)&yes, sizeof(yes));
+    ::setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char*)&yes, sizeof(yes));
+    ::setsockopt(s, SOL_SOCKET, SO_BROADCAST, (const char*)&yes, sizeof(yes));
+    // a fragmented message lands as one burst; ask for deep buffers (the kernel caps them)
+    int depth = 4 << 20;
+    ::setsockopt(s, SOL_SOCKET, SO_RCVBUF, (const char*)&depth, sizeof(depth));
+    ::setsockopt(s, SOL_SOCKET, SO_SNDBUF, (const char*)&depth, sizeof(depth));
+#ifdef SO_REUSEPORT
+    if (reusePort) ::setsockopt(s, SOL_SOCKET, SO_REUSEPORT, (const char*)&yes, sizeof(yes));
+#else
+    (void)reusePort;
+#endif
 
-    sockaddr_in addr{};
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port);
-    addr.sin_addr.s_addr = ip.empty() ? INADDR_ANY : ::inet_addr(ip.c_str());
-    if (::bind(sock_, (sockaddr*)&addr, sizeof(addr)) < 0) return false;
+    if (family == AF_INET6) {
+        int no = 0;
+        ::setsockopt(s, IPPROTO_IPV6, IPV6_V6ONLY, (const char*)&no, sizeof(no));
+    }
+    // don't-fragment on everything: the router sizes datagrams to the probed
+    // path MTU, and a probe that is too big must be lost rather than split
+#if defined(IP_MTU_DISCOVER) && defined(IP_PMTUDISC_PROBE)
+    int probe = IP_PMTUDISC_PROBE;
+    ::setsockopt(s, IPPROTO_IP, IP_MTU_DISCOVER, (const char*)&probe, sizeof(probe));
+#if defined(IPV6_MTU_DISCOVER) && defined(IPV6_PMTUDISC_PROBE)
+    int probe6 = IPV6_PMTUDISC_PROBE;
+    if (family == AF_INET6) ::setsockopt(s, IPPROTO_IPV6, IPV6_MTU_DISCOVER, (const char*)&probe6, sizeof(probe6));
+#endif
+#elif defined(IP_DONTFRAG)
+    ::setsockopt(s, IPPROTO_IP, IP_DONTFRAG, (const char*)&yes, sizeof(yes));
+#endif
+    if (ip.empty()) local = Endpoint("0.0.0.0", port);
+    sockaddr_storage addr{};
+    socklen_t alen = toSockaddr(local, family, addr);
+    if (::bind(s, (sockaddr*)&addr, alen) < 0) { closeSocket(s); return -1; }
 
     // set non-blocking
 #ifdef _WIN32
     u_long mode = 1;
-    ioctlsocket(sock_, FIONBIO, &mode);
+    ioctlsocket(s, FIONBIO, &mode);
 #else
-    int flags = fcntl(sock_, F_GETFL, 0);
-    fcntl(sock_, F_SETFL, flags | O_NONBLOCK);
+    int flags = fcntl(s, F_GETFL, 0);
+    fcntl(s, F_SETFL, flags | O_NONBLOCK);
 #endif
+    return s;
+}
 
-    // get bound port
-    socklen_t slen = sizeof(addr);
-    if (::getsockname(sock_, (sockaddr*)&addr, &slen) == 0) {
-        boundPort_ = ntohs(addr.sin_port);
+// unbound AF_INET socket for v4 broadcasts from a dual-stack node
+static int openBroadcastSocket() {
+    int s = ::socket(AF_INET, SOCK_DGRAM, 0);
+    if (s < 0) return -1;
+    int yes = 1;
+    ::setsockopt(s, SOL_SOCKET, SO_BROADCAST, (const char*)&yes, sizeof(yes));
+#ifdef _WIN32
+    u_long mode = 1;
+    ioctlsocket(s, FIONBIO, &mode);
+#else
+    fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+#endif
+    return s;
+}
+
+bool Transport::bind(const std::string& ip, uint16_t port, size_t shards) {
+#ifndef SO_REUSEPORT
+    shards = 1;
+#endif
+    if (shards == 0) shards = 1;
+    for (size_t i = 0; i < shards; ++i) {
+        // later shards join the port the first one got
+        int s = openSocket(ip, i == 0 ? port : boundPort_, shards > 1, family_);
+        if (s < 0) {
+            if (i == 0) return false;
+            break;
+        }
+        socks_.push_back(s);
+        if (i == 0) {
+            // get bound port
+            sockaddr_storage addr{};
+            socklen_t slen = sizeof(addr);
+            if (::getsockname(s, (sockaddr*)&addr, &slen) == 0) {
+                boundPort_ = fromSockaddr(addr).port;
+            }
+        }
     }
+    sock_ = socks_.front();
+    rxSlots_.resize(socks_.size());
+    // a v6 socket cannot send to 255.255.255.255, not even v4-mapped
+    if (family_ == AF_INET6) bcast_ = openBroadcastSocket();
     return true;
 }
 
-bool Transport::send(const std::string& ip, uint16_t port, const Packet& pkt) {
+static bool wouldBlock() {
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS;
+#endif
+}
+
+bool Transport::sendTo(const Endpoint& to, const uint8_t* data, size_t len) {
     if (sock_ < 0) return false;
+    sockaddr_storage addr;
+    socklen_t alen = toSockaddr(to, family_, addr);
+    if (alen == 0) return false;
+    // keep ordering behind anything already queued
+    if (hasPending_.load(std::memory_order_acquire)) return enqueue(to, data, len);
+    ssize_t n = ::sendto(sock_, (const char*)data, len, 0, (sockaddr*)&addr, alen);
+    if (n == (ssize_t)len) return true;
+    if (n < 0 && wouldBlock()) return enqueue(to, data, len);
+    return false;
+}
+
+// the hook runs under pendMtx_ in both directions, so hook(true) from an
+// enqueue can never be overtaken by the hook(false) of the flush before it
+bool Transport::enqueue(const Endpoint& to, const uint8_t* data, size_t len) {
+    std::lock_guard<std::mutex> lock(pendMtx_);
+    if (pending_.size() >= kMaxPending) return false;
+    pending_.push_back(Datagram{to, std::vector<uint8_t>(data, data + len)});
+    if (!hasPending_.exchange(true, std::memory_order_acq_rel) && writableHook_) writableHook_(true);
+    return true;
+}
+
+void Transport::flush() {
+    if (sock_ < 0) return;
+    std::lock_guard<std::mutex> lock(pendMtx_);
+    while (!pending_.empty()) {
+        const Datagram& d = pending_.front();
+        sockaddr_storage addr;
+        socklen_t alen = toSockaddr(d.to, family_, addr);
+        ssize_t n = ::sendto(sock_, (const char*)d.bytes.data(), d.bytes.size(), 0, (sockaddr*)&addr, alen);
+        if (n < 0 && wouldBlock()) return; // wait for the next writable edge
+        pending_.pop_front();
+    }
+    if (hasPending_.exchange(false, std::memory_order_acq_rel) && writableHook_) writableHook_(false);
+}
+
+size_t Transport::pendingCount() const {
+    std::lock_guard<std::mutex> lock(pendMtx_);
+    return pending_.size();
+}
+
+bool Transport::send(const Endpoint& to, const Packet& pkt) {
     auto buf = pkt.serialize();
-    sockaddr_in addr{};
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port);
-    addr.sin_addr.s_addr = ::inet_addr(ip.c_str());
-    ssize_t n = ::sendto(sock_, (const char*)buf.data(), buf.size(), 0, (sockaddr*)&addr, sizeof(addr));
-    return n == (ssize_t)buf.size();
+    return sendTo(to, buf.data(), buf.size());
 }
 
-bool Transport::sendRaw(const std::string& ip, uint16_t port, const std::vector<uint8_t>& data) {
-    if (sock_ < 0) return false;
-    sockaddr_in addr{};
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port);
-    addr.sin_addr.s_addr = ::inet_addr(ip.c_str());
-    ssize_t n = ::sendto(sock_, (const char*)data.data(), data.size(), 0, (sockaddr*)&addr, sizeof(addr));
-    return n == (ssize_t)data.size();
+bool Transport::sendRaw(const Endpoint& to, ByteView data) {
+    return sendTo(to, data.data(), data.size());
+}
+
+bool Transport::sendBroadcast(uint16_t port, ByteView data) {
+    static const uint8_t kAll[4] = {255, 255, 255, 255};
+    if (family_ != AF_INET6) return sendRaw(Endpoint::v4(kAll, port), data);
+    // dual-stack: v4 neighbours through the broadcast socket, v6 ones through
+    // the link-local all-nodes group, which every host is a member of
+    static const uint8_t kAllNodes[16] = {0xFF, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
+    bool sent = false;
+    if (bcast_ >= 0) {
+        sockaddr_storage addr;
+        socklen_t alen = toSockaddr(Endpoint::v4(kAll, port), AF_INET, addr);
+        sent = ::sendto(bcast_, (const char*)data.data(), data.size(), 0, (sockaddr*)&addr, alen) == (ssize_t)data.size();
+    }
+    return sendRaw(Endpoint::v6(kAllNodes, port), data) || sent;
+}
+
+size_t Transport::sendBatch(const std::vector<Datagram>& batch, std::vector<size_t>* unsent) {
+    if (unsent) unsent->clear();
+    if (sock_ < 0) {
+        if (unsent) for (size_t i = 0; i < batch.size(); ++i) unsent->push_back(i);
+        return 0;
+    }
+    size_t sent = 0;
+    // queue batch[from..] behind the socket, keeping order
+    auto park = [&](size_t from) {
+        for (size_t i = from; i < batch.size(); ++i) {
+            const Datagram& d = batch[i];
+            sockaddr_storage addr;
+            if (toSockaddr(d.to, family_, addr) != 0 && enqueue(d.to, d.bytes.data(), d.bytes.size())) ++sent;
+            else if (unsent) unsent->push_back(i);
+        }
+    };
+#if defined(__linux__)
+    if (hasPending_.load(std::memory_order_acquire)) { park(0); return sent; }
+    constexpr size_t kChunk = 64;
+    sockaddr_storage addrs[kChunk];
+    iovec iovs[kChunk];
+    mmsghdr msgs[kChunk];
+    size_t idx[kChunk]; // slot -> batch index
+    size_t next = 0;
+    while (next < batch.size()) {
+        // datagrams this socket cannot reach are skipped
+        size_t cnt = 0;
+        for (; next < batch.size() && cnt < kChunk; ++next) {
+            const Datagram& d = batch[next];
+            socklen_t alen = toSockaddr(d.to, family_, addrs[cnt]);
+            if (alen == 0) { if (unsent) unsent->push_back(next); continue; }
+            iovs[cnt].iov_base = const_cast<uint8_t*>(d.bytes.data());
+            iovs[cnt].iov_len = d.bytes.size();
+            msgs[cnt] = mmsghdr{};
+            msgs[cnt].msg_hdr.msg_name = &addrs[cnt];
+            msgs[cnt].msg_hdr.msg_namelen = alen;
+            msgs[cnt].msg_hdr.msg_iov = &iovs[cnt];
+            msgs[cnt].msg_hdr.msg_iovlen = 1;
+            idx[cnt++] = next;
+        }
+        if (cnt == 0) break;
+        int r = ::sendmmsg(sock_, msgs, (unsigned)cnt, 0);
+        if (r <= 0) {
+            // socket buffer full: park the rest until writable
+            if (wouldBlock()) { park(idx[0]); return sent; }
+            // this one destination failed; the others still get theirs
+            if (unsent) unsent->push_back(idx[0]);
+            next = idx[0] + 1;
+            continue;
+        }
+        sent += (size_t)r;
+        // a short count stops at the message that failed; sending it again says why
+        if ((size_t)r < cnt) next = idx[r];
+    }
+    return sent;
+#else
+    for (size_t i = 0; i < batch.size(); ++i) {
+        if (sendRaw(batch[i].to, batch[i].bytes)) ++sent;
+        else if (unsent) unsent->push_back(i);
+    }
+    return sent;
+#endif
 }
 
-bool Transport::sendBroadcast(uint16_t port, const std::vector<uint8_t>& data) {
-    return sendRaw("255.255.255.255", port, data);
+size_t Transport::sendBatch(const std::vector<Endpoint>& dests, ByteView data) {
+    if (sock_ < 0) return 0;
+#if defined(__linux__)
+    if (hasPending_.load(std::memory_order_acquire)) {
+        size_t queued = 0;
+        for (const auto& d : dests) if (enqueue(d, data.data(), data.size())) ++queued;
+        return queued;
+    }
+    constexpr size_t kChunk = 64;
+    sockaddr_storage addrs[kChunk];
+    iovec iov{ const_cast<uint8_t*>(data.data()), data.size() };
+    mmsghdr msgs[kChunk];
+    size_t idx[kChunk]; // slot -> dests index
+    size_t next = 0, sent = 0;
+    while (next < dests.size()) {
+        // destinations this socket cannot reach are skipped
+        size_t cnt = 0;
+        for (; next < dests.size() && cnt < kChunk; ++next) {
+            socklen_t alen = toSockaddr(dests[next], family_, addrs[cnt]);
+            if (alen == 0) continue;
+            msgs[cnt] = mmsghdr{};
+            msgs[cnt].msg_hdr.msg_name = &addrs[cnt];
+            msgs[cnt].msg_hdr.msg_namelen = alen;
+            msgs[cnt].msg_hdr.msg_iov = &iov;
+            msgs[cnt].msg_hdr.msg_iovlen = 1;
+            idx[cnt++] = next;
+        }
+        if (cnt == 0) break;
+        int r = ::sendmmsg(sock_, msgs, (unsigned)cnt, 0);
+        if (r <= 0) {
+            if (wouldBlock()) {
+                // socket buffer full: park the rest until writable
+                for (size_t i = idx[0]; i < dests.size(); ++i) {
+                    sockaddr_storage addr;
+                    if (toSockaddr(dests[i], family_, addr) != 0 && enqueue(dests[i], data.data(), data.size())) ++sent;
+                }
+                break;
+            }
+            // one unreachable neighbour must not cost the others their copy
+            next = idx[0] + 1;
+            continue;
+        }
+        sent += (size_t)r;
+        // a short count stops at the message that failed; sending it again says why
+        if ((size_t)r < cnt) next = idx[r];
+    }
+    return sent;
+#else
+    size_t sent = 0;
+    for (const auto& d : dests) {
+        if (sendRaw(d, data)) ++sent;
+    }
+    return sent;
+#endif
 }
 
 void Transport::poll(int timeoutMs, const PacketHandler& pktHandler, const RawHandler& rawHandler) {
@@ -99,29 +397,71 @@ void Transport::poll(int timeoutMs, const PacketHandler& pktHandler, const RawHa
 
     fd_set rfds;
     FD_ZERO(&rfds);
-    FD_SET(sock_, &rfds);
+    int maxFd = -1;
+    for (int s : socks_) { FD_SET(s, &rfds); maxFd = std::max(maxFd, s); }
     timeval tv{ timeoutMs/1000, (timeoutMs%1000)*1000 };
-    int r = ::select(sock_+1, &rfds, nullptr, nullptr, &tv);
+    int r = ::select(maxFd+1, &rfds, nullptr, nullptr, &tv);
     if (r <= 0) return;
+    for (size_t i = 0; i < socks_.size(); ++i) {
+        if (FD_ISSET(socks_[i], &rfds)) receiveBatch(i, pktHandler, rawHandler);
+    }
+}
 
-    if (FD_ISSET(sock_, &rfds)) {
-        char buf[2048];
-        sockaddr_in src{}; socklen_t slen = sizeof(src);
-        ssize_t n = ::recvfrom(sock_, buf, sizeof(buf), 0, (sockaddr*)&src, &slen);
-        if (n > 0) {
-            std::string fromIp = ::inet_ntoa(src.sin_addr);
-            uint16_t fromPort = ntohs(src.sin_port);
-            // Discovery beacons start with "DISC"
-            if (n >= 4 && buf[0]=='D' && buf[1]=='I' && buf[2]=='S' && buf[3]=='C') {
-                if (rawHandler) rawHandler(std::vector<uint8_t>((uint8_t*)buf, (uint8_t*)buf + n), fromIp, fromPort);
-            } else {
-                Packet pkt{};
-                if (Packet::deserialize((uint8_t*)buf, (size_t)n, pkt)) {
-                    if (pktHandler) pktHandler(pkt, fromIp, fromPort);
-                }
-            }
-        }
+void Transport::drain(size_t shard, const PacketHandler& pktHandler, const RawHandler& rawHandler) {
+    if (shard >= socks_.size()) return;
+    // a short batch means the socket was empty when we looked
+    while (receiveBatch(shard, pktHandler, rawHandler) == recvBatch_) {}
+}
+
+size_t Transport::receiveBatch(size_t shard, const PacketHandler& pktHandler, const RawHandler& rawHandler) {
+    int sock = socks_[shard];
+    auto& slots = rxSlots_[shard];
+    // refill only the slots whose buffers went off with a packet last round
+    for (size_t i = 0; i < recvBatch_; ++i) {
+        if (!slots[i]) slots[i] = pool_.acquire();
     }
+#if defined(__linux__)
+    sockaddr_storage srcs[kMaxRecvBatch];
+    iovec iovs[kMaxRecvBatch];
+    mmsghdr msgs[kMaxRecvBatch];
+    for (size_t i = 0; i < recvBatch_; ++i) {
+        iovs[i].iov_base = slots[i].data();
+        iovs[i].iov_len = kMaxDatagram;
+        msgs[i] = mmsghdr{};
+        msgs[i].msg_hdr.msg_name = &srcs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(srcs[i]);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    int got = ::recvmmsg(sock, msgs, (unsigned)recvBatch_, MSG_DONTWAIT, nullptr);
+    if (got <= 0) return 0;
+    for (int i = 0; i < got; ++i) {
+        if (msgs[i].msg_len == 0) continue;
+        if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) { truncated_.fetch_add(1, std::memory_order_relaxed); continue; }
+        dispatch(slots[i], msgs[i].msg_len, srcs[i], pktHandler, rawHandler);
+    }
+    return (size_t)got;
+#else
+    size_t got = 0;
+    for (; got < recvBatch_; ++got) {
+        sockaddr_storage src{}; socklen_t slen = sizeof(src);
+#ifdef _WIN32
+        int n = ::recvfrom(sock, (char*)slots[got].data(), (int)kMaxDatagram, 0, (sockaddr*)&src, &slen);
+        if (n < 0 && WSAGetLastError() == WSAEMSGSIZE) { truncated_.fetch_add(1, std::memory_order_relaxed); continue; }
+        if (n <= 0) break;
+#else
+        iovec iov{ slots[got].data(), kMaxDatagram };
+        msghdr mh{};
+        mh.msg_name = &src; mh.msg_namelen = slen;
+        mh.msg_iov = &iov; mh.msg_iovlen = 1;
+        ssize_t n = ::recvmsg(sock, &mh, 0);
+        if (n <= 0) break;
+        if (mh.msg_flags & MSG_TRUNC) { truncated_.fetch_add(1, std::memory_order_relaxed); continue; }
+#endif
+        dispatch(slots[got], (size_t)n, src, pktHandler, rawHandler);
+    }
+    return got;
+#endif
 }
 
 } // namespace p2p
@@ -26,8 +26,8 @@ int main() {
     B.start();
 
     // manual bootstrap
-    Peer pA{A.identity().id, A.identity().publicKey, A.identity().signPublic, "127.0.0.1", 9001};
-    Peer pB{B.identity().id, B.identity().publicKey, B.identity().signPublic, "127.0.0.1", 9002};
+    Peer pA{A.identity().id, A.identity().publicKey, A.identity().signPublic, {"127.0.0.1", 9001}};
+    Peer pB{B.identity().id, B.identity().publicKey, B.identity().signPublic, {"127.0.0.1", 9002}};
     A.addPeer(pB);
     B.addPeer(pA);
 